@@ -0,0 +1,82 @@
+#pragma once
+
+#include <new>
+#include <cstdlib>
+#include <cstddef>
+
+#include "Stats.h"
+
+// Replaces the global allocation functions so Stats can count allocations. Replacements can only be defined once
+// per program, so include this in exactly one source file. Over-aligned allocations aren't counted.
+//
+// Define ALLOCATION_HOOKS_ENABLED as 0 to build with the standard allocation functions, which leaves allocations
+// uncounted and --max-allocs-per-line unavailable.
+#ifndef ALLOCATION_HOOKS_ENABLED
+#define ALLOCATION_HOOKS_ENABLED 1
+#endif
+
+#if ALLOCATION_HOOKS_ENABLED
+inline void* allocateCounted(std::size_t size) {
+    Stats::addAllocation(size);
+
+    if (size == 0) size = 1;
+    while (true) {
+        void* memory = std::malloc(size);
+        if (memory != nullptr) return memory;
+
+        // Give whoever's interested a chance to free something up, as the standard allocator would.
+        std::new_handler handler = std::get_new_handler();
+        if (handler == nullptr) throw std::bad_alloc();
+        handler();
+    }
+}
+
+void* operator new(std::size_t size) {
+    return allocateCounted(size);
+}
+void* operator new[](std::size_t size) {
+    return allocateCounted(size);
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return allocateCounted(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return allocateCounted(size);
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+// Once these are inlined (from -O1), GCC 11 on warns that free is given memory from operator new, not knowing that
+// operator new is replaced too, with memory from malloc. Here that pairing is exactly right.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+void operator delete[](void* memory) noexcept {
+    std::free(memory);
+}
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+void operator delete[](void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+void operator delete(void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+void operator delete[](void* memory, const std::nothrow_t&) noexcept {
+    std::free(memory);
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+#endif
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <iostream>
+
+#include "ChargePack.h"
+#include "DataAnalysis.h"
+#include "DatasetCache.h"
+#include "Incremental.h"
+#include "LineIndex.h"
+#include "ResultCache.h"
+#include "Stats.h"
+#include "Trace.h"
+
+/// Works out the summary of a file by whichever route is cheapest: a cached result, saved incremental state,
+/// or loading the data (through the in-memory data set cache, so repeats aren't parsed again).
+class Analyser {
+public:
+    /// How a summary came about.
+    enum class Route {
+        LOADED,
+        RESUMED,
+        CACHED
+    };
+
+    // Either cache may be nullptr to go without. Incremental state is used if the options ask for streaming analysis,
+    // which only reads text files through a stream, whatever the load settings say.
+    void init(const DataAnalysis::Options& options, ResultCache* results, DatasetCache* datasets,
+              const ChargeLoading::Settings& loadSettings = ChargeLoading::Settings()) {
+        m_options      = options;
+        m_optionsHash  = options.hash();
+        m_results      = results;
+        m_datasets     = datasets;
+        m_loadSettings = loadSettings;
+    }
+
+    // Analyses the given file, from its contents if they've already been read. Returns false if the file couldn't
+    // be read.
+    bool analyse(const std::string& filepath, DataAnalysis::Summary& summary, Route& route,
+                 const Sources::Memory::ContentsPtr& contents = nullptr) {
+        Trace::Scope fileTrace("file", "pipeline", filepath.c_str());
+
+        // Standard input and pipes can only be read once and might never end, so they skip the caches (hashing
+        // one for the result cache would use it up) and go straight into running statistics.
+        if (contents == nullptr && Sources::Stream::isStream(filepath)) {
+            if (!accumulate(filepath, summary)) return false;
+            route = Route::LOADED;
+            Stats::add(Stats::Counter::FILES);
+            return true;
+        }
+
+        // A charge pack carries exact sums in its block headers, which is quicker to summarise from than it is to
+        // look up in the result cache, even over a range where the blocks at its ends need decoding.
+        if (ChargePack::isPackPath(filepath)) {
+            ChargePack::Reader reader;
+            std::string error;
+            if (!reader.open(filepath, error, contents)) {
+                std::cerr << filepath << ": " << error << std::endl;
+                return false;
+            }
+            Stats::ScopedTimer timer(Stats::Phase::REDUCE);
+            summary = reader.summarise(m_options.range);
+            Stats::add(Stats::Counter::BYTES_READ, sizeof(ChargePack::FileHeader) + reader.getBlockCount() * sizeof(ChargePack::BlockHeader));
+            Stats::add(Stats::Counter::LINES, reader.getHeader().count);
+            route = Route::LOADED;
+            Stats::add(Stats::Counter::FILES);
+            return true;
+        }
+
+        // A sample only reads the lines it picks, through the file's line index, which is quicker than hashing the
+        // whole file for the result cache.
+        if (m_options.sampleSize > 0) {
+            LineIndex::Index index;
+            if (!LineIndex::getIndex(filepath, m_loadSettings.parserThreads, index)) {
+                std::cerr << "File: " << filepath << " couldn't be indexed to sample it (compressed files can't be)." << std::endl;
+                return false;
+            }
+            std::vector<double> charges;
+            unsigned int corruptCount = 0;
+            if (!LineIndex::sample(filepath, index, m_options.sampleSize, LineIndex::DEFAULT_SEED, charges, corruptCount)) return false;
+
+            Stats::ScopedTimer timer(Stats::Phase::REDUCE);
+            if (!m_options.range.isUnbounded()) {
+                summary = DataAnalysis::summarise(charges.data(), (unsigned int)charges.size(), m_options.range);
+            } else {
+                summary = DataAnalysis::summarise(charges.data(), (unsigned int)charges.size());
+            }
+            summary.corruptCount = corruptCount;
+            route = Route::LOADED;
+            Stats::add(Stats::Counter::FILES);
+            return true;
+        }
+
+        // Check the result cache before going anywhere near parsing the file.
+        ResultCache::Key key;
+        if (m_results != nullptr) {
+            Stats::ScopedTimer timer(Stats::Phase::CACHE_LOOKUP);
+            if (m_results->lookup(filepath, m_optionsHash, summary, key)) {
+                Stats::add(Stats::Counter::FILES);
+                route = Route::CACHED;
+                return true;
+            }
+        }
+
+        if (m_options.streaming && Decompression::detect(filepath) != Decompression::Format::NONE) {
+            // Saved state is an offset into the file's bytes, which means nothing for a compressed file, so
+            // those are read whole every time.
+            if (!accumulate(filepath, summary)) return false;
+            route = Route::LOADED;
+        } else if (m_options.streaming) {
+            Incremental::Outcome outcome;
+            if (!Incremental::analyseFile(filepath, outcome, m_loadSettings.reportCorruptPoints)) return false;
+
+            Stats::ScopedTimer timer(Stats::Phase::REDUCE);
+            summary = DataAnalysis::summarise(outcome.accumulator);
+            summary.corruptCount = outcome.corruptCount;
+            route = outcome.resumed ? Route::RESUMED : Route::LOADED;
+        } else {
+            DatasetCache::DatasetPtr dataset;
+            if (m_datasets != nullptr) {
+                dataset = m_datasets->get(filepath, contents);
+            } else {
+                dataset = DatasetCache::load(filepath, m_loadSettings, m_options.fixedPointDecimals, contents);
+            }
+            if (dataset == nullptr) return false;
+
+            Stats::ScopedTimer timer(Stats::Phase::REDUCE);
+            if (!dataset->scaledCharges.empty() && !m_options.range.isUnbounded()) {
+                unsigned decimals = dataset->scaledCharges.getDecimals();
+                FixedPoint::ScaledRange range = FixedPoint::getScaledRange(m_options.range, decimals);
+                summary = FixedPoint::summarise(FixedPoint::accumulate(dataset->scaledCharges, range), decimals);
+            } else if (!dataset->scaledCharges.empty()) {
+                summary = FixedPoint::summarise(FixedPoint::accumulate(dataset->scaledCharges), dataset->scaledCharges.getDecimals());
+            } else if (!m_options.range.isUnbounded()) {
+                summary = DataAnalysis::summarise(dataset->charges.data(), (unsigned int)dataset->charges.size(), m_options.range);
+            } else {
+                summary = DataAnalysis::summarise(dataset->charges.data(), (unsigned int)dataset->charges.size());
+            }
+            summary.corruptCount = dataset->corruptCount;
+            route = Route::LOADED;
+        }
+
+        if (m_results != nullptr) {
+            m_results->store(key, summary);
+        }
+        Stats::add(Stats::Counter::FILES);
+        return true;
+    }
+private:
+    // Summarises the file from running statistics, reading it front to back once.
+    bool accumulate(const std::string& filepath, DataAnalysis::Summary& summary) {
+        DataAnalysis::Accumulator accumulator;
+        unsigned int corruptCount = 0;
+        if (!ChargeLoading::accumulate(filepath, m_loadSettings, accumulator, corruptCount, m_options.range)) return false;
+
+        Stats::ScopedTimer timer(Stats::Phase::REDUCE);
+        summary = DataAnalysis::summarise(accumulator);
+        summary.corruptCount = corruptCount;
+        return true;
+    }
+
+    DataAnalysis::Options m_options;
+    uint64_t m_optionsHash = 0;
+
+    ResultCache*  m_results  = nullptr;
+    DatasetCache* m_datasets = nullptr;
+
+    ChargeLoading::Settings m_loadSettings;
+};
@@ -1,266 +1,422 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <string>
 #include <vector>
-#include <cctype>
 #include <fstream>
-#include <algorithm>
 #include <iostream>
-#include <iterator>
-#include <sstream>
-
-/// Collection of helper function to act on strings.
-namespace String {
-    // Trims a string from the left.
-    void ltrim(std::string& s) {
-        // Erase from the beginning of the string to wherever the first non-whitespace character is.
-        s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](char a) {
-            return !std::isspace((int)a);
-        }));
-    }
-    // Trims a string from the right.
-    void rtrim(std::string& s) {
-        // Erase from the end of the string to wherever the last non-whitespace character is.
-        s.erase(std::find_if(s.rbegin(), s.rend(), [](char a) {
-            return !std::isspace((int)a);
-        }).base(), s.end()); // base returns the string iterator of the found reverse iterator.
-    }
-    // Trims a string from both ends.
-    void trim(std::string& s) {
-        ltrim(s);
-        rtrim(s);
-    }
-}
+#include <optional>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "String.h"
+#include "Input.h"
+#include "ChargeDataModel.h"
+#include "DataAnalysis.h"
+#include "ResultCache.h"
+#include "DatasetCache.h"
+#include "Analyser.h"
+#include "CommandLine.h"
+#include "ResultSink.h"
+#include "Executor.h"
+#include "AsyncReader.h"
+#include "BatchReader.h"
+#include "ChargePack.h"
+#include "LineIndex.h"
+#include "SharedRing.h"
+#include "Stats.h"
+#include "Trace.h"
+#include "AllocationHooks.h"
+
+// Asks the user what to analyse and how, then does it.
+int runInteractive() {
+    // TODO(Matthew): Ask for the name of the file(s) they wish to load.
+    std::cout << "Welcome to Matt's impetuous charge calculator!" << std::endl;
 
-namespace Input {
-    // Compares two strings in a case-insensitive manner.
-    bool icompare(const std::string& a, const std::string& b) {
-        // Simple shortcut, two strings must be the same length to be the same.
-        if (a.length() != b.length()) return false;
+    std::vector<std::string> filesToLoad;
+    bool shouldContinue;
+    do {
+        std::cout << "Please enter the name of the file you wish to load:" << std::endl;
+        std::string temp;
+        std::getline(std::cin, temp);
+        filesToLoad.push_back(temp);
 
-        // Not-so-efficient algorithm that equates each pair of characters with the same index in the string objects' char arrays one at a time.
-        return std::equal(a.begin(), a.end(), b.begin(), [](char a, char b) {
-            // Case insensitive so simply force characters to their lower-case form.
-            return std::tolower(a) == std::tolower(b);
-        });
-    }
+        std::cout << "Is there another file you'd like to load? [y/n]" << std::endl;
+        shouldContinue = Input::getBool();
+    } while (shouldContinue);
 
-    // Gets a user choice between two sets of valid responses. Returns 1 where the user response was in the first set and -1 where the response was in the second set.
-    int getBetweenTwoStringSetOptions(std::string message, const std::vector<std::string>& firstStringSet, const std::vector<std::string>& secondStringSet) {
-        int response;
-        std::string line;
-        // Grab a line from the cin buffer.
-        while (std::getline(std::cin, line)) {
-            // Iterate over valid true strings and compare them with the grabbed line in a case-insensitive manner.
-            const auto& itTrue = std::find_if(firstStringSet.begin(), firstStringSet.end(), [&line](const std::string& a) {
-                return icompare(a, line);
-            });
-            // Iterate over valid false strings and compare them with the grabbed line in a case-insensitive manner.
-            const auto& itFalse = std::find_if(secondStringSet.begin(), secondStringSet.end(), [&line](const std::string& a) {
-                return icompare(a, line);
-            });
+    std::cout << "Would you like to keep analysis state beside each file, so re-runs only read newly appended data? [y/n]" << std::endl;
+    bool useIncremental = Input::getBool();
 
-            // If either iterator is not pointing at the end of their respective string arrays, then the grabbed line must have matched one of the valid strings in one of those arrays.
-            if (itTrue != firstStringSet.end()) {
-                response = 1;
-                break;
-            } else if (itFalse != secondStringSet.end()) {
-                response = -1;
-                break;
-            }
+    std::cout << "Would you like to reuse cached results for files that have been analysed before? [y/n]" << std::endl;
+    bool useCache = Input::getBool();
+
+    DataAnalysis::Options options;
+    options.streaming = useIncremental;
 
-            std::cout << "Sorry, the value you inputted was not valid." << std::endl;
-            std::cout << message;
+    ResultCache cache;
+    if (useCache) {
+        cache.init();
+        if (!cache.isUsable()) {
+            std::cout << "Could not create the result cache, carrying on without it." << std::endl;
         }
-        // Can only get here via the if block, but returning inside the if block makes VS throw a warning, I don't like warnings.
-        return response;
     }
 
-    // Gets a bool from the user.
-    bool getBool() {
-        static const std::vector<std::string> validTrues = {
-            "yes",
-            "y",
-            "true",
-            "1"
-        };
-        static const std::vector<std::string> validFalses = {
-            "no",
-            "n",
-            "false",
-            "0"
-        };
-
-        return getBetweenTwoStringSetOptions("Yay, or nay? [y/n]:\n", validTrues, validFalses) == 1;
+    // Files listed more than once only get loaded once.
+    DatasetCache datasets;
+    datasets.init();
+
+    Analyser analyser;
+    analyser.init(options, useCache ? &cache : nullptr, &datasets);
+
+    TextResultSink sink(std::cout);
+    for (std::string& file : filesToLoad) {
+        DataAnalysis::Summary summary;
+        Analyser::Route route;
+        if (!analyser.analyse(file, summary, route)) {
+            std::cout << "Could not open file: " << file << "." << std::endl
+                      << "Exiting..." << std::endl;
+            std::getchar();
+            exit(0);
+        }
+
+        sink.writeResult(file, summary, route);
+        // Someone's watching, don't keep them waiting for the rest.
+        sink.flush();
     }
+
+    std::cout << "Press any key to exit..." << std::endl;
+    std::getchar();
+    return 0;
 }
 
-/// Model that holds the charge data.
-class ChargeDataModel {
-public:
-    ChargeDataModel() {}
-    ~ChargeDataModel() {
-        dispose();
+// Takes charges from a shared-memory ring until its producer finishes, keeping running statistics rather than
+// the charges themselves so it can go on for as long as the producer does. Reports the statistics so far on
+// stderr every second. Only charges in the range count. Returns false if there was no ring to attach to.
+bool analyseLive(const std::string& name, const DataAnalysis::Range& range, DataAnalysis::Summary& summary) {
+    SharedRing::Consumer ring;
+    {
+        Stats::ScopedTimer timer(Stats::Phase::OPEN);
+        if (!ring.open(name)) return false;
     }
 
-    void init(std::string filepath = "millikan.dat") {
-        m_filepath = filepath;
-    }
-    void dispose() {
-        // Close file is still open.
-        if (m_file.is_open()) {
-            m_file.close();
+    RecordParsers::Binary parser;
+    DataAnalysis::Accumulator accumulator;
+    uint64_t corruptCount = 0;
+    uint64_t bytesRead = 0;
+    auto lastReport = std::chrono::steady_clock::now();
+
+    const char* data;
+    size_t size;
+    while (ring.next(data, size)) {
+        {
+            Stats::ScopedTimer timer(Stats::Phase::PARSE);
+            const char* const end = data + size;
+            while (const char* recordEnd = parser.findRecordEnd(data, end)) {
+                double charge;
+                if (parser.parseRecord(data, recordEnd, charge)) {
+                    if (range.contains(charge)) accumulator.add(charge);
+                } else {
+                    ++corruptCount;
+                }
+                data = recordEnd;
+            }
+            bytesRead += size;
         }
 
-        // Clear up memory.
-        if (m_charges != nullptr) {
-            delete[] m_charges;
-            m_charges = nullptr;
-        }
-    }
-    
-    double* getChargeData(unsigned int& size) {
-        // If we haven't yet loaded data from the file, do so.
-        if (m_charges == nullptr) {
-            loadDataFromFile(size);
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastReport >= std::chrono::seconds(1) && accumulator.getCount() > 1) {
+            std::cerr << "Live: " << accumulator.getCount() << " charge(s), mean " << accumulator.getMean()
+                      << "C, standard deviation " << accumulator.getStandardDeviation() << "C." << std::endl;
+            lastReport = now;
         }
-        return m_charges;
     }
-private:
-    bool openFile() {
-        m_file.open(m_filepath, std::ios::in);
-        return m_file.is_open();
+
+    if (ring.isProducerGone()) {
+        std::cerr << "The producer of shared ring: " << name << " stopped without finishing, results are for what it wrote." << std::endl;
     }
 
-    unsigned int getLineCount() {
-        // Make sure the file stream doesn't skip new lines as per default.
-        m_file.unsetf(std::ios_base::skipws);
+    Stats::add(Stats::Counter::BYTES_READ, bytesRead);
+    Stats::add(Stats::Counter::LINES, bytesRead / sizeof(double)); // Every record, in range or not.
+    Stats::add(Stats::Counter::CORRUPT_POINTS, corruptCount);
 
-        // Iterates over chars in the file, counting the 
-        // number of newline characters.
-        unsigned int count = std::count(
-            std::istream_iterator<char>(m_file),
-            std::istream_iterator<char>(),
-            '\n');
+    summary = DataAnalysis::summarise(accumulator);
+    summary.corruptCount = corruptCount;
+    return true;
+}
 
-        // Return file to prior condition.
-        m_file.clear();
-        m_file.seekg(0, std::ios::beg);
-        m_file.setf(std::ios_base::skipws);
+// Writes the file's charges out beside it as a charge pack (<file>.cpk) with the given decimal places. Takes them
+// from the data set cache, so a file that's just been analysed isn't parsed all over again. Returns false if
+// they couldn't be loaded, have more decimal places than that, or the pack couldn't be written.
+bool packFile(const std::string& file, const Sources::Memory::ContentsPtr& contents, unsigned decimals, DatasetCache& datasets) {
+    DatasetCache::DatasetPtr dataset = datasets.get(file, contents);
+    if (dataset == nullptr) return false;
 
-        return count;
+    // Held in fixed point already when --fixed-point asked for the same decimal places.
+    if (!dataset->scaledCharges.empty()) {
+        return ChargePack::write(file + ".cpk", dataset->scaledCharges, dataset->corruptCount);
+    }
+    FixedPoint::Charges charges;
+    if (!charges.assign(dataset->charges.data(), dataset->charges.size(), decimals)) {
+        std::cerr << "File: " << file << " has charges with more than " << decimals << " decimal places, so can't be packed." << std::endl;
+        return false;
     }
+    return ChargePack::write(file + ".cpk", charges, dataset->corruptCount);
+}
 
-    void loadDataFromFile(unsigned int& size) {
-        // If file isn't already open, and failed to open on an attempt, exit the program.
-        if (!m_file.is_open() && !openFile()) {
-            std::cout << "Could not open file: " << m_filepath << "." << std::endl
-                      << "Exiting..." << std::endl;
-            std::getchar();
-            exit(0);
-        }
+// Analyses everything given on the command line without ever waiting on the user. A file that can't be
+// analysed is reported and skipped rather than stopping the whole batch.
+int runBatch(const CommandLine::Arguments& arguments) {
+    // Allocations are only counted while stats are on.
+    if (arguments.showStats || arguments.maxAllocationsPerLine >= 0.0) {
+        Stats::enable();
+    }
+    if (!arguments.tracePath.empty()) {
+        Trace::enable();
+    }
 
-        // Get line count and allocate enough memory for data.
-        unsigned int maxSize = getLineCount();
-        m_charges = new double[maxSize];
-
-        unsigned int finalSize = maxSize;
-        // Iterate over lines in file and validate them.
-        for (unsigned int i = 0; i < maxSize; ++i) {
-            // Grab the line.
-            std::string line;
-            std::getline(m_file, line);
-
-            // Trim whitespace.
-            String::trim(line);
-
-            // Put it in a stringstream.
-            std::stringstream sstream(line);
-
-            // Out put to a double.
-            double possibleCharge = -1.0;
-            sstream >> possibleCharge;
-
-            // Test that the rest of the stringstream is empty.
-            std::string emptyTest;
-            sstream >> emptyTest;
-
-            // If either the possible charge has an invalid value, or the empty test string is not empty, fail.
-            if (possibleCharge < 0.0 || !emptyTest.empty()) {
-                std::cout << "File: " << m_filepath << " has a corrupt data point." << std::endl
-                          << "Skipping that data point." << std::endl;
-                --finalSize;
-                continue;
-            }
+    std::vector<std::string> files;
+    std::vector<std::string> problems;
+    CommandLine::collectFiles(arguments, files, problems);
 
-            // All's well, push the read charge onto the charge array.
-            m_charges[i - maxSize + finalSize] = possibleCharge; // Have to compute the difference between maxSize and finalSize 
-                                                                 // and take that off so as to have all data points continiguous in the array.
-        }
-        size = finalSize;
+    for (const std::string& problem : problems) {
+        std::cerr << problem << std::endl;
     }
 
-    std::fstream m_file;
-    std::string m_filepath;
-
-    double* m_charges = nullptr;
-};
+    DataAnalysis::Options options;
+    options.streaming          = arguments.incremental;
+    options.fixedPointDecimals = arguments.fixedPointDecimals;
+    options.binaryInput        = arguments.inputFormat == "binary";
+    options.range              = arguments.range;
+    options.sampleSize         = arguments.sampleSize;
+
+    ChargeLoading::Settings loadSettings;
+    loadSettings.memoryMap           = arguments.memoryMap;
+    loadSettings.reportCorruptPoints = arguments.verbose;
+    loadSettings.parserThreads       = arguments.parseThreads;
+    loadSettings.dropCache           = arguments.dropCache;
+    if (arguments.inputFormat == "fixed-width") {
+        loadSettings.format = ChargeLoading::Settings::Format::FIXED_WIDTH;
+    } else if (arguments.inputFormat == "binary") {
+        loadSettings.format = ChargeLoading::Settings::Format::BINARY;
+    }
 
-namespace DataAnalysis {
-    double computeMean(double* data, unsigned int size) {
-        double total = 0.0;
-        for (unsigned int i = 0; i < size; ++i) {
-            total += data[i];
+    ResultCache cache;
+    if (arguments.useCache) {
+        cache.init(arguments.cacheDirectory);
+        if (!cache.isUsable()) {
+            std::cerr << "Could not create the result cache in: " << arguments.cacheDirectory << ", carrying on without it." << std::endl;
         }
-        return total / (double)size;
     }
 
-    double computeStandardDeviation(double* data, unsigned int size, double mean) {
-        double total = 0.0;
-        for (unsigned int i = 0; i < size; ++i) {
-            total += std::pow(data[i] - mean, 2.0);
+    std::ofstream outputFile;
+    if (!arguments.outputPath.empty()) {
+        outputFile.open(arguments.outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!outputFile.is_open()) {
+            std::cerr << "Could not open output file: " << arguments.outputPath << "." << std::endl;
+            return 2;
         }
-        return std::sqrt(total / (double)(size - 1));
     }
-
-    double computeStandardErrorInTheMean(double mean, unsigned int size) {
-        return mean / std::sqrt((double)size);
+#ifdef _WIN32
+    else if (arguments.format == "binary") {
+        // Stop Windows turning every 0x0A byte into 0x0D 0x0A.
+        _setmode(_fileno(stdout), _O_BINARY);
+    }
+#endif
+    std::ostream& output = outputFile.is_open() ? outputFile : std::cout;
+    std::unique_ptr<ResultSink> sink = createResultSink(arguments.format, output);
+
+    DatasetCache datasets;
+    datasets.init(256 << 20, loadSettings, arguments.fixedPointDecimals);
+
+    Analyser analyser;
+    analyser.init(options, arguments.useCache ? &cache : nullptr, &datasets, loadSettings);
+
+    /// What came of analysing one file, handed back from whichever thread did it.
+    struct FileOutcome {
+        bool isAnalysed = false;
+        DataAnalysis::Summary summary;
+        Analyser::Route route = Analyser::Route::LOADED;
+        Stats::Allocations allocations;
+        uint64_t lines = 0;
+        bool isPackFailed = false;
+        bool isIndexFailed = false;
+    };
+
+    // With one job everything happens here on the main thread, just as it would without an executor. With more,
+    // a few extra files are queued beyond the number of threads, so none sits idle while results are written.
+    Executor executor(arguments.jobs > 1 ? arguments.jobs : 0);
+    size_t maxInFlight = arguments.jobs > 1 ? (size_t)arguments.jobs * 2 : 1;
+
+    // With threads to hand them to, files are read ahead asynchronously, many more of them at once than there are
+    // threads, so waiting on slow storage overlaps. Not where the settings ask for files to be read some other way,
+    // or where what's read would go unused.
+    std::optional<AsyncReader> reader;
+    if (arguments.jobs > 1 && !arguments.batchRead && !arguments.memoryMap && !arguments.dropCache && !arguments.incremental
+        && arguments.sampleSize == 0) {
+        reader.emplace(executor);
+        maxInFlight = std::max<size_t>(maxInFlight, AsyncReader::READ_AHEAD);
     }
-}
 
-int main() {
-    // TODO(Matthew): Ask for the name of the file(s) they wish to load.
-    std::cout << "Welcome to Matt's impetuous charge calculator!" << std::endl;
+    auto analyse = [&](const std::string& file, const Sources::Memory::ContentsPtr& contents) {
+        // Allocations and lines are counted per thread, so only this file's count towards it.
+        Stats::Allocations allocationsBefore = Stats::getThreadAllocations();
+        uint64_t linesBefore = Stats::getThreadCount(Stats::Counter::LINES);
 
-    std::vector<std::string> filesToLoad;
-    bool shouldContinue;
-    do {
-        std::cout << "Please enter the name of the file you wish to load:" << std::endl;
-        std::string temp;
-        std::getline(std::cin, temp);
-        filesToLoad.push_back(temp);
-
-        std::cout << "Is there another file you'd like to load? [y/n]" << std::endl;
-        shouldContinue = Input::getBool();
-    } while (shouldContinue);
+        FileOutcome outcome;
+        outcome.isAnalysed  = analyser.analyse(file, outcome.summary, outcome.route, contents);
+        outcome.allocations = Stats::getThreadAllocations() - allocationsBefore;
+        outcome.lines       = Stats::getThreadCount(Stats::Counter::LINES) - linesBefore;
 
-    ChargeDataModel model; // Just reuse the same model for each.
-    for (std::string& file : filesToLoad) {
-        model.init(file);
+        // Packs are made after the counting, so they don't count against the file's allocations per line.
+        if (arguments.packDecimals > 0 && outcome.isAnalysed && !ChargePack::isPackPath(file) && !Sources::Stream::isStream(file)) {
+            outcome.isPackFailed = !packFile(file, contents, arguments.packDecimals, datasets);
+        }
+        if (arguments.buildIndex && outcome.isAnalysed && arguments.inputFormat != "binary" && !ChargePack::isPackPath(file)
+            && !Sources::Stream::isStream(file)) {
+            LineIndex::Index index;
+            outcome.isIndexFailed = !index.load(file) && !(index.build(file, arguments.parseThreads) && index.save(file));
+        }
+        return outcome;
+    };
+
+    size_t failures = 0;
+    size_t allocationProblems = 0;
+    size_t packProblems = 0;
+    size_t indexProblems = 0;
+    auto report = [&](const std::string& file, const FileOutcome& outcome) {
+        if (outcome.isAnalysed) {
+            Stats::ScopedTimer timer(Stats::Phase::OUTPUT);
+            sink->writeResult(file, outcome.summary, outcome.route);
+        } else {
+            std::cerr << "Could not read file: " << file << "." << std::endl;
+            Stats::ScopedTimer timer(Stats::Phase::OUTPUT);
+            sink->writeFailure(file, "could not read file");
+            ++failures;
+        }
+        if (outcome.isPackFailed) {
+            std::cerr << "Could not write charge pack for: " << file << "." << std::endl;
+            ++packProblems;
+        }
+        if (outcome.isIndexFailed) {
+            std::cerr << "Could not write line index for: " << file << "." << std::endl;
+            ++indexProblems;
+        }
 
-        unsigned int size;
-        const auto& data = model.getChargeData(size);
+        Stats::addFile(file, outcome.lines, outcome.allocations);
 
-        double mean = DataAnalysis::computeMean(data, size);
-        double standardDeviation = DataAnalysis::computeStandardDeviation(data, size, mean);
-        double errorInTheMean = DataAnalysis::computeStandardErrorInTheMean(mean, size);
+        if (arguments.maxAllocationsPerLine >= 0.0 && outcome.lines > 0) {
+            double allocationsPerLine = (double)outcome.allocations.getTotalCount() / (double)outcome.lines;
+            if (allocationsPerLine > arguments.maxAllocationsPerLine) {
+                std::cerr << "File: " << file << " took " << allocationsPerLine << " allocations per line, more than the "
+                          << arguments.maxAllocationsPerLine << " allowed." << std::endl;
+                ++allocationProblems;
+            }
+        }
+    };
+
+    if (!arguments.sharedRing.empty()) {
+        std::string source = "shm:" + arguments.sharedRing;
+        DataAnalysis::Summary summary;
+        if (analyseLive(arguments.sharedRing, options.range, summary)) {
+            Stats::ScopedTimer timer(Stats::Phase::OUTPUT);
+            sink->writeResult(source, summary, Analyser::Route::LOADED);
+        } else {
+            std::cerr << "Could not attach to shared ring: " << arguments.sharedRing << "." << std::endl;
+            Stats::ScopedTimer timer(Stats::Phase::OUTPUT);
+            sink->writeFailure(source, "could not attach to shared ring");
+            ++failures;
+        }
+    } else if (arguments.batchRead) {
+        // Read a batch of files in one go, then analyse them from memory. Files that couldn't be read are left to
+        // the analyser to try, and report.
+        BatchReader reader;
+        std::vector<BatchReader::File> batch;
+        for (size_t start = 0; start < files.size(); start += BatchReader::BATCH_SIZE) {
+            size_t end = std::min<size_t>(start + BatchReader::BATCH_SIZE, files.size());
+            batch.assign(end - start, BatchReader::File());
+            for (size_t i = start; i < end; ++i) {
+                batch[i - start].path = files[i];
+            }
+            reader.read(batch);
 
-        std::cout << "File read from: " << file << std::endl;
-        std::cout << "    The computed mean is:" << std::endl << "        (" << mean << " +/- " << errorInTheMean << ")C" << std::endl;
-        std::cout << "    The computed standard deviation is:" << std::endl << "        " << standardDeviation << "C" << std::endl;
+            executor.forEachInOrder(batch.size(), maxInFlight, [&](size_t i) -> Task<FileOutcome> {
+                co_await executor.schedule();
+                co_return analyse(batch[i].path, batch[i].contents);
+            }, [&](size_t i, const FileOutcome& outcome) {
+                report(batch[i].path, outcome);
+            });
+        }
+    } else {
+        executor.forEachInOrder(files.size(), maxInFlight, [&](size_t i) -> Task<FileOutcome> {
+            Sources::Memory::ContentsPtr contents;
+            if (reader) {
+                contents = co_await reader->read(files[i]);
+            } else {
+                co_await executor.schedule();
+            }
+            co_return analyse(files[i], contents);
+        }, [&](size_t i, const FileOutcome& outcome) {
+            report(files[i], outcome);
+        });
+    }
+    {
+        Stats::ScopedTimer timer(Stats::Phase::OUTPUT);
+        sink->flush();
+        if (outputFile.is_open()) outputFile.close();
+    }
+    // A full disk or a closed pipe only shows up here, as the sink writes in large blocks.
+    bool isOutputFailed = output.fail();
+    if (isOutputFailed) {
+        std::cerr << "Could not write results to "
+                  << (arguments.outputPath.empty() ? std::string("standard output") : arguments.outputPath) << "." << std::endl;
+    }
 
-        model.dispose();
+    if (arguments.showStats) {
+        Stats::writeJson(std::cerr);
+    }
+    if (!arguments.tracePath.empty() && !Trace::writeJson(arguments.tracePath)) {
+        std::cerr << "Could not write trace file: " << arguments.tracePath << "." << std::endl;
     }
 
-    std::cout << "Press any key to exit..." << std::endl;
-    std::getchar();
+    if (isOutputFailed) {
+        return 1;
+    }
+    if (failures > 0 || !problems.empty() || allocationProblems > 0 || packProblems > 0 || indexProblems > 0) {
+        size_t sourceCount = arguments.sharedRing.empty() ? files.size() : 1; // A ring counts as one.
+        std::cerr << "Analysed " << (sourceCount - failures) << " of " << sourceCount << " file(s), "
+                  << (failures + problems.size() + allocationProblems + packProblems + indexProblems) << " problem(s)." << std::endl;
+        return 1;
+    }
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char* argv[]) {
+    // With nothing on the command line, ask the user what to do.
+    if (argc <= 1) {
+        return runInteractive();
+    }
+
+    CommandLine::Arguments arguments;
+    std::string error;
+    if (!CommandLine::parse(argc, argv, arguments, error)) {
+        std::cerr << error << std::endl;
+        CommandLine::printUsage(std::cerr, argv[0]);
+        return 2;
+    }
+    if (arguments.showHelp) {
+        CommandLine::printUsage(std::cout, argv[0]);
+        return 0;
+    }
+#if !ALLOCATION_HOOKS_ENABLED
+    if (arguments.maxAllocationsPerLine >= 0.0) {
+        std::cerr << "--max-allocs-per-line needs allocations counted, which this build leaves out." << std::endl;
+        return 2;
+    }
+#endif
+
+    return runBatch(arguments);
+}
@@ -0,0 +1,295 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <utility>
+#include <algorithm>
+#include <coroutine>
+#include <unordered_set>
+#include <condition_variable>
+
+#include "Executor.h"
+#include "LoaderPolicies.h"
+#include "Uring.h"
+
+/// Reads whole files for tasks (see Executor.h), which co_await read(path) and carry on, on one of the executor's
+/// threads, once the file is in memory. Many reads can be in flight at once without a thread apiece, so with
+/// thousands of small files on slow or network storage the waiting overlaps rather than adding up.
+///
+/// On Linux the reads go through io_uring (see Uring.h). The open, the reads and the close for each file are
+/// submitted as the one before completes, and a thread of the reader's own waits on the completions. Where io_uring
+/// isn't there, or the ring is full, a read is a job on the executor's threads instead, reading with an ifstream.
+///
+/// Only files up to MAX_FILE_SIZE are held in memory. Bigger ones, streams, and files the reader had any trouble
+/// with come back as nullptr, for the caller to read its own way (and report, if it can't either).
+class AsyncReader {
+public:
+    static constexpr unsigned RING_SIZE       = 256;     // Reads in the ring at once.
+    static constexpr unsigned READ_AHEAD      = 64;      // Files worth having in flight, however few threads there are.
+    static constexpr size_t   FIRST_READ_SIZE = 1 << 16; // Grown for files that turn out bigger.
+    static constexpr size_t   MAX_FILE_SIZE   = 1 << 20;
+
+    /// What read gives back, for co_await.
+    class Read {
+    public:
+        Read(AsyncReader& reader, std::string path) : m_reader(reader), m_path(std::move(path)) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+        void await_suspend(std::coroutine_handle<> waiter) {
+            m_waiter = waiter;
+            m_reader.start(*this);
+        }
+        Sources::Memory::ContentsPtr await_resume() {
+            return std::move(m_contents);
+        }
+    private:
+        friend class AsyncReader;
+
+        // Takes what's been read as the contents.
+        void keepContents() {
+            // Small files only use a sliver of the first read's buffer, so copy them out rather than hold on to it.
+            m_buffer.resize(m_size);
+            if (m_buffer.capacity() > m_size * 2) {
+                m_contents = std::make_shared<const std::vector<char>>(m_buffer.begin(), m_buffer.end());
+            } else {
+                m_contents = std::make_shared<const std::vector<char>>(std::move(m_buffer));
+            }
+        }
+
+        AsyncReader& m_reader;
+        std::string m_path;
+        std::coroutine_handle<> m_waiter;
+        Sources::Memory::ContentsPtr m_contents;
+
+        int    m_descriptor = -1;
+        bool   m_isClosing  = false;
+        size_t m_size       = 0;
+        std::vector<char> m_buffer;
+    };
+
+    explicit AsyncReader(Executor& executor) : m_executor(executor) {
+#if defined(URING_HAS_SYSCALLS)
+        m_isUsingUring = m_ring.open(RING_SIZE, { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE });
+        if (m_isUsingUring) {
+            m_completer = std::thread([this]() { complete(); });
+        }
+#endif
+    }
+    // Every read has to have been awaited before the reader goes.
+    ~AsyncReader() {
+#if defined(URING_HAS_SYSCALLS)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_isStopping = true;
+        }
+        m_wake.notify_all();
+        if (m_completer.joinable()) m_completer.join();
+#endif
+    }
+
+    AsyncReader(const AsyncReader&) = delete;
+    AsyncReader& operator=(const AsyncReader&) = delete;
+
+    // For a task to co_await, carrying on on one of the executor's threads with the file's contents.
+    Read read(const std::string& path) {
+        return Read(*this, path);
+    }
+private:
+    void start(Read& request) {
+        if (Sources::Stream::isStream(request.m_path)) {
+            finish(request);
+            return;
+        }
+#if defined(URING_HAS_SYSCALLS)
+        bool isInRing  = false;
+        bool isGivenUp = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (m_isUsingUring && m_requests.size() < m_ring.getEntryCount()) {
+                io_uring_sqe& entry = addEntry(IORING_OP_OPENAT, request);
+                entry.fd         = AT_FDCWD;
+                entry.addr       = (uint64_t)(uintptr_t)request.m_path.c_str();
+                entry.open_flags = O_RDONLY | O_CLOEXEC;
+
+                std::vector<Read*> givenUp;
+                submit(givenUp);
+                isInRing  = true;
+                isGivenUp = !givenUp.empty();
+            }
+        }
+        if (isGivenUp) {
+            finish(request);
+            return;
+        }
+        if (isInRing) {
+            m_wake.notify_one();
+            return;
+        }
+#endif
+        m_executor.post([this, &request]() {
+            readWithStream(request);
+            request.m_waiter.resume();
+        });
+    }
+
+    // Hands a request back to its task on one of the executor's threads. Nothing of the request can be touched
+    // after, as the task may already have carried on.
+    void finish(Read& request) {
+        std::coroutine_handle<> waiter = request.m_waiter;
+        m_executor.post([waiter]() { waiter.resume(); });
+    }
+
+    static void readWithStream(Read& request) {
+        std::ifstream in(request.m_path, std::ios::in | std::ios::binary);
+        if (!in.is_open()) return;
+
+        do {
+            request.m_buffer.resize(std::min(request.m_size + FIRST_READ_SIZE, MAX_FILE_SIZE));
+            in.read(request.m_buffer.data() + request.m_size, (std::streamsize)(request.m_buffer.size() - request.m_size));
+            request.m_size += (size_t)in.gcount();
+        } while (in && request.m_size < MAX_FILE_SIZE);
+        if (!in.eof() || in.bad()) return;
+
+        request.keepContents();
+    }
+
+    Executor& m_executor;
+
+#if defined(URING_HAS_SYSCALLS)
+    // Everything from here on is only touched with m_mutex held, but for the ring's wait, which the completer thread
+    // calls without it so reads can still be started meanwhile.
+
+    io_uring_sqe& addEntry(uint8_t opcode, Read& request) {
+        m_queued.push_back(&request);
+        m_requests.insert(&request);
+        return m_ring.addEntry(opcode, (uint64_t)(uintptr_t)&request);
+    }
+
+    // Hands over everything added. If the ring fails it's given up on, along with the requests that were waiting
+    // to go in, which are added to givenUp for finishing once the lock's let go.
+    void submit(std::vector<Read*>& givenUp) {
+        if (m_ring.enter(0)) {
+            m_opsInFlight += m_queued.size();
+        } else {
+            m_isUsingUring = false;
+            for (Read* request : m_queued) {
+                giveUp(*request);
+                givenUp.push_back(request);
+            }
+        }
+        m_queued.clear();
+    }
+
+    void giveUp(Read& request) {
+        if (request.m_descriptor >= 0) ::close(request.m_descriptor);
+        request.m_descriptor = -1;
+        request.m_contents   = nullptr;
+        m_requests.erase(&request);
+    }
+
+    // Takes the next step for a request whose last one has completed. Returns true if it's done.
+    bool advance(Read& request, int result) {
+        m_requests.erase(&request);
+        if (request.m_isClosing) {
+            request.m_descriptor = -1;
+            return true;
+        }
+
+        if (request.m_descriptor < 0) {
+            if (result < 0) return true; // Couldn't be opened.
+            request.m_descriptor = result;
+        } else if (result > 0) {
+            request.m_size += (size_t)result;
+        } else {
+            if (result == 0) request.keepContents();
+            return close(request);
+        }
+        if (request.m_size >= MAX_FILE_SIZE) return close(request);
+        if (!m_isUsingUring) {
+            giveUp(request);
+            return true;
+        }
+
+        if (request.m_buffer.size() - request.m_size < FIRST_READ_SIZE / 2) {
+            request.m_buffer.resize(std::min(std::max(request.m_buffer.size() * 2, FIRST_READ_SIZE), MAX_FILE_SIZE));
+        }
+        io_uring_sqe& entry = addEntry(IORING_OP_READ, request);
+        entry.fd   = request.m_descriptor;
+        entry.addr = (uint64_t)(uintptr_t)(request.m_buffer.data() + request.m_size);
+        entry.len  = (unsigned)(request.m_buffer.size() - request.m_size);
+        entry.off  = (uint64_t)request.m_size;
+        return false;
+    }
+
+    bool close(Read& request) {
+        if (!m_isUsingUring) {
+            ::close(request.m_descriptor);
+            request.m_descriptor = -1;
+            return true;
+        }
+        request.m_isClosing = true;
+        io_uring_sqe& entry = addEntry(IORING_OP_CLOSE, request);
+        entry.fd = request.m_descriptor;
+        return false;
+    }
+
+    // Runs on a thread of its own, waiting on completions and taking each request on to its next step.
+    void complete() {
+        std::vector<Read*> finished;
+        for (;;) {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this]() { return m_opsInFlight > 0 || m_isStopping; });
+                if (m_opsInFlight == 0) return;
+            }
+
+            bool isWorking = m_ring.wait();
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                unsigned count = m_ring.takeCompletions([&](uint64_t userData, int result) {
+                    Read& request = *(Read*)(uintptr_t)userData;
+                    if (advance(request, result)) finished.push_back(&request);
+                });
+                m_opsInFlight -= count;
+                if (!isWorking && count == 0) {
+                    // Something's badly wrong with the ring. Close it, so the kernel's done with every buffer, and
+                    // give up on everything still in it.
+                    m_isUsingUring = false;
+                    m_ring.close();
+                    for (Read* request : std::vector<Read*>(m_requests.begin(), m_requests.end())) {
+                        giveUp(*request);
+                        finished.push_back(request);
+                    }
+                    m_queued.clear();
+                    m_opsInFlight = 0;
+                } else if (!m_queued.empty()) {
+                    submit(finished);
+                }
+            }
+
+            for (Read* request : finished) {
+                finish(*request);
+            }
+            finished.clear();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    bool m_isStopping = false;
+    bool m_isUsingUring = false;
+
+    Uring::Ring m_ring;
+    std::thread m_completer;
+    std::vector<Read*> m_queued;            // Requests with an entry added but not yet handed over.
+    std::unordered_set<Read*> m_requests;   // Requests with an entry added or in flight.
+    size_t m_opsInFlight = 0;
+#endif
+};
@@ -0,0 +1,203 @@
+#pragma once
+
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <fstream>
+#include <algorithm>
+
+#include "LoaderPolicies.h"
+#include "Stats.h"
+#include "Uring.h"
+
+/// Reads whole files into memory a batch at a time, for runs over thousands of small files where opening and
+/// reading each one in turn spends longer in system calls than in parsing.
+///
+/// On Linux this goes through io_uring (see Uring.h). A batch of files costs a few trips into the kernel in all
+/// (one to open them all, a couple to read them all, one to close them all) rather than several trips per file.
+/// Where io_uring isn't there (other systems, older kernels, or sandboxes that forbid it) each file is read with an
+/// ifstream instead, so callers don't need to care.
+class BatchReader {
+public:
+    /// A file to read, and what was read from it.
+    struct File {
+        std::string path;
+        Sources::Memory::ContentsPtr contents; // nullptr if the file couldn't be read.
+    };
+
+    static constexpr unsigned BATCH_SIZE = 64;           // Files in flight in the ring at once.
+    static constexpr size_t   FIRST_READ_SIZE = 1 << 16; // Grown for files that turn out bigger.
+
+    BatchReader() {
+#if defined(URING_HAS_SYSCALLS)
+        m_isUsingUring = m_ring.open(BATCH_SIZE, { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE });
+#endif
+    }
+    ~BatchReader() = default;
+
+    BatchReader(const BatchReader&) = delete;
+    BatchReader& operator=(const BatchReader&) = delete;
+
+    bool isUsingUring() const {
+        return m_isUsingUring;
+    }
+
+    // Reads every file given, filling in its contents. Streams (standard input and pipes) are left unread, for
+    // reading as they arrive rather than held in memory whole.
+    void read(std::vector<File>& files) {
+        Stats::ScopedTimer timer(Stats::Phase::OPEN);
+        for (size_t start = 0; start < files.size(); start += BATCH_SIZE) {
+            size_t end = std::min(start + BATCH_SIZE, files.size());
+#if defined(URING_HAS_SYSCALLS)
+            if (m_isUsingUring && readWithUring(files, start, end)) continue;
+#endif
+            readWithStreams(files, start, end);
+        }
+    }
+private:
+    static void readWithStreams(std::vector<File>& files, size_t start, size_t end) {
+        for (size_t i = start; i < end; ++i) {
+            if (Sources::Stream::isStream(files[i].path)) continue;
+            std::ifstream in(files[i].path, std::ios::in | std::ios::binary);
+            if (!in.is_open()) continue;
+
+            auto contents = std::make_shared<std::vector<char>>();
+            size_t size = 0;
+            do {
+                contents->resize(size + FIRST_READ_SIZE);
+                in.read(contents->data() + size, FIRST_READ_SIZE);
+                size += (size_t)in.gcount();
+            } while (in);
+            if (!in.eof()) continue;
+
+            contents->resize(size);
+            contents->shrink_to_fit();
+            files[i].contents = contents;
+        }
+    }
+
+    bool m_isUsingUring = false;
+
+#if defined(URING_HAS_SYSCALLS)
+    /// How far each file in a batch has got.
+    struct Pending {
+        int    descriptor = -1;
+        bool   isFailed   = false;
+        bool   isAtEnd    = false;
+        size_t size       = 0;
+        std::vector<char> buffer;
+    };
+
+    // Submits everything added since last time and waits for all of it to complete, passing each result to
+    // handle(fileIndex, result). Returns false if the ring itself failed, or turned out not to know an operation
+    // after all (which comes back as -EINVAL, and for any of these operations can't mean anything else).
+    template <typename Handle>
+    bool submitAndWait(Handle handle) {
+        unsigned toComplete = m_ring.getQueued();
+        bool isUnsupported = false;
+        while (toComplete > 0) {
+            // Only the first time round has anything to submit, after that it's just waiting.
+            if (!m_ring.enter(1)) return false;
+            toComplete -= m_ring.takeCompletions([&](uint64_t fileIndex, int result) {
+                if (result == -EINVAL) isUnsupported = true;
+                handle((size_t)fileIndex, result);
+            });
+        }
+        return !isUnsupported;
+    }
+
+    // Returns false (having closed anything it opened) if the ring failed, for the caller to fall back on streams.
+    bool readWithUring(std::vector<File>& files, size_t start, size_t end) {
+        std::vector<Pending> pending(end - start);
+
+        // Open them all.
+        for (size_t i = start; i < end; ++i) {
+            if (Sources::Stream::isStream(files[i].path)) {
+                pending[i - start].isFailed = true;
+                continue;
+            }
+            io_uring_sqe& entry = m_ring.addEntry(IORING_OP_OPENAT, i - start);
+            entry.fd         = AT_FDCWD;
+            entry.addr       = (uint64_t)(uintptr_t)files[i].path.c_str();
+            entry.open_flags = O_RDONLY | O_CLOEXEC;
+        }
+        bool isRingWorking = submitAndWait([&](size_t i, int result) {
+            if (result >= 0) {
+                pending[i].descriptor = result;
+            } else {
+                pending[i].isFailed = true;
+            }
+        });
+
+        // Read them all, round after round until every one has hit its end. Small files take two rounds: one to
+        // read everything, and one to find there's nothing more.
+        while (isRingWorking) {
+            bool isAnyReading = false;
+            for (size_t i = 0; i < pending.size(); ++i) {
+                Pending& file = pending[i];
+                if (file.descriptor < 0 || file.isFailed || file.isAtEnd) continue;
+
+                if (file.buffer.size() - file.size < FIRST_READ_SIZE / 2) {
+                    file.buffer.resize(std::max(file.buffer.size() * 2, FIRST_READ_SIZE));
+                }
+                io_uring_sqe& entry = m_ring.addEntry(IORING_OP_READ, i);
+                entry.fd   = file.descriptor;
+                entry.addr = (uint64_t)(uintptr_t)(file.buffer.data() + file.size);
+                entry.len  = (unsigned)std::min<size_t>(file.buffer.size() - file.size, 1u << 30);
+                entry.off  = (uint64_t)file.size;
+                isAnyReading = true;
+            }
+            if (!isAnyReading) break;
+
+            isRingWorking = submitAndWait([&](size_t i, int result) {
+                if (result > 0) {
+                    pending[i].size += (size_t)result;
+                } else if (result == 0) {
+                    pending[i].isAtEnd = true;
+                } else {
+                    pending[i].isFailed = true;
+                }
+            });
+        }
+
+        // Close them all.
+        if (isRingWorking) {
+            for (size_t i = 0; i < pending.size(); ++i) {
+                if (pending[i].descriptor < 0) continue;
+                io_uring_sqe& entry = m_ring.addEntry(IORING_OP_CLOSE, i);
+                entry.fd = pending[i].descriptor;
+            }
+            isRingWorking = submitAndWait([&](size_t i, int result) {
+                // A close the ring couldn't do is left to be done by hand.
+                if (result != -EINVAL) pending[i].descriptor = -1;
+            });
+        }
+        if (!isRingWorking) {
+            // Don't trust it again, and tidy up by hand.
+            m_isUsingUring = false;
+            m_ring.close();
+            for (Pending& file : pending) {
+                if (file.descriptor >= 0) ::close(file.descriptor);
+            }
+            return false;
+        }
+
+        for (size_t i = 0; i < pending.size(); ++i) {
+            Pending& file = pending[i];
+            if (file.isFailed) continue;
+            // Small files only use a sliver of the first read's buffer, so copy them out rather than hold on to it.
+            file.buffer.resize(file.size);
+            if (file.buffer.capacity() > file.size * 2) {
+                files[start + i].contents = std::make_shared<const std::vector<char>>(file.buffer.begin(), file.buffer.end());
+            } else {
+                files[start + i].contents = std::make_shared<const std::vector<char>>(std::move(file.buffer));
+            }
+        }
+        return true;
+    }
+
+    Uring::Ring m_ring;
+#endif
+};
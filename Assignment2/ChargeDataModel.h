@@ -0,0 +1,374 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include <iostream>
+#include <type_traits>
+
+#include "ChargePack.h"
+#include "ChargeParser.h"
+#include "DataAnalysis.h"
+#include "Decompression.h"
+#include "LineIndex.h"
+#include "LoaderPolicies.h"
+#include "ParallelLoader.h"
+#include "Stats.h"
+#include "Trace.h"
+
+/// Model that holds the charge data.
+///
+/// Put together from a source, a record parser and a storage (see LoaderPolicies.h), so a deployment that
+/// always reads, say, mapped binary files gets a loader specialised for just that. ChargeDataModel is the one
+/// for text files read through a stream into a vector.
+template <typename Source, typename Parser, typename Storage>
+class BasicChargeDataModel {
+public:
+    BasicChargeDataModel() {}
+    ~BasicChargeDataModel() {
+        dispose();
+    }
+
+    // If reportCorruptPoints is false, corrupt data points are only counted rather than reported as they're found.
+    void init(std::string filepath = "millikan.dat", bool reportCorruptPoints = true) {
+        m_filepath = filepath;
+        m_reportCorruptPoints = reportCorruptPoints;
+    }
+    void dispose() {
+        // Close file is still open.
+        m_source.close();
+
+        // Clear up memory.
+        m_storage.clear();
+        m_isLoaded = false;
+        m_corruptCount = 0;
+    }
+
+    // Returns nullptr if the file couldn't be opened. Only for storages that keep the charges contiguous.
+    double* getChargeData(unsigned int& size) {
+        static_assert(Storage::IS_CONTIGUOUS, "getChargeData needs a contiguous storage, use getStorage instead");
+
+        // If we haven't yet loaded data from the file, do so.
+        if (!m_isLoaded && !loadDataFromFile()) {
+            size = 0;
+            return nullptr;
+        }
+        size = (unsigned int)m_storage.size();
+        return m_storage.data();
+    }
+
+    // Hands over the charge data, loading it first if need be. The model is left empty afterwards.
+    // Returns false if the file couldn't be opened. Only for vector storage.
+    bool takeChargeData(std::vector<double>& charges) {
+        if (!m_isLoaded && !loadDataFromFile()) {
+            return false;
+        }
+        m_isLoaded = false;
+        charges = std::move(m_storage.getVector());
+        m_storage.clear();
+        return true;
+    }
+
+    // Loads the charges if they aren't already, for getting at them through getStorage. Returns false if the
+    // file couldn't be opened.
+    bool load() {
+        return m_isLoaded || loadDataFromFile();
+    }
+    const Storage& getStorage() const {
+        return m_storage;
+    }
+    Storage& getStorage() {
+        return m_storage;
+    }
+    // For handing the source anything it needs before opening, such as the contents for a memory source.
+    Source& getSource() {
+        return m_source;
+    }
+
+    // Opens the file, returns false if it couldn't be. Loading does this itself, this is only needed for getLineCount.
+    bool openFile() {
+        Stats::ScopedTimer timer(Stats::Phase::OPEN);
+        return m_source.open(m_filepath);
+    }
+
+    // Number of records in the file, which for text is the number of lines. Loading doesn't need this. Text comes
+    // straight from the line index beside the file, if there's an up-to-date one (see LineIndex.h).
+    unsigned int getLineCount() {
+        Stats::ScopedTimer timer(Stats::Phase::LINE_COUNT);
+        if constexpr (!Parser::RECORDS_ARE_VALUES) {
+            LineIndex::Index index;
+            if (index.load(m_filepath)) return (unsigned int)index.getLineCount();
+        }
+
+        uint64_t count = 0;
+        size_t carry = 0;
+        const char* data;
+        size_t size;
+        while (m_source.next(data, size)) {
+            count += m_parser.countRecordEnds(data, size, carry);
+        }
+
+        // Return the source to the start.
+        m_source.rewind();
+        return (unsigned int)count;
+    }
+
+    // Number of data points skipped as corrupt in the last load.
+    unsigned int getCorruptCount() const {
+        return m_corruptCount;
+    }
+private:
+    bool loadDataFromFile() {
+        // If file isn't already open, and failed to open on an attempt, leave it to the caller to decide what to do.
+        if (!m_source.isOpen() && !openFile()) {
+            return false;
+        }
+
+        m_storage.clear();
+        if constexpr (Storage::IS_VIEW) {
+            static_assert(Source::IS_STABLE && Parser::RECORDS_ARE_VALUES, "A view storage needs records that are the charges themselves, from a source whose memory stays put");
+            m_storage.setKeepAlive(m_source.getKeepAlive());
+        }
+
+        Stats::ScopedTimer timer(Stats::Phase::PARSE);
+        uint64_t bytesRead = 0;
+        uint64_t records = 0;
+        m_corruptCount = 0;
+
+        std::string partial; // The start of a record that runs on into the next block.
+        bool isFirstBlock = true;
+        const char* data;
+        size_t size;
+        while (m_source.next(data, size)) {
+            Trace::Scope chunkTrace("parse_chunk", "pipeline", m_filepath.c_str());
+            bytesRead += size;
+            const char* recordStart = data;
+            const char* const end = data + size;
+
+            // Size the storage from a look at the first block, rather than a whole extra pass to count lines.
+            if (isFirstBlock) {
+                m_storage.reserve(m_parser.estimateRecordCount(data, size, m_source.getSize()));
+                isFirstBlock = false;
+            }
+
+            // Finish off a record started in the last block.
+            if (!partial.empty()) {
+                size_t remainder = m_parser.getRemainder(partial.size(), data, size);
+                if (remainder == SIZE_MAX) {
+                    partial.append(data, end);
+                    continue;
+                }
+                partial.append(data, data + remainder);
+                addRecord(partial.data(), partial.data() + partial.size(), false);
+                ++records;
+                partial.clear();
+                recordStart += remainder;
+            }
+
+            // Iterate over records in the block and validate them.
+            while (const char* recordEnd = m_parser.findRecordEnd(recordStart, end)) {
+                addRecord(recordStart, recordEnd, true);
+                ++records;
+                recordStart = recordEnd;
+            }
+            partial.assign(recordStart, end);
+        }
+        // Anything still in partial is a last record without an end, which has never counted as a data point.
+        m_storage.finish();
+        // A source that stopped on an error has only handed over part of the file, which is no good to anyone.
+        if (m_source.isFailed()) return false;
+
+        Stats::add(Stats::Counter::BYTES_READ, bytesRead);
+        Stats::add(Stats::Counter::LINES, records);
+        Stats::add(Stats::Counter::CORRUPT_POINTS, m_corruptCount);
+        m_isLoaded = true;
+        return true;
+    }
+
+    // Validates a record and keeps the charge in it. isInSource is false for a record pieced together from
+    // more than one block, which a view storage then can't point at.
+    void addRecord(const char* begin, const char* end, bool isInSource) {
+        double possibleCharge;
+        if (!m_parser.parseRecord(begin, end, possibleCharge)) {
+            Stats::ScopedTimer corruptTimer(Stats::Phase::CORRUPT);
+            if (m_reportCorruptPoints) {
+                std::cerr << "File: " << m_filepath << " has a corrupt data point." << std::endl
+                          << "Skipping that data point." << std::endl;
+            }
+            ++m_corruptCount;
+            return;
+        }
+
+        // All's well, push the read charge onto the charges.
+        m_storage.add(possibleCharge, isInSource ? begin : nullptr);
+    }
+
+    Source  m_source;
+    Parser  m_parser;
+    Storage m_storage;
+    std::string m_filepath;
+
+    bool m_reportCorruptPoints = true;
+
+    unsigned int m_corruptCount = 0;
+    bool m_isLoaded = false;
+};
+
+typedef BasicChargeDataModel<Sources::File, RecordParsers::Text, Storages::Vector> ChargeDataModel;
+
+/// Picking a loader at run time, once per file rather than once per data point.
+namespace ChargeLoading {
+    /// Which loader to read a file with.
+    struct Settings {
+        enum class Format {
+            TEXT,
+            FIXED_WIDTH,
+            BINARY
+        };
+
+        Format   format              = Format::TEXT;
+        bool     memoryMap           = false; // Map the file into memory rather than read it through a stream.
+        bool     reportCorruptPoints = true;
+        unsigned parserThreads       = 1;     // More than one parses big text files on that many threads.
+        bool     dropCache           = false; // Drop each file from the page cache once it's been read.
+    };
+
+    namespace impl {
+        // Whether a source reads from contents handed to it, rather than from the file itself.
+        template <typename Source> struct IsFromMemory : std::is_same<Source, Sources::Memory> {};
+        template <typename Inner> struct IsFromMemory<Decompression::Source<Inner>> : IsFromMemory<Inner> {};
+
+        // Loads into the given storage, which keeps whatever it was set up with (Storages::Scaled's decimals, say).
+        template <typename Source, typename Parser, typename Storage>
+        inline bool load(const std::string& filepath, const Settings& settings, const Sources::Memory::ContentsPtr& contents,
+                         Storage& storage, unsigned int& corruptCount) {
+            // Contents already in memory are from a small file, not worth any more threads.
+            if constexpr (!Parser::RECORDS_ARE_VALUES && !IsFromMemory<Source>::value) {
+                if (settings.parserThreads > 1 && ParallelLoader::isWorthwhile(filepath)) {
+                    std::vector<double> charges;
+                    if (!ParallelLoader::load<Source, Parser>(filepath, settings.parserThreads, settings.reportCorruptPoints, settings.dropCache,
+                                                              charges, corruptCount)) {
+                        return false;
+                    }
+                    storage.assign(std::move(charges));
+                    return true;
+                }
+            }
+
+            BasicChargeDataModel<Source, Parser, Storage> model;
+            model.init(filepath, settings.reportCorruptPoints);
+            model.getStorage() = std::move(storage);
+            if constexpr (IsFromMemory<Source>::value) {
+                model.getSource().setContents(contents);
+            } else {
+                model.getSource().setDropCache(settings.dropCache);
+            }
+            bool isLoaded = model.load();
+            storage = std::move(model.getStorage());
+            if (!isLoaded) return false;
+            corruptCount = model.getCorruptCount();
+            return true;
+        }
+
+        template <typename Source, typename Parser>
+        inline bool accumulate(const std::string& filepath, const Settings& settings, const DataAnalysis::Range& range,
+                               DataAnalysis::Accumulator& accumulator, unsigned int& corruptCount) {
+            BasicChargeDataModel<Source, Parser, Storages::Running> model;
+            model.init(filepath, settings.reportCorruptPoints);
+            model.getStorage().setRange(range);
+            if (!model.load()) return false;
+            accumulator  = model.getStorage().getAccumulator();
+            corruptCount = model.getCorruptCount();
+            return true;
+        }
+
+        template <typename Source>
+        inline bool accumulate(const std::string& filepath, const Settings& settings, const DataAnalysis::Range& range,
+                               DataAnalysis::Accumulator& accumulator, unsigned int& corruptCount) {
+            switch (settings.format) {
+            case Settings::Format::FIXED_WIDTH:
+                return accumulate<Source, RecordParsers::FixedWidth>(filepath, settings, range, accumulator, corruptCount);
+            case Settings::Format::BINARY:
+                return accumulate<Source, RecordParsers::Binary>(filepath, settings, range, accumulator, corruptCount);
+            default:
+                return accumulate<Source, RecordParsers::Text>(filepath, settings, range, accumulator, corruptCount);
+            }
+        }
+
+        template <typename Source, typename Storage>
+        inline bool load(const std::string& filepath, const Settings& settings, const Sources::Memory::ContentsPtr& contents,
+                         Storage& storage, unsigned int& corruptCount) {
+            switch (settings.format) {
+            case Settings::Format::FIXED_WIDTH:
+                return load<Source, RecordParsers::FixedWidth>(filepath, settings, contents, storage, corruptCount);
+            case Settings::Format::BINARY:
+                return load<Source, RecordParsers::Binary>(filepath, settings, contents, storage, corruptCount);
+            default:
+                return load<Source, RecordParsers::Text>(filepath, settings, contents, storage, corruptCount);
+            }
+        }
+    }
+
+    // Loads the charges in a file with the loader the settings ask for, or from its contents if they've already
+    // been read (by an AsyncReader or a BatchReader, say). gzip or zstd compressed files are decompressed as they're
+    // parsed, and charge packs (see ChargePack.h) decoded whatever the format setting. Returns false if the file
+    // couldn't be opened.
+    // Any storage with an assign for charges loaded in one go will do (Storages::Vector or Storages::Scaled).
+    template <typename Storage>
+    inline bool load(const std::string& filepath, const Settings& settings, Storage& storage, unsigned int& corruptCount,
+                     const Sources::Memory::ContentsPtr& contents = nullptr) {
+        if (ChargePack::isPackPath(filepath)) {
+            ChargePack::Reader reader;
+            std::string error;
+            if (!reader.open(filepath, error, contents)) {
+                std::cerr << filepath << ": " << error << std::endl;
+                return false;
+            }
+            Stats::ScopedTimer timer(Stats::Phase::PARSE);
+            std::vector<double> charges;
+            reader.decodeAll(charges);
+            Stats::add(Stats::Counter::BYTES_READ, reader.getSize());
+            Stats::add(Stats::Counter::LINES, charges.size());
+            corruptCount = (unsigned int)reader.getHeader().corruptCount;
+            storage.assign(std::move(charges));
+            return true;
+        }
+        if (contents != nullptr) {
+            if (Decompression::detect(contents->data(), contents->size()) != Decompression::Format::NONE) {
+                return impl::load<Decompression::Source<Sources::Memory>>(filepath, settings, contents, storage, corruptCount);
+            }
+            return impl::load<Sources::Memory>(filepath, settings, contents, storage, corruptCount);
+        }
+        if (Decompression::detect(filepath) != Decompression::Format::NONE) {
+            if (settings.memoryMap) {
+                return impl::load<Decompression::Source<Sources::Mapped>>(filepath, settings, nullptr, storage, corruptCount);
+            }
+            return impl::load<Decompression::Source<Sources::File>>(filepath, settings, nullptr, storage, corruptCount);
+        }
+        if (settings.memoryMap) {
+            return impl::load<Sources::Mapped>(filepath, settings, nullptr, storage, corruptCount);
+        }
+        return impl::load<Sources::File>(filepath, settings, nullptr, storage, corruptCount);
+    }
+
+    inline bool load(const std::string& filepath, const Settings& settings, std::vector<double>& charges, unsigned int& corruptCount,
+                     const Sources::Memory::ContentsPtr& contents = nullptr) {
+        Storages::Vector storage;
+        if (!load(filepath, settings, storage, corruptCount, contents)) return false;
+        charges = std::move(storage.getVector());
+        return true;
+    }
+
+    // Reads a stream (standard input or a pipe, see Sources::Stream) or a compressed file into running statistics
+    // as it arrives, in the format the settings ask for, holding only a block at a time however long it goes on.
+    // The load settings' source and thread choices don't apply. Only charges in the range count. Returns false if
+    // it couldn't be opened.
+    inline bool accumulate(const std::string& filepath, const Settings& settings, DataAnalysis::Accumulator& accumulator,
+                           unsigned int& corruptCount, const DataAnalysis::Range& range = DataAnalysis::Range()) {
+        if (Sources::Stream::isStream(filepath)) {
+            return impl::accumulate<Sources::Stream>(filepath, settings, range, accumulator, corruptCount);
+        }
+        return impl::accumulate<Decompression::Source<Sources::File>>(filepath, settings, range, accumulator, corruptCount);
+    }
+}
@@ -0,0 +1,451 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define CHARGE_PACK_HAS_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CHARGE_PACK_HAS_SSE2
+#endif
+
+#include "DataAnalysis.h"
+#include "Files.h"
+#include "FixedPoint.h"
+#include "LoaderPolicies.h"
+#include "Stats.h"
+
+/// A compact binary format for archiving charges (.cpk files): fixed point, frame-of-reference encoded and
+/// bit-packed in blocks.
+///
+/// Each block of up to BLOCK_SIZE charges holds them as offsets from the block's smallest, in only as many bits
+/// as its biggest offset needs, behind a header with the block's count, minimum, maximum, and exact sum and sum
+/// of squares. A summary of a whole file comes from the headers alone, without decoding a single charge, and a
+/// full decode reads a fraction of the bytes the text takes (17 bits a charge at 5 decimal places, against 9 or
+/// 10 bytes a line). Charges are independent measurements, so the differences between neighbours are no smaller
+/// than the spread, which is why it's offsets from a frame of reference rather than deltas.
+///
+/// Offsets are spread over LANES lanes of 32-bit words, charge i going in lane i % LANES, so one SIMD load brings
+/// in the same word of every lane and decoding takes a shift, an or and a mask for every LANES charges. A block
+/// whose offsets need more than 32 bits is stored unpacked, 64 bits each, instead.
+///
+/// The block headers double as zone maps for range queries: a block entirely outside the range is skipped, one
+/// entirely inside it counts with its header's sums, and only blocks straddling an end of the range get decoded.
+namespace ChargePack {
+    static constexpr uint32_t MAGIC      = 0x4B504843; // "CHPK" when read as little-endian bytes.
+    static constexpr uint32_t VERSION    = 1;
+    static constexpr size_t   BLOCK_SIZE = 1024; // Charges per block.
+    static constexpr size_t   LANES      = 8;
+    static constexpr uint32_t WIDE_BITS  = 64;   // A block of offsets stored whole rather than packed.
+
+    struct FileHeader {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t decimals;     // Charges are held multiplied by 10^decimals.
+        uint32_t blockSize;
+        uint64_t count;
+        uint64_t blockCount;
+        uint64_t corruptCount; // Data points skipped as corrupt in the file this was packed from.
+    };
+
+    /// Followed by the block's offsets from minimum: bits * BLOCK_SIZE / 32 words packed, or count 64-bit offsets.
+    struct BlockHeader {
+        uint64_t minimum;
+        uint64_t maximum;
+        uint64_t sum;
+        uint64_t sumOfSquaresLow;
+        uint64_t sumOfSquaresHigh;
+        uint32_t count;
+        uint32_t bits;
+    };
+
+    static_assert(sizeof(FileHeader) == 40 && sizeof(BlockHeader) == 48, "Headers are written as they are in memory");
+
+    inline bool isPackPath(const std::string& path) {
+        return path.size() > 4 && path.compare(path.size() - 4, 4, ".cpk") == 0;
+    }
+
+    inline size_t getPayloadSize(const BlockHeader& header) {
+        if (header.bits == WIDE_BITS) return (size_t)header.count * sizeof(uint64_t);
+        return (size_t)header.bits * (BLOCK_SIZE / 32) * sizeof(uint32_t);
+    }
+
+    namespace impl {
+        inline uint32_t getBitWidth(uint64_t value) {
+            uint32_t bits = 0;
+            while (value != 0) {
+                ++bits;
+                value >>= 1;
+            }
+            return bits;
+        }
+
+        // Packs BLOCK_SIZE offsets of the given width across the lanes. words must start zeroed.
+        inline void pack(const uint64_t* offsets, uint32_t bits, uint32_t* words) {
+            for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+                size_t lane = i % LANES;
+                size_t position = (i / LANES) * bits;
+                size_t word = position / 32;
+                unsigned shift = (unsigned)(position % 32);
+                uint32_t offset = (uint32_t)offsets[i];
+
+                words[word * LANES + lane] |= offset << shift;
+                if (shift + bits > 32) {
+                    words[(word + 1) * LANES + lane] |= offset >> (32 - shift);
+                }
+            }
+        }
+
+        // Unpacks BLOCK_SIZE offsets of the given width (1 to 32 bits), LANES at a time.
+        inline void unpack(const uint32_t* words, uint32_t bits, uint32_t* offsets) {
+            const uint32_t mask = bits == 32 ? 0xFFFFFFFF : (1u << bits) - 1;
+#if defined(CHARGE_PACK_HAS_AVX2)
+            const __m256i maskVector = _mm256_set1_epi32((int)mask);
+            for (size_t k = 0; k < BLOCK_SIZE / LANES; ++k) {
+                size_t position = k * bits;
+                size_t word = position / 32;
+                unsigned shift = (unsigned)(position % 32);
+
+                __m256i low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + word * LANES));
+                __m256i value = _mm256_srl_epi32(low, _mm_cvtsi32_si128((int)shift));
+                if (shift + bits > 32) {
+                    __m256i high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + (word + 1) * LANES));
+                    value = _mm256_or_si256(value, _mm256_sll_epi32(high, _mm_cvtsi32_si128((int)(32 - shift))));
+                }
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(offsets + k * LANES), _mm256_and_si256(value, maskVector));
+            }
+#elif defined(CHARGE_PACK_HAS_SSE2)
+            // The same as AVX2, with each row of lanes in two halves.
+            const __m128i maskVector = _mm_set1_epi32((int)mask);
+            for (size_t k = 0; k < BLOCK_SIZE / LANES; ++k) {
+                size_t position = k * bits;
+                size_t word = position / 32;
+                unsigned shift = (unsigned)(position % 32);
+                __m128i shiftRight = _mm_cvtsi32_si128((int)shift);
+                __m128i shiftLeft  = _mm_cvtsi32_si128((int)(32 - shift));
+
+                for (size_t half = 0; half < LANES; half += 4) {
+                    __m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + word * LANES + half));
+                    __m128i value = _mm_srl_epi32(low, shiftRight);
+                    if (shift + bits > 32) {
+                        __m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + (word + 1) * LANES + half));
+                        value = _mm_or_si128(value, _mm_sll_epi32(high, shiftLeft));
+                    }
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(offsets + k * LANES + half), _mm_and_si128(value, maskVector));
+                }
+            }
+#else
+            for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+                size_t lane = i % LANES;
+                size_t position = (i / LANES) * bits;
+                size_t word = position / 32;
+                unsigned shift = (unsigned)(position % 32);
+
+                uint32_t value = words[word * LANES + lane] >> shift;
+                if (shift + bits > 32) {
+                    value |= words[(word + 1) * LANES + lane] << (32 - shift);
+                }
+                offsets[i] = value & mask;
+            }
+#endif
+        }
+    }
+
+    // Writes charges already scaled to fixed point out as a pack. Goes through a temporary file, so a pack is
+    // never left half written. Returns false if it couldn't be written, or if the charges are too big for a
+    // block's sum to fit in its header.
+    inline bool write(const std::string& path, const FixedPoint::Charges& charges, uint64_t corruptCount) {
+        // Block sums are held in 64 bits, so a full block of the biggest charge has to fit. Charges scaled from
+        // doubles never pass 2^53, so this only turns away charges from somewhere else.
+        if (charges.getMaximum() > UINT64_MAX / BLOCK_SIZE) return false;
+
+        FileHeader fileHeader = {};
+        fileHeader.magic        = MAGIC;
+        fileHeader.version      = VERSION;
+        fileHeader.decimals     = charges.getDecimals();
+        fileHeader.blockSize    = (uint32_t)BLOCK_SIZE;
+        fileHeader.count        = charges.size();
+        fileHeader.blockCount   = (charges.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        fileHeader.corruptCount = corruptCount;
+
+        return Files::writeFileAtomically(path, [&](std::ostream& out) {
+            out.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+
+            const uint32_t* narrow = charges.getNarrow();
+            const uint64_t* wide = charges.getWide();
+            std::vector<uint64_t> values(BLOCK_SIZE);
+            std::vector<uint32_t> words;
+            for (size_t start = 0; start < charges.size(); start += BLOCK_SIZE) {
+                size_t count = std::min(BLOCK_SIZE, charges.size() - start);
+                for (size_t i = 0; i < count; ++i) {
+                    values[i] = narrow != nullptr ? narrow[start + i] : wide[start + i];
+                }
+
+                BlockHeader header = {};
+                header.count   = (uint32_t)count;
+                header.minimum = *std::min_element(values.begin(), values.begin() + count);
+                header.maximum = *std::max_element(values.begin(), values.begin() + count);
+                FixedPoint::UInt128 sumOfSquares;
+                for (size_t i = 0; i < count; ++i) {
+                    header.sum += values[i];
+                    sumOfSquares += FixedPoint::UInt128::multiply(values[i], values[i]);
+                }
+                header.sumOfSquaresLow  = sumOfSquares.low;
+                header.sumOfSquaresHigh = sumOfSquares.high;
+
+                // Offsets from the minimum, with the end of a short last block padded out with zeros.
+                for (size_t i = 0; i < BLOCK_SIZE; ++i) {
+                    values[i] = i < count ? values[i] - header.minimum : 0;
+                }
+                header.bits = impl::getBitWidth(header.maximum - header.minimum);
+                if (header.bits > 32) header.bits = WIDE_BITS;
+                out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+                if (header.bits == WIDE_BITS) {
+                    out.write(reinterpret_cast<const char*>(values.data()), (std::streamsize)getPayloadSize(header));
+                } else if (header.bits > 0) {
+                    words.assign(getPayloadSize(header) / sizeof(uint32_t), 0);
+                    impl::pack(values.data(), header.bits, words.data());
+                    out.write(reinterpret_cast<const char*>(words.data()), (std::streamsize)getPayloadSize(header));
+                }
+            }
+        });
+    }
+
+    /// Reads a pack, from a mapping of the file or from contents already read.
+    class Reader {
+    public:
+        // Returns false with the reason in error if it couldn't be opened or isn't a pack we understand.
+        bool open(const std::string& path, std::string& error, const Sources::Memory::ContentsPtr& contents = nullptr) {
+            m_blocks.clear();
+            m_size = 0;
+            const char* data = nullptr;
+            size_t size = 0;
+            if (contents != nullptr) {
+                data = contents->data();
+                size = contents->size();
+                m_keepAlive = contents;
+            } else {
+                Sources::Mapped source;
+                if (!source.open(path)) {
+                    error = "could not open file";
+                    return false;
+                }
+                source.next(data, size);
+                m_keepAlive = source.getKeepAlive(); // Keeps the mapping after the source is closed.
+            }
+
+            if (size < sizeof(FileHeader)) {
+                error = "too short to be a charge pack";
+                return false;
+            }
+            std::memcpy(&m_header, data, sizeof(m_header));
+            if (m_header.magic != MAGIC || m_header.version != VERSION || m_header.blockSize != BLOCK_SIZE) {
+                error = "not a charge pack this version understands";
+                return false;
+            }
+
+            // Find where each block starts, checking they all fit.
+            size_t offset = sizeof(FileHeader);
+            uint64_t count = 0;
+            m_blocks.reserve((size_t)std::min<uint64_t>(m_header.blockCount, size / sizeof(BlockHeader)));
+            for (uint64_t i = 0; i < m_header.blockCount; ++i) {
+                if (size - offset < sizeof(BlockHeader)) break;
+                const BlockHeader* header = reinterpret_cast<const BlockHeader*>(data + offset);
+                if (header->count == 0 || header->count > BLOCK_SIZE || (header->bits > 32 && header->bits != WIDE_BITS)) break;
+                offset += sizeof(BlockHeader);
+                if (size - offset < getPayloadSize(*header)) break;
+
+                m_blocks.push_back(header);
+                count += header->count;
+                offset += getPayloadSize(*header);
+            }
+            if (m_blocks.size() != m_header.blockCount || count != m_header.count) {
+                m_blocks.clear();
+                error = "charge pack is damaged or cut short";
+                return false;
+            }
+            m_size = size;
+            return true;
+        }
+
+        // Size of the whole pack in bytes.
+        size_t getSize() const {
+            return m_size;
+        }
+        const FileHeader& getHeader() const {
+            return m_header;
+        }
+        size_t getBlockCount() const {
+            return m_blocks.size();
+        }
+        const BlockHeader& getBlock(size_t index) const {
+            return *m_blocks[index];
+        }
+
+        // Decodes a block's offsets from its minimum, BLOCK_SIZE of them with any past its count as padding.
+        void decodeOffsets(size_t index, uint32_t* offsets) const {
+            const BlockHeader& header = *m_blocks[index];
+            const char* payload = reinterpret_cast<const char*>(&header) + sizeof(BlockHeader);
+            if (header.bits == 0) {
+                std::fill(offsets, offsets + BLOCK_SIZE, 0u);
+            } else if (header.bits == WIDE_BITS) {
+                // Only ever used for blocks too spread out to pack, which can't be decoded to 32-bit offsets.
+                std::fill(offsets, offsets + BLOCK_SIZE, 0u);
+            } else {
+                impl::unpack(reinterpret_cast<const uint32_t*>(payload), header.bits, offsets);
+            }
+        }
+        // Decodes a block's charges, scaled back to doubles (the very doubles they were packed from). Returns
+        // how many there were.
+        size_t decodeCharges(size_t index, double* charges) const {
+            const BlockHeader& header = *m_blocks[index];
+            const double scale = (double)FixedPoint::getScale(m_header.decimals);
+            if (header.bits == WIDE_BITS) {
+                const char* payload = reinterpret_cast<const char*>(&header) + sizeof(BlockHeader);
+                for (size_t i = 0; i < header.count; ++i) {
+                    uint64_t offset;
+                    std::memcpy(&offset, payload + i * sizeof(offset), sizeof(offset));
+                    charges[i] = (double)(header.minimum + offset) / scale;
+                }
+                return header.count;
+            }
+
+            uint32_t offsets[BLOCK_SIZE];
+            decodeOffsets(index, offsets);
+            for (size_t i = 0; i < header.count; ++i) {
+                charges[i] = (double)(header.minimum + offsets[i]) / scale;
+            }
+            return header.count;
+        }
+        // Decodes every charge in the pack.
+        void decodeAll(std::vector<double>& charges) const {
+            charges.resize((size_t)m_header.count);
+            size_t done = 0;
+            for (size_t i = 0; i < m_blocks.size(); ++i) {
+                done += decodeCharges(i, charges.data() + done);
+            }
+        }
+
+        // Exact sums over the whole pack, from the block headers alone.
+        FixedPoint::Sums getSums() const {
+            FixedPoint::Sums sums;
+            for (const BlockHeader* header : m_blocks) {
+                sums.count += header->count;
+                sums.sum += header->sum;
+                FixedPoint::UInt128 sumOfSquares;
+                sumOfSquares.low  = header->sumOfSquaresLow;
+                sumOfSquares.high = header->sumOfSquaresHigh;
+                sums.sumOfSquares += sumOfSquares;
+            }
+            return sums;
+        }
+        // Exact sums over the charges in the range, decoding only the blocks that straddle its ends.
+        FixedPoint::Sums getSums(const FixedPoint::ScaledRange& range) const {
+            FixedPoint::Sums sums;
+            if (range.isEmpty()) return sums;
+
+            uint64_t skipped = 0, decoded = 0;
+            uint32_t offsets[BLOCK_SIZE];
+            for (size_t i = 0; i < m_blocks.size(); ++i) {
+                const BlockHeader& header = *m_blocks[i];
+                if (header.maximum < range.lower || header.minimum > range.upper) {
+                    ++skipped;
+                } else if (header.minimum >= range.lower && header.maximum <= range.upper) {
+                    ++skipped;
+                    FixedPoint::Sums block;
+                    block.count = header.count;
+                    block.sum += header.sum;
+                    block.sumOfSquares.low  = header.sumOfSquaresLow;
+                    block.sumOfSquares.high = header.sumOfSquaresHigh;
+                    sums.merge(block);
+                } else if (header.bits == WIDE_BITS) {
+                    ++decoded;
+                    const char* payload = reinterpret_cast<const char*>(&header) + sizeof(BlockHeader);
+                    for (size_t j = 0; j < header.count; ++j) {
+                        uint64_t offset;
+                        std::memcpy(&offset, payload + j * sizeof(offset), sizeof(offset));
+                        if (range.contains(header.minimum + offset)) sums.add(header.minimum + offset);
+                    }
+                } else {
+                    ++decoded;
+                    decodeOffsets(i, offsets);
+                    sums.merge(sumOffsets(header, offsets, range));
+                }
+            }
+            Stats::add(Stats::Counter::BLOCKS_SKIPPED, skipped);
+            Stats::add(Stats::Counter::BLOCKS_DECODED, decoded);
+            return sums;
+        }
+
+        // The summary of the whole pack, from the block headers alone.
+        DataAnalysis::Summary summarise() const {
+            DataAnalysis::Summary summary = FixedPoint::summarise(getSums(), m_header.decimals);
+            summary.corruptCount = m_header.corruptCount;
+            return summary;
+        }
+        // The summary of the charges in the range, from the block headers as far as it can be.
+        DataAnalysis::Summary summarise(const DataAnalysis::Range& range) const {
+            if (range.isUnbounded()) return summarise();
+            FixedPoint::Sums sums = getSums(FixedPoint::getScaledRange(range, m_header.decimals));
+            DataAnalysis::Summary summary = FixedPoint::summarise(sums, m_header.decimals);
+            summary.corruptCount = m_header.corruptCount;
+            return summary;
+        }
+    private:
+        // Sums the block's charges in the range from its decoded offsets. The offsets in range are summed in 64
+        // bits (squares too, while they're narrow enough not to overflow), which vectorises, and only then moved
+        // up by the block's minimum: with n offsets o, sum (m + o)^2 = n m^2 + 2 m sum o + sum o^2.
+        static FixedPoint::Sums sumOffsets(const BlockHeader& header, const uint32_t* offsets, const FixedPoint::ScaledRange& range) {
+            // Offsets fit 32 bits here, so compare them against the range shifted down to the block.
+            const uint64_t lower = range.lower > header.minimum ? range.lower - header.minimum : 0;
+            const uint64_t upper = range.upper - header.minimum;
+
+            uint64_t count = 0, offsetSum = 0, narrowSquares = 0;
+            FixedPoint::UInt128 offsetSquares;
+            if (header.bits <= 26) {
+                // 1024 squares of 26 bits sum to under 2^62.
+                for (size_t j = 0; j < header.count; ++j) {
+                    uint64_t offset = offsets[j];
+                    uint64_t isIn = (uint64_t)(offset >= lower && offset <= upper);
+                    count += isIn;
+                    offsetSum += offset * isIn;
+                    narrowSquares += offset * offset * isIn;
+                }
+                offsetSquares += narrowSquares;
+            } else {
+                for (size_t j = 0; j < header.count; ++j) {
+                    uint64_t offset = offsets[j];
+                    if (offset < lower || offset > upper) continue;
+                    ++count;
+                    offsetSum += offset;
+                    offsetSquares += FixedPoint::UInt128::multiply(offset, offset);
+                }
+            }
+
+            FixedPoint::Sums sums;
+            sums.count = count;
+            sums.sum = FixedPoint::UInt128::multiply(count, header.minimum);
+            sums.sum += offsetSum;
+            FixedPoint::UInt128 squaresOfMinimum = FixedPoint::UInt128::multiply(header.minimum, header.minimum);
+            squaresOfMinimum.multiplyBy(count);
+            FixedPoint::UInt128 crossTerms = FixedPoint::UInt128::multiply(header.minimum, offsetSum);
+            crossTerms.multiplyBy(2);
+            sums.sumOfSquares = squaresOfMinimum;
+            sums.sumOfSquares += crossTerms;
+            sums.sumOfSquares += offsetSquares;
+            return sums;
+        }
+
+        FileHeader m_header = {};
+        std::vector<const BlockHeader*> m_blocks;
+        size_t m_size = 0;
+        std::shared_ptr<const void> m_keepAlive;
+    };
+}
@@ -0,0 +1,298 @@
+#pragma once
+
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <sstream>
+#include <charconv>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CHARGE_PARSER_HAS_SSE2 1
+#include <emmintrin.h>
+#endif
+
+#include "String.h"
+
+/// Parsing of the charge on a single line of a charge file.
+///
+/// There are several backends that all accept exactly the same lines and give bit-identical charges, so which is
+/// used is purely a matter of speed. A line holds a charge if, once surrounding whitespace is trimmed, it is a
+/// decimal number with an optional sign, fraction and exponent that isn't negative and doesn't overflow.
+/// Anything else, hex, inf and nan included, is corrupt.
+namespace ChargeParser {
+    enum class Backend { STRINGSTREAM, STRTOD, FROM_CHARS, FIXED_POINT, SIMD, COUNT };
+
+// Which backend parseLine uses, set it per deployment from the benchmark's --parsers results. Fixed point by
+// default, as it's the fastest that never allocates.
+#ifndef CHARGE_PARSER_DEFAULT_BACKEND
+#define CHARGE_PARSER_DEFAULT_BACKEND FIXED_POINT
+#endif
+    const Backend DEFAULT_BACKEND = Backend::CHARGE_PARSER_DEFAULT_BACKEND;
+
+    inline const char* getName(Backend backend) {
+        static const char* const NAMES[] = { "stringstream", "strtod", "from_chars", "fixed_point", "simd" };
+        return NAMES[(size_t)backend];
+    }
+
+    namespace impl {
+        // Every power of ten that a double holds exactly.
+        const double EXACT_POWERS_OF_TEN[] = {
+            1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+        };
+        const int      MAX_EXACT_EXPONENT = 22;
+        const uint64_t MAX_EXACT_MANTISSA = 1ULL << 53;
+
+        inline bool isDigit(char c) {
+            return c >= '0' && c <= '9';
+        }
+
+        // Moves begin and end inwards past any whitespace, the same as String::trim without the copy.
+        inline void trim(const char*& begin, const char*& end) {
+            while (begin < end && std::isspace((unsigned char)*begin)) ++begin;
+            while (end > begin && std::isspace((unsigned char)end[-1])) --end;
+        }
+
+        // Whether the text could start a decimal number, which rules out inf, nan and the like up front.
+        inline bool startsNumber(const char* begin, const char* end) {
+            if (begin < end && (*begin == '+' || *begin == '-')) ++begin;
+            return begin < end && (isDigit(*begin) || *begin == '.');
+        }
+
+        // The charge a parsed value makes, or false if the value isn't one.
+        inline bool accept(double value, double& charge) {
+            if (!(value >= 0.0) || std::isinf(value)) return false; // -0.0 passes, as it always has.
+            charge = value;
+            return true;
+        }
+
+        // Exact (correctly rounded) when both the mantissa and the power of ten are exact in a double, since
+        // then the result is a single rounded multiply or divide.
+        inline bool tryExact(uint64_t mantissa, int exponent, double& value) {
+            if (mantissa > MAX_EXACT_MANTISSA || exponent < -MAX_EXACT_EXPONENT || exponent > MAX_EXACT_EXPONENT) return false;
+            value = exponent < 0 ? (double)mantissa / EXACT_POWERS_OF_TEN[-exponent] : (double)mantissa * EXACT_POWERS_OF_TEN[exponent];
+            return true;
+        }
+    }
+
+    // The original parser: the charge streamed out of a stringstream, then a second extraction to catch trailing junk.
+    inline bool parseStringStream(const char* begin, const char* end, double& charge) {
+        impl::trim(begin, end);
+        std::stringstream sstream(std::string(begin, end));
+
+        double possibleCharge = -1.0;
+        if (!(sstream >> possibleCharge)) {
+            return false; // Nothing that reads as a number, which used to slip through as a charge of 0.
+        }
+
+        std::string emptyTest;
+        sstream >> emptyTest;
+        if (!emptyTest.empty()) {
+            return false;
+        }
+        return impl::accept(possibleCharge, charge);
+    }
+
+    inline bool parseStrtod(const char* begin, const char* end, double& charge) {
+        impl::trim(begin, end);
+        if (!impl::startsNumber(begin, end)) return false;
+
+        // strtod also takes hex, so only let it see the characters a decimal number can have.
+        for (const char* p = begin; p < end; ++p) {
+            if (!impl::isDigit(*p) && *p != '.' && *p != '+' && *p != '-' && *p != 'e' && *p != 'E') return false;
+        }
+
+        // strtod needs a terminated string, which the line usually isn't.
+        char local[64];
+        std::string heap;
+        const char* text = local;
+        size_t length = (size_t)(end - begin);
+        if (length < sizeof(local)) {
+            std::memcpy(local, begin, length);
+            local[length] = '\0';
+        } else {
+            heap.assign(begin, end);
+            text = heap.c_str();
+        }
+
+        char* parsedEnd = nullptr;
+        double value = std::strtod(text, &parsedEnd);
+        if (parsedEnd != text + length) return false;
+        return impl::accept(value, charge);
+    }
+
+    inline bool parseFromChars(const char* begin, const char* end, double& charge) {
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+        impl::trim(begin, end);
+        if (!impl::startsNumber(begin, end)) return false;
+
+        // from_chars won't take a leading plus, so step over it ourselves.
+        const char* text = begin;
+        if (*text == '+') {
+            ++text;
+            if (text < end && *text == '-') return false;
+        }
+
+        double value = 0.0;
+        auto result = std::from_chars(text, end, value, std::chars_format::general);
+        if (result.ec == std::errc::result_out_of_range) {
+            // Underflow is a (tiny) charge to the other backends but an error to from_chars, so let strtod decide.
+            return parseStrtod(begin, end, charge);
+        }
+        if (result.ec != std::errc() || result.ptr != end) return false;
+        return impl::accept(value, charge);
+#else
+        // No floating point from_chars in this standard library.
+        return parseStrtod(begin, end, charge);
+#endif
+    }
+
+    // Reads the digits straight into an integer mantissa and decimal exponent, then converts with a single exact
+    // multiply or divide. The rare line that can't be converted exactly that way (over 19 significant digits, or a
+    // large exponent) goes through strtod instead.
+    inline bool parseFixedPoint(const char* begin, const char* end, double& charge) {
+        impl::trim(begin, end);
+        const char* p = begin;
+
+        bool isNegative = false;
+        if (p < end && (*p == '+' || *p == '-')) {
+            isNegative = *p == '-';
+            ++p;
+        }
+
+        uint64_t mantissa = 0;
+        int      significantDigits = 0;
+        int      exponent = 0;
+        bool     hasDigits = false;
+        bool     isTruncated = false; // More significant digits than fit in the mantissa.
+        for (; p < end && impl::isDigit(*p); ++p) {
+            hasDigits = true;
+            if (mantissa == 0 && *p == '0') continue;
+            if (significantDigits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                ++significantDigits;
+            } else {
+                ++exponent;
+                isTruncated = true;
+            }
+        }
+        if (p < end && *p == '.') {
+            for (++p; p < end && impl::isDigit(*p); ++p) {
+                hasDigits = true;
+                if (mantissa == 0 && *p == '0') {
+                    --exponent;
+                } else if (significantDigits < 19) {
+                    mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                    ++significantDigits;
+                    --exponent;
+                } else {
+                    isTruncated = true;
+                }
+            }
+        }
+        if (!hasDigits) return false;
+
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            bool isExponentNegative = false;
+            if (p < end && (*p == '+' || *p == '-')) {
+                isExponentNegative = *p == '-';
+                ++p;
+            }
+            if (p == end || !impl::isDigit(*p)) return false;
+
+            int explicitExponent = 0;
+            for (; p < end && impl::isDigit(*p); ++p) {
+                if (explicitExponent < 100000) explicitExponent = explicitExponent * 10 + (*p - '0');
+            }
+            exponent += isExponentNegative ? -explicitExponent : explicitExponent;
+        }
+        if (p != end) return false;
+
+        // Only zero can be negative and still be a charge.
+        if (isNegative && mantissa != 0) return false;
+
+        double value = 0.0;
+        if (mantissa != 0 && (isTruncated || !impl::tryExact(mantissa, exponent, value))) {
+            return parseStrtod(begin, end, charge);
+        }
+        return impl::accept(isNegative ? -value : value, charge);
+    }
+
+    // Handles the common case of up to 16 digits and an optional decimal point with SSE2: the digits are lined up
+    // in a zero-padded register, checked in one go and combined into the mantissa by multiply-adding neighbouring
+    // groups of 1, 2, 4 and then 8 digits. Anything else (a sign, an exponent, more digits) or a machine without
+    // SSE2 goes through parseFixedPoint.
+    inline bool parseSimd(const char* begin, const char* end, double& charge) {
+#if defined(CHARGE_PARSER_HAS_SSE2)
+        const char* trimmedBegin = begin;
+        const char* trimmedEnd = end;
+        impl::trim(trimmedBegin, trimmedEnd);
+        size_t length = (size_t)(trimmedEnd - trimmedBegin);
+
+        const char* dot = static_cast<const char*>(std::memchr(trimmedBegin, '.', length));
+        size_t integerLength  = dot != nullptr ? (size_t)(dot - trimmedBegin) : length;
+        size_t fractionLength = dot != nullptr ? length - integerLength - 1 : 0;
+        if (integerLength + fractionLength == 0 || integerLength + fractionLength > 16) {
+            return parseFixedPoint(begin, end, charge);
+        }
+
+        // Right-align the digits without the point, with leading zeros that don't change the value.
+        alignas(16) char digits[16];
+        std::memset(digits, '0', sizeof(digits));
+        std::memcpy(digits + 16 - integerLength - fractionLength, trimmedBegin, integerLength);
+        if (fractionLength > 0) {
+            std::memcpy(digits + 16 - fractionLength, dot + 1, fractionLength);
+        }
+
+        __m128i text = _mm_load_si128(reinterpret_cast<const __m128i*>(digits));
+        __m128i notDigits = _mm_or_si128(_mm_cmplt_epi8(text, _mm_set1_epi8('0')), _mm_cmpgt_epi8(text, _mm_set1_epi8('9')));
+        if (_mm_movemask_epi8(notDigits) != 0) {
+            return parseFixedPoint(begin, end, charge); // Signs, exponents, a second point and junk all end up here.
+        }
+
+        __m128i values = _mm_sub_epi8(text, _mm_set1_epi8('0'));
+        __m128i zero = _mm_setzero_si128();
+        __m128i tens = _mm_set_epi16(1, 10, 1, 10, 1, 10, 1, 10);
+        __m128i pairs = _mm_packs_epi32(_mm_madd_epi16(_mm_unpacklo_epi8(values, zero), tens),
+                                        _mm_madd_epi16(_mm_unpackhi_epi8(values, zero), tens));
+        __m128i quads = _mm_madd_epi16(pairs, _mm_set_epi16(1, 100, 1, 100, 1, 100, 1, 100));
+        quads = _mm_packs_epi32(quads, quads);
+        __m128i octets = _mm_madd_epi16(quads, _mm_set_epi16(1, 10000, 1, 10000, 1, 10000, 1, 10000));
+
+        uint64_t high = (uint32_t)_mm_cvtsi128_si32(octets);
+        uint64_t low  = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(octets, 4));
+        uint64_t mantissa = high * 100000000ULL + low;
+
+        double value;
+        if (!impl::tryExact(mantissa, -(int)fractionLength, value)) {
+            return parseFixedPoint(begin, end, charge);
+        }
+        return impl::accept(value, charge);
+#else
+        return parseFixedPoint(begin, end, charge);
+#endif
+    }
+
+    inline bool parse(Backend backend, const char* begin, const char* end, double& charge) {
+        switch (backend) {
+        case Backend::STRTOD:      return parseStrtod(begin, end, charge);
+        case Backend::FROM_CHARS:  return parseFromChars(begin, end, charge);
+        case Backend::FIXED_POINT: return parseFixedPoint(begin, end, charge);
+        case Backend::SIMD:        return parseSimd(begin, end, charge);
+        default:                   return parseStringStream(begin, end, charge);
+        }
+    }
+
+    // Parses a single line of a charge file. Returns false if the line doesn't hold exactly one valid charge.
+    // Note: the line is trimmed in place.
+    inline bool parseLine(std::string& line, double& charge) {
+        // Trim whitespace.
+        String::trim(line);
+
+        return parse(DEFAULT_BACKEND, line.data(), line.data() + line.size(), charge);
+    }
+}
@@ -0,0 +1,352 @@
+#pragma once
+
+#include <cmath>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <algorithm>
+#include <vector>
+#include <fstream>
+#include <ostream>
+#include <filesystem>
+
+#include "DataAnalysis.h"
+#include "String.h"
+#include "Glob.h"
+
+/// Command line handling for running without anyone at the keyboard.
+namespace CommandLine {
+    struct Arguments {
+        std::vector<std::string> inputs;    // File names or glob patterns.
+        std::vector<std::string> manifests; // Files listing more file names or glob patterns, one per line.
+
+        bool        incremental    = false;
+        unsigned    fixedPointDecimals = 0; // Hold charges in fixed point with this many decimal places, 0 for not.
+        bool        memoryMap      = false; // Map files into memory rather than reading them through a stream.
+        std::string inputFormat    = "text";
+        unsigned    jobs           = 1;     // Files to have under way at once.
+        unsigned    parseThreads   = 1;     // Threads to parse each big file with.
+        bool        batchRead      = false; // Read files a batch at a time before analysing them.
+        bool        dropCache      = false; // Drop files from the page cache once they've been read.
+        std::string sharedRing;             // Shared-memory ring to take charges from live, empty for none.
+        unsigned    packDecimals   = 0;     // Write each file out as a charge pack with this many decimal places, 0 for not.
+        DataAnalysis::Range range;          // Only analyse charges in this range.
+        bool        buildIndex     = false; // Keep a line index beside each text file.
+        uint64_t    sampleSize     = 0;     // Lines to sample from each text file, 0 for all of them.
+        bool        useCache       = false;
+        std::string cacheDirectory = ".chargecache";
+        bool        verbose        = false; // Report each corrupt data point as it's found.
+        std::string format         = "text";
+        std::string outputPath;             // Empty for standard output.
+        bool        showStats      = false; // Dump timings and counters as JSON on stderr at the end.
+        std::string tracePath;              // Where to write a Chrome trace, empty for no trace.
+        double      maxAllocationsPerLine = -1.0; // Fail any file that allocates more than this per line, if not negative.
+        bool        showHelp       = false;
+    };
+
+    inline void printUsage(std::ostream& out, const char* program) {
+        out << "Usage: " << program << " [options] <file or pattern>..." << std::endl
+            << std::endl
+            << "Analyses each charge file given without asking any questions. Patterns may use *, ?, [...]" << std::endl
+            << "and ** (any number of directories). A file of - is standard input, which like a named pipe is" << std::endl
+            << "read as it arrives into running statistics, in constant memory (and never cached)." << std::endl
+            << "Files compressed with gzip or zstd are recognised and decompressed as they're parsed, where the" << std::endl
+            << "system has zlib or libzstd." << std::endl
+            << std::endl
+            << "Options:" << std::endl
+            << "  -m, --manifest <file>   Also analyse the files or patterns listed in <file>, one per line." << std::endl
+            << "                          Blank lines and lines starting with # are ignored, and relative" << std::endl
+            << "                          paths are taken relative to the manifest." << std::endl
+            << "  -i, --incremental       Keep analysis state beside each file so re-runs only read appended data." << std::endl
+            << "      --fixed-point <n>   Hold charges as integers with <n> decimal places (1 to 9) and sum them" << std::endl
+            << "                          exactly. Files with more decimal places than that fall back to doubles." << std::endl
+            << "      --mmap              Map files into memory rather than reading them through a stream." << std::endl
+            << "      --fixed-width       Files have every line the same width, so lines can be found without" << std::endl
+            << "                          searching (falls back to searching for any file where they aren't)." << std::endl
+            << "      --binary            Files hold raw little-endian doubles, 8 bytes per charge, not text." << std::endl
+            << "  -j, --jobs <n>          Analyse up to <n> files at once (default 1, 0 for one per hardware" << std::endl
+            << "                          thread). Worth going past the number of cores when files are on slow" << std::endl
+            << "                          or network storage. Results still come out in the order given." << std::endl
+            << "      --parse-threads <n> Parse each big text file on <n> threads (default 1, 0 for one per" << std::endl
+            << "                          hardware thread). The charges come out the same either way." << std::endl
+            << "      --batch-read        Read files into memory a batch at a time before analysing them," << std::endl
+            << "                          through io_uring where the system has it. For runs over many small" << std::endl
+            << "                          files, where opening and reading them one by one is the bottleneck." << std::endl
+            << "      --drop-cache        Drop each file from the system's page cache once it's been read, so a" << std::endl
+            << "                          big run doesn't push out files other programs have cached. Where the" << std::endl
+            << "                          system takes the hint (Linux and the like)." << std::endl
+            << "      --shm <name>        Instead of files, take charges live from the shared-memory ring <name>" << std::endl
+            << "                          that an acquisition process (or the Generator's --shm) writes to." << std::endl
+            << "                          Running statistics go to stderr every second, and the final results" << std::endl
+            << "                          out as for a file once the producer finishes. Not on Windows." << std::endl
+            << "      --pack <n>          Also write each file out beside itself as a charge pack (<file>.cpk)," << std::endl
+            << "                          holding charges with <n> decimal places (1 to 9). Packs are a fraction" << std::endl
+            << "                          of the size, decode quickly, and summarise without decoding at all." << std::endl
+            << "                          Any .cpk file given is read as a pack, whatever the other options." << std::endl
+            << "      --range <lo>:<hi>   Only analyse charges from <lo> to <hi> inclusive. Either end may be left" << std::endl
+            << "                          off, as in 1.5: for anything from 1.5 up. Over charge packs, only the" << std::endl
+            << "                          blocks straddling an end of the range are decoded." << std::endl
+            << "      --index             Keep a line index beside each text file analysed (<file>.idx), built" << std::endl
+            << "                          on the --parse-threads threads, for seeking to any line and sampling." << std::endl
+            << "      --sample <n>        Analyse a random sample of <n> lines from each text file, rather than" << std::endl
+            << "                          all of them. The same lines each run. Builds a line index if need be." << std::endl
+            << "  -c, --cache             Reuse results for files that have been analysed before." << std::endl
+            << "      --cache-dir <dir>   Where to keep cached results (default .chargecache). Implies --cache." << std::endl
+            << "  -f, --format <format>   How to write results: text (default), csv, jsonl or binary." << std::endl
+            << "  -o, --output <file>     Write results to <file> rather than standard output." << std::endl
+            << "  -v, --verbose           Report each corrupt data point as it's found." << std::endl
+            << "      --stats             Write per-phase timings and counters as JSON to stderr at the end." << std::endl
+            << "      --trace <file>      Record a Chrome trace (for Perfetto or chrome://tracing) into <file>." << std::endl
+            << "      --max-allocs-per-line <n>" << std::endl
+            << "                          Treat any file whose analysis makes more than <n> allocations per line" << std::endl
+            << "                          as a problem. For catching per-line allocations creeping back in." << std::endl
+            << "  -h, --help              Show this message." << std::endl
+            << std::endl
+            << "Exits with 0 if every file was analysed, 1 if any could not be, and 2 on bad usage." << std::endl;
+    }
+
+    namespace impl {
+        // Parses a range of charges written <lo>:<hi>, where an end left off is unbounded.
+        inline bool parseRange(const std::string& value, DataAnalysis::Range& range) {
+            size_t colon = value.find(':');
+            if (colon == std::string::npos) return false;
+
+            auto parseEnd = [](const std::string& text, double& end) {
+                if (text.empty()) return true;
+                char* textEnd = nullptr;
+                end = std::strtod(text.c_str(), &textEnd);
+                return *textEnd == '\0' && std::isfinite(end);
+            };
+            DataAnalysis::Range parsed;
+            if (!parseEnd(value.substr(0, colon), parsed.lower) || !parseEnd(value.substr(colon + 1), parsed.upper)) return false;
+            if (parsed.lower > parsed.upper) return false;
+            range = parsed;
+            return true;
+        }
+    }
+
+    // Parses the command line. Returns false with a message in error if it doesn't make sense.
+    inline bool parse(int argc, char* argv[], Arguments& arguments, std::string& error) {
+        bool optionsEnded = false;
+        for (int i = 1; i < argc; ++i) {
+            std::string argument = argv[i];
+
+            if (optionsEnded || argument.empty() || argument[0] != '-' || argument == "-") {
+                arguments.inputs.push_back(argument);
+                continue;
+            }
+
+            // Grabs the value for options that take one.
+            auto takeValue = [&](std::string& value) {
+                if (i + 1 >= argc) {
+                    error = "Option " + argument + " needs a value.";
+                    return false;
+                }
+                value = argv[++i];
+                return true;
+            };
+
+            if (argument == "--") {
+                optionsEnded = true;
+            } else if (argument == "-m" || argument == "--manifest") {
+                std::string manifest;
+                if (!takeValue(manifest)) return false;
+                arguments.manifests.push_back(manifest);
+            } else if (argument == "-i" || argument == "--incremental") {
+                arguments.incremental = true;
+            } else if (argument == "--fixed-point") {
+                std::string value;
+                if (!takeValue(value)) return false;
+                char* valueEnd = nullptr;
+                long decimals = std::strtol(value.c_str(), &valueEnd, 10);
+                if (value.empty() || *valueEnd != '\0' || decimals < 1 || decimals > 9) {
+                    error = "Option " + argument + " needs a number of decimal places from 1 to 9.";
+                    return false;
+                }
+                arguments.fixedPointDecimals = (unsigned)decimals;
+            } else if (argument == "--mmap") {
+                arguments.memoryMap = true;
+            } else if (argument == "--fixed-width") {
+                arguments.inputFormat = "fixed-width";
+            } else if (argument == "--binary") {
+                arguments.inputFormat = "binary";
+            } else if (argument == "-j" || argument == "--jobs") {
+                std::string value;
+                if (!takeValue(value)) return false;
+                char* valueEnd = nullptr;
+                long jobs = std::strtol(value.c_str(), &valueEnd, 10);
+                if (value.empty() || *valueEnd != '\0' || jobs < 0 || jobs > 1024) {
+                    error = "Option " + argument + " needs a number of files from 0 to 1024.";
+                    return false;
+                }
+                arguments.jobs = jobs == 0 ? std::max(std::thread::hardware_concurrency(), 1u) : (unsigned)jobs;
+            } else if (argument == "--parse-threads") {
+                std::string value;
+                if (!takeValue(value)) return false;
+                char* valueEnd = nullptr;
+                long threads = std::strtol(value.c_str(), &valueEnd, 10);
+                if (value.empty() || *valueEnd != '\0' || threads < 0 || threads > 256) {
+                    error = "Option " + argument + " needs a number of threads from 0 to 256.";
+                    return false;
+                }
+                arguments.parseThreads = threads == 0 ? std::max(std::thread::hardware_concurrency(), 1u) : (unsigned)threads;
+            } else if (argument == "--batch-read") {
+                arguments.batchRead = true;
+            } else if (argument == "--drop-cache") {
+                arguments.dropCache = true;
+            } else if (argument == "--shm") {
+                if (!takeValue(arguments.sharedRing)) return false;
+            } else if (argument == "--range") {
+                std::string value;
+                if (!takeValue(value)) return false;
+                if (!impl::parseRange(value, arguments.range)) {
+                    error = "Option " + argument + " needs a range like 1.5:2.0, with either end optional.";
+                    return false;
+                }
+            } else if (argument == "--index") {
+                arguments.buildIndex = true;
+            } else if (argument == "--sample") {
+                std::string value;
+                if (!takeValue(value)) return false;
+                char* valueEnd = nullptr;
+                unsigned long long lines = std::strtoull(value.c_str(), &valueEnd, 10);
+                if (value.empty() || *valueEnd != '\0' || value[0] == '-' || lines == 0 || lines > (1ULL << 32)) {
+                    error = "Option " + argument + " needs a number of lines from 1 to 4294967296.";
+                    return false;
+                }
+                arguments.sampleSize = lines;
+            } else if (argument == "--pack") {
+                std::string value;
+                if (!takeValue(value)) return false;
+                char* valueEnd = nullptr;
+                long decimals = std::strtol(value.c_str(), &valueEnd, 10);
+                if (value.empty() || *valueEnd != '\0' || decimals < 1 || decimals > 9) {
+                    error = "Option " + argument + " needs a number of decimal places from 1 to 9.";
+                    return false;
+                }
+                arguments.packDecimals = (unsigned)decimals;
+            } else if (argument == "-c" || argument == "--cache") {
+                arguments.useCache = true;
+            } else if (argument == "--cache-dir") {
+                if (!takeValue(arguments.cacheDirectory)) return false;
+                arguments.useCache = true;
+            } else if (argument == "-f" || argument == "--format") {
+                if (!takeValue(arguments.format)) return false;
+                if (arguments.format != "text" && arguments.format != "csv" && arguments.format != "jsonl" && arguments.format != "binary") {
+                    error = "Unknown format: " + arguments.format + ".";
+                    return false;
+                }
+            } else if (argument == "-o" || argument == "--output") {
+                if (!takeValue(arguments.outputPath)) return false;
+            } else if (argument == "-v" || argument == "--verbose") {
+                arguments.verbose = true;
+            } else if (argument == "--stats") {
+                arguments.showStats = true;
+            } else if (argument == "--trace") {
+                if (!takeValue(arguments.tracePath)) return false;
+            } else if (argument == "--max-allocs-per-line") {
+                std::string value;
+                if (!takeValue(value)) return false;
+                char* valueEnd = nullptr;
+                arguments.maxAllocationsPerLine = std::strtod(value.c_str(), &valueEnd);
+                if (value.empty() || *valueEnd != '\0' || !(arguments.maxAllocationsPerLine >= 0.0)) {
+                    error = "Option " + argument + " needs a number that isn't negative.";
+                    return false;
+                }
+            } else if (argument == "-h" || argument == "--help") {
+                arguments.showHelp = true;
+            } else {
+                error = "Unknown option: " + argument + ".";
+                return false;
+            }
+        }
+
+        if (arguments.incremental && arguments.fixedPointDecimals > 0) {
+            error = "Options --incremental and --fixed-point can't be used together.";
+            return false;
+        }
+        if (arguments.incremental && arguments.batchRead) {
+            error = "Options --incremental and --batch-read can't be used together.";
+            return false;
+        }
+        if (arguments.incremental && arguments.inputFormat == "binary") {
+            error = "Options --incremental and --binary can't be used together.";
+            return false;
+        }
+        if (!arguments.sharedRing.empty() && (!arguments.inputs.empty() || !arguments.manifests.empty())) {
+            error = "Option --shm can't be used with files.";
+            return false;
+        }
+        if (!arguments.sharedRing.empty() && arguments.incremental) {
+            error = "Options --incremental and --shm can't be used together.";
+            return false;
+        }
+        if (!arguments.range.isUnbounded() && arguments.incremental) {
+            error = "Options --incremental and --range can't be used together.";
+            return false;
+        }
+        if (arguments.sampleSize > 0 && (arguments.incremental || arguments.inputFormat == "binary" || !arguments.sharedRing.empty())) {
+            error = "Option --sample can't be used with --incremental, --binary or --shm.";
+            return false;
+        }
+        if (arguments.packDecimals > 0 && (arguments.incremental || !arguments.sharedRing.empty())) {
+            error = "Option --pack can't be used with --incremental or --shm.";
+            return false;
+        }
+        if (arguments.packDecimals > 0 && arguments.fixedPointDecimals > 0 && arguments.packDecimals != arguments.fixedPointDecimals) {
+            error = "Options --pack and --fixed-point need the same number of decimal places.";
+            return false;
+        }
+        if (!arguments.showHelp && arguments.inputs.empty() && arguments.manifests.empty() && arguments.sharedRing.empty()) {
+            error = "No files given.";
+            return false;
+        }
+        return true;
+    }
+
+    namespace impl {
+        // Adds the files matching an input to the list, or notes a problem if there aren't any.
+        inline void addInput(const std::string& input, std::vector<std::string>& files, std::vector<std::string>& problems) {
+            if (!Glob::hasWildcards(input)) {
+                // Plain names go straight through, if they don't exist the failure gets reported against the file.
+                files.push_back(input);
+                return;
+            }
+
+            std::vector<std::string> matches = Glob::expand(input);
+            if (matches.empty()) {
+                problems.push_back("No files match: " + input + ".");
+            }
+            files.insert(files.end(), matches.begin(), matches.end());
+        }
+    }
+
+    // Works out the full list of files to analyse, in the order given. Anything that couldn't be resolved
+    // is added to problems rather than stopping everything else.
+    inline void collectFiles(const Arguments& arguments, std::vector<std::string>& files, std::vector<std::string>& problems) {
+        for (const std::string& input : arguments.inputs) {
+            impl::addInput(input, files, problems);
+        }
+
+        for (const std::string& manifest : arguments.manifests) {
+            std::ifstream in(manifest);
+            if (!in.is_open()) {
+                problems.push_back("Could not open manifest: " + manifest + ".");
+                continue;
+            }
+
+            std::filesystem::path manifestDirectory = std::filesystem::path(manifest).parent_path();
+            std::string line;
+            while (std::getline(in, line)) {
+                String::trim(line);
+                if (line.empty() || line[0] == '#') continue;
+
+                std::filesystem::path entry(line);
+                if (entry.is_relative() && !manifestDirectory.empty()) {
+                    entry = manifestDirectory / entry;
+                }
+                impl::addInput(entry.string(), files, problems);
+            }
+        }
+    }
+}
@@ -0,0 +1,278 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <istream>
+#include <type_traits>
+#include <ostream>
+
+#include "Hash.h"
+
+/// The analysis kernels are templates over the type the data is stored as (T) and the type it's summed in (Sum),
+/// so each combination gets its own kernel at compile time. Data can be stored as float to halve the memory
+/// traffic while still being summed in double, or summed in DoubleDouble where double loses too much, and
+/// integer data (such as fixed-point charges) can be summed exactly in a wide enough integer. Results are in
+/// the units the data is stored in.
+namespace DataAnalysis {
+    /// A double with another double's worth of extra precision, held as the unevaluated sum of the two. Adding
+    /// up lots of doubles in one loses next to nothing, where a plain double drops the low bits of every add.
+    struct DoubleDouble {
+        double high = 0.0;
+        double low  = 0.0;
+
+        DoubleDouble() {}
+        DoubleDouble(double value) : high(value) {}
+
+        DoubleDouble& operator+=(double value) {
+            // Knuth's two-sum: the exact rounding error of high + value, carried along in low.
+            double sum = high + value;
+            double virtualValue = sum - high;
+            double error = (high - (sum - virtualValue)) + (value - virtualValue);
+
+            // Fold the carried error back in, keeping low small compared with high.
+            low += error;
+            high = sum + low;
+            low -= high - sum;
+            return *this;
+        }
+
+        explicit operator double() const {
+            return high + low;
+        }
+    };
+
+    /// Just enough of an unsigned 128-bit integer for exact sums, and sums of squares, of 64-bit integers.
+    struct UInt128 {
+        uint64_t low  = 0;
+        uint64_t high = 0;
+
+        static UInt128 multiply(uint64_t a, uint64_t b) {
+            // Schoolbook multiply on 32-bit halves, so it works without compiler support for 128-bit integers.
+            uint64_t aLow = a & 0xFFFFFFFF, aHigh = a >> 32;
+            uint64_t bLow = b & 0xFFFFFFFF, bHigh = b >> 32;
+            uint64_t lowLow   = aLow * bLow;
+            uint64_t lowHigh  = aLow * bHigh;
+            uint64_t highLow  = aHigh * bLow;
+            uint64_t highHigh = aHigh * bHigh;
+
+            uint64_t middle = (lowLow >> 32) + (lowHigh & 0xFFFFFFFF) + (highLow & 0xFFFFFFFF);
+            UInt128 product;
+            product.low  = (middle << 32) | (lowLow & 0xFFFFFFFF);
+            product.high = highHigh + (lowHigh >> 32) + (highLow >> 32) + (middle >> 32);
+            return product;
+        }
+
+        UInt128& operator+=(uint64_t value) {
+            low += value;
+            if (low < value) ++high;
+            return *this;
+        }
+        UInt128& operator+=(const UInt128& value) {
+            *this += value.low;
+            high += value.high;
+            return *this;
+        }
+        UInt128 operator-(const UInt128& value) const {
+            UInt128 difference;
+            difference.low  = low - value.low;
+            difference.high = high - value.high - (low < value.low ? 1 : 0);
+            return difference;
+        }
+
+        // Multiplies by factor, returning false (and leaving garbage) if the product doesn't fit.
+        bool multiplyBy(uint64_t factor) {
+            UInt128 lowProduct  = multiply(low, factor);
+            UInt128 highProduct = multiply(high, factor);
+            if (highProduct.high != 0) return false;
+
+            low  = lowProduct.low;
+            high = lowProduct.high + highProduct.low;
+            return high >= highProduct.low;
+        }
+
+        double toDouble() const {
+            return (double)high * 18446744073709551616.0 + (double)low;
+        }
+        explicit operator double() const {
+            return toDouble();
+        }
+    };
+
+    /// What to sum each type of data in when not told otherwise. Integers are always summed exactly, so each
+    /// integer type needs a sum wide enough for it.
+    template <typename T> struct DefaultSum {
+        static_assert(!std::is_integral<T>::value, "integer data needs a DefaultSum that adds it up exactly");
+        typedef double type;
+    };
+    template <> struct DefaultSum<int32_t>  { typedef int64_t type; };  // Exact for up to 2^32 values.
+    template <> struct DefaultSum<uint32_t> { typedef uint64_t type; }; // Exact for up to 2^32 values.
+    template <> struct DefaultSum<uint64_t> { typedef UInt128 type; };  // Exact for up to 2^64 values.
+
+    template <typename T, typename Sum = typename DefaultSum<T>::type>
+    inline double computeMean(const T* data, unsigned int size) {
+        Sum total = Sum();
+        for (unsigned int i = 0; i < size; ++i) {
+            total += data[i];
+        }
+        return (double)total / (double)size;
+    }
+
+    template <typename T, typename Sum = typename DefaultSum<T>::type>
+    inline double computeStandardDeviation(const T* data, unsigned int size, double mean) {
+        // Squared differences from the mean are never whole numbers, so sum them as floating point whatever T is.
+        const bool isIntegerSum = std::is_integral<Sum>::value || std::is_same<Sum, UInt128>::value;
+        typedef typename std::conditional<isIntegerSum, double, Sum>::type DeviationSum;
+
+        DeviationSum total = DeviationSum();
+        for (unsigned int i = 0; i < size; ++i) {
+            total += std::pow((double)data[i] - mean, 2.0);
+        }
+        return std::sqrt((double)total / (double)(size - 1));
+    }
+
+    inline double computeStandardErrorInTheMean(double mean, unsigned int size) {
+        return mean / std::sqrt((double)size);
+    }
+
+    /// The numbers we report for a data set.
+    struct Summary {
+        uint64_t count                  = 0;
+        double   mean                   = 0.0;
+        double   standardDeviation      = 0.0;
+        double   standardErrorInTheMean = 0.0;
+        uint64_t corruptCount           = 0; // Data points skipped as corrupt.
+    };
+
+    /// A range of charges to restrict an analysis to, both ends included. Unbounded both ways unless set.
+    struct Range {
+        double lower = -HUGE_VAL;
+        double upper = HUGE_VAL;
+
+        bool isUnbounded() const {
+            return lower == -HUGE_VAL && upper == HUGE_VAL;
+        }
+        bool contains(double value) const {
+            return value >= lower && value <= upper;
+        }
+    };
+
+    /// Options that change the numbers an analysis produces, anything keyed on results needs keying on these too.
+    struct Options {
+        bool     streaming          = false; // Single-pass running statistics rather than two passes over the loaded data.
+        unsigned fixedPointDecimals = 0;     // Hold charges as integers scaled by 10^this, 0 for doubles.
+        bool     binaryInput        = false; // Files hold raw doubles rather than a charge per line of text.
+        Range    range;                      // Only charges in this range count.
+        uint64_t sampleSize         = 0;     // Lines to pick at random from each text file, 0 for all of them.
+
+        uint64_t hash() const {
+            // Bump the version whenever the way results are computed changes, so anything keyed on old results misses.
+            const uint64_t VERSION = 2; // 2: lines with no number in them are corrupt rather than charges of 0.
+            uint64_t h = Hash::combine(0, VERSION);
+            h = Hash::combine(h, streaming ? 1 : 0);
+            // Only mixed in when used, so results cached before it existed still hit.
+            if (fixedPointDecimals > 0) h = Hash::combine(h, 0x100 + fixedPointDecimals);
+            if (binaryInput) h = Hash::combine(h, 0x200);
+            if (!range.isUnbounded()) {
+                h = Hash::combine(h, 0x300);
+                h = Hash::compute(&range.lower, sizeof(range.lower), h);
+                h = Hash::compute(&range.upper, sizeof(range.upper), h);
+            }
+            if (sampleSize > 0) {
+                h = Hash::combine(h, 0x400);
+                h = Hash::combine(h, sampleSize);
+            }
+            return h;
+        }
+    };
+
+    /// Running statistics over a stream of data points, for when we can't (or don't want to) hold all the data at once.
+    ///
+    /// Uses Welford's algorithm so that the mean and standard deviation come out as accurate as the two-pass
+    /// versions above, and two accumulators over separate bits of data can be merged into one.
+    class Accumulator {
+    public:
+        void add(double value) {
+            ++m_count;
+            double delta = value - m_mean;
+            m_mean += delta / (double)m_count;
+            m_m2 += delta * (value - m_mean);
+        }
+
+        void merge(const Accumulator& other) {
+            if (other.m_count == 0) return;
+            if (m_count == 0) {
+                *this = other;
+                return;
+            }
+
+            uint64_t count = m_count + other.m_count;
+            double delta = other.m_mean - m_mean;
+            m_mean += delta * (double)other.m_count / (double)count;
+            m_m2 += other.m_m2 + delta * delta * (double)m_count * (double)other.m_count / (double)count;
+            m_count = count;
+        }
+
+        void reset() {
+            m_count = 0;
+            m_mean = 0.0;
+            m_m2 = 0.0;
+        }
+
+        uint64_t getCount() const {
+            return m_count;
+        }
+        double getMean() const {
+            return m_mean;
+        }
+        double getStandardDeviation() const {
+            return std::sqrt(m_m2 / (double)(m_count - 1));
+        }
+
+        // Writes the raw accumulator state out in binary, for picking back up later.
+        void write(std::ostream& out) const {
+            out.write(reinterpret_cast<const char*>(&m_count), sizeof(m_count));
+            out.write(reinterpret_cast<const char*>(&m_mean),  sizeof(m_mean));
+            out.write(reinterpret_cast<const char*>(&m_m2),    sizeof(m_m2));
+        }
+        // Reads raw accumulator state written by write, returns false if the stream ran dry.
+        bool read(std::istream& in) {
+            in.read(reinterpret_cast<char*>(&m_count), sizeof(m_count));
+            in.read(reinterpret_cast<char*>(&m_mean),  sizeof(m_mean));
+            in.read(reinterpret_cast<char*>(&m_m2),    sizeof(m_m2));
+            return (bool)in;
+        }
+    private:
+        uint64_t m_count = 0;
+        double   m_mean  = 0.0;
+        double   m_m2    = 0.0; // Sum of squared differences from the current mean.
+    };
+
+    template <typename T, typename Sum = typename DefaultSum<T>::type>
+    inline Summary summarise(const T* data, unsigned int size) {
+        Summary summary;
+        summary.count                  = size;
+        summary.mean                   = computeMean<T, Sum>(data, size);
+        summary.standardDeviation      = computeStandardDeviation<T, Sum>(data, size, summary.mean);
+        summary.standardErrorInTheMean = computeStandardErrorInTheMean(summary.mean, size);
+        return summary;
+    }
+
+    inline Summary summarise(const Accumulator& accumulator) {
+        Summary summary;
+        summary.count                  = accumulator.getCount();
+        summary.mean                   = accumulator.getMean();
+        summary.standardDeviation      = accumulator.getStandardDeviation();
+        summary.standardErrorInTheMean = computeStandardErrorInTheMean(summary.mean, (unsigned int)summary.count);
+        return summary;
+    }
+
+    // Summarises only the data points in the range, in one pass without copying them out.
+    template <typename T>
+    inline Summary summarise(const T* data, unsigned int size, const Range& range) {
+        Accumulator accumulator;
+        for (unsigned int i = 0; i < size; ++i) {
+            if (range.contains((double)data[i])) accumulator.add((double)data[i]);
+        }
+        return summarise(accumulator);
+    }
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <list>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <filesystem>
+#include <system_error>
+#include <unordered_map>
+
+#include "ChargeDataModel.h"
+#include "FixedPoint.h"
+
+/// In-memory cache of loaded data sets, so the same file listed more than once only gets parsed once.
+///
+/// Data sets are handed out as shared read-only views, so any number of readers can use one at the same time,
+/// and an evicted data set stays alive for whoever is still holding it. The cache is bounded by the number of
+/// bytes it holds rather than the number of data sets, evicting the least recently used first.
+class DatasetCache {
+public:
+    /// A loaded data set, held either as doubles or, when asked for and every charge allows it, as fixed point.
+    struct Dataset {
+        std::vector<double> charges;
+        FixedPoint::Charges scaledCharges;
+        unsigned int corruptCount = 0;
+
+        size_t getSizeInBytes() const {
+            return sizeof(Dataset) + charges.capacity() * sizeof(double) + scaledCharges.getSizeInBytes();
+        }
+    };
+    typedef std::shared_ptr<const Dataset> DatasetPtr;
+
+    // Data sets are held in fixed point with the given number of decimal places, unless it's 0.
+    void init(size_t maxBytes = 256 << 20, const ChargeLoading::Settings& loadSettings = ChargeLoading::Settings(), unsigned fixedPointDecimals = 0) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_maxBytes = maxBytes;
+        m_loadSettings = loadSettings;
+        m_fixedPointDecimals = fixedPointDecimals;
+        evict();
+    }
+    void dispose() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.clear();
+        m_index.clear();
+        m_usedBytes = 0;
+    }
+
+    // Gets the data set for the file, loading it if we don't have an up-to-date copy.
+    // If another thread is already loading the same file, we wait for that rather than loading it twice.
+    // The contents, if given, are what's already been read from the file, to load from rather than reading it again.
+    // Returns nullptr if the file couldn't be loaded.
+    DatasetPtr get(const std::string& filepath, const Sources::Memory::ContentsPtr& contents = nullptr) {
+        Key key;
+        if (!makeKey(filepath, key)) {
+            // Can't stat it, let the loader deal with reporting that.
+            return load(filepath, m_loadSettings, m_fixedPointDecimals, contents);
+        }
+
+        std::promise<DatasetPtr> promise;
+        std::shared_future<DatasetPtr> inFlight;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            auto it = m_index.find(key.path);
+            if (it != m_index.end()) {
+                Entry& entry = *it->second;
+                if (entry.key.size == key.size && entry.key.modifiedTime == key.modifiedTime) {
+                    // Hit, move it to the front as most recently used.
+                    m_entries.splice(m_entries.begin(), m_entries, it->second);
+                    ++m_hits;
+                    return entry.dataset;
+                }
+                // File has changed since we loaded it.
+                remove(it->second);
+            }
+
+            auto loading = m_loading.find(key.path);
+            if (loading != m_loading.end()) {
+                inFlight = loading->second;
+            } else {
+                m_loading[key.path] = promise.get_future().share();
+            }
+            ++m_misses;
+        }
+        if (inFlight.valid()) {
+            return inFlight.get();
+        }
+
+        DatasetPtr dataset;
+        try {
+            dataset = load(filepath, m_loadSettings, m_fixedPointDecimals, contents);
+        } catch (...) {
+            // Don't leave anyone waiting on us forever.
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_loading.erase(key.path);
+            }
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (dataset != nullptr) {
+                insert(key, dataset);
+            }
+            m_loading.erase(key.path);
+        }
+        promise.set_value(dataset);
+        return dataset;
+    }
+
+    size_t getUsedBytes() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_usedBytes;
+    }
+    uint64_t getHits() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_hits;
+    }
+    uint64_t getMisses() const {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_misses;
+    }
+
+    // Loads a data set without involving any cache. Returns nullptr if the file couldn't be loaded.
+    static DatasetPtr load(const std::string& filepath, const ChargeLoading::Settings& loadSettings, unsigned fixedPointDecimals = 0,
+                           const Sources::Memory::ContentsPtr& contents = nullptr) {
+        auto dataset = std::make_shared<Dataset>();
+        if (fixedPointDecimals == 0) {
+            if (!ChargeLoading::load(filepath, loadSettings, dataset->charges, dataset->corruptCount, contents)) {
+                return nullptr;
+            }
+            return dataset;
+        }
+
+        // Scaled as they're parsed, so there's never a vector of doubles as well, unless a charge won't scale.
+        Storages::Scaled storage;
+        storage.setDecimals(fixedPointDecimals);
+        storage.clear();
+        if (!ChargeLoading::load(filepath, loadSettings, storage, dataset->corruptCount, contents)) {
+            return nullptr;
+        }
+        if (storage.isScaled()) {
+            dataset->scaledCharges = std::move(storage.getCharges());
+        } else {
+            dataset->charges = std::move(storage.getVector());
+            std::cerr << "File: " << filepath << " has charges with more than " << fixedPointDecimals
+                      << " decimal places, analysing it in floating point." << std::endl;
+        }
+        return dataset;
+    }
+private:
+    /// Identifies a particular version of a file.
+    struct Key {
+        std::string path;
+        uint64_t    size;
+        int64_t     modifiedTime;
+    };
+    struct Entry {
+        Key        key;
+        DatasetPtr dataset;
+        size_t     bytes;
+    };
+    typedef std::list<Entry>::iterator EntryIterator;
+
+    static bool makeKey(const std::string& filepath, Key& key) {
+        std::error_code error;
+        std::filesystem::path absolutePath = std::filesystem::absolute(filepath, error);
+        if (error) return false;
+
+        key.path = absolutePath.string();
+        key.size = (uint64_t)std::filesystem::file_size(absolutePath, error);
+        if (error) return false;
+        key.modifiedTime = (int64_t)std::filesystem::last_write_time(absolutePath, error).time_since_epoch().count();
+        return !error;
+    }
+
+    // Must hold the lock for the following.
+    void insert(const Key& key, const DatasetPtr& dataset) {
+        size_t bytes = dataset->getSizeInBytes();
+        // Never going to fit, don't throw everything else out trying.
+        if (bytes > m_maxBytes) return;
+
+        m_entries.push_front(Entry{ key, dataset, bytes });
+        m_index[key.path] = m_entries.begin();
+        m_usedBytes += bytes;
+        evict();
+    }
+    void remove(EntryIterator it) {
+        m_usedBytes -= it->bytes;
+        m_index.erase(it->key.path);
+        m_entries.erase(it);
+    }
+    void evict() {
+        while (m_usedBytes > m_maxBytes && !m_entries.empty()) {
+            remove(std::prev(m_entries.end()));
+        }
+    }
+
+    mutable std::mutex m_mutex;
+    std::list<Entry> m_entries; // Most recently used at the front.
+    std::unordered_map<std::string, EntryIterator> m_index;
+    std::unordered_map<std::string, std::shared_future<DatasetPtr>> m_loading;
+
+    ChargeLoading::Settings m_loadSettings;
+    unsigned m_fixedPointDecimals = 0;
+
+    size_t   m_maxBytes  = 256 << 20;
+    size_t   m_usedBytes = 0;
+    uint64_t m_hits      = 0;
+    uint64_t m_misses    = 0;
+};
@@ -0,0 +1,284 @@
+#pragma once
+
+#include <cmath>
+#include <future>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <algorithm>
+
+/// Generates synthetic charge data sets, in the text layout of millikan.dat or as packed doubles.
+///
+/// Charges follow a quantised model: a whole number of elementary charges, drawn uniformly between two multiples,
+/// plus Gaussian measurement noise. Lines are generated in fixed-size chunks, each with its own random number
+/// stream seeded from the overall seed and the chunk index, so the output only depends on the seed and not on
+/// how many threads did the work.
+namespace DatasetGenerator {
+    struct Settings {
+        uint64_t lines           = 1000000;
+        uint64_t seed            = 1;
+
+        double   elementaryCharge = 1.60218;
+        unsigned minMultiple      = 1;
+        unsigned maxMultiple      = 1;
+        double   noise            = 0.1;      // Standard deviation of the measurement noise.
+
+        unsigned decimals         = 5;
+        double   corruptFraction  = 0.0;      // Fraction of lines replaced by something that isn't a valid charge.
+        bool     crlf             = false;    // Windows line endings.
+        bool     oddWhitespace    = false;    // Random runs of spaces and tabs either side of each value.
+        bool     binary           = false;    // Packed little-endian doubles rather than text, corrupt points are NaN.
+    };
+
+    const uint64_t CHUNK_LINES = 1 << 16;
+
+    /// Small, fast random number generator (xoshiro256**), seeded through splitmix64.
+    class Random {
+    public:
+        Random(uint64_t seed) {
+            for (int i = 0; i < 4; ++i) {
+                seed += 0x9E3779B97F4A7C15ULL;
+                uint64_t z = seed;
+                z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+                z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+                m_state[i] = z ^ (z >> 31);
+            }
+        }
+
+        uint64_t next() {
+            uint64_t result = rotl(m_state[1] * 5, 7) * 9;
+            uint64_t t = m_state[1] << 17;
+            m_state[2] ^= m_state[0];
+            m_state[3] ^= m_state[1];
+            m_state[1] ^= m_state[2];
+            m_state[0] ^= m_state[3];
+            m_state[2] ^= t;
+            m_state[3] = rotl(m_state[3], 45);
+            return result;
+        }
+        // Uniform in [0, 1).
+        double nextDouble() {
+            return (double)(next() >> 11) * (1.0 / 9007199254740992.0);
+        }
+        // Uniform in [0, bound).
+        uint64_t nextBelow(uint64_t bound) {
+            return bound <= 1 ? 0 : next() % bound;
+        }
+        // Standard normal, through the inverse of the normal CDF (Acklam's rational approximation, relative error
+        // around 1e-9). Unlike Box-Muller this needs no log, sqrt or trig outside the 5% of draws in the tails.
+        double nextGaussian() {
+            static const double A[] = { -3.969683028665376e+01,  2.209460984245205e+02, -2.759285104469687e+02,
+                                         1.383577518672690e+02, -3.066479806614716e+01,  2.506628277459239e+00 };
+            static const double B[] = { -5.447609879822406e+01,  1.615858368580409e+02, -1.556989798598866e+02,
+                                         6.680131188771972e+01, -1.328068155288572e+01 };
+            static const double C[] = { -7.784894002430293e-03, -3.223964580411365e-01, -2.400758277161838e+00,
+                                        -2.549671010584765e+00,  4.374664141464968e+00,  2.938163982698783e+00 };
+            static const double D[] = {  7.784695709041462e-03,  3.224671290700398e-01,  2.445134137142996e+00,
+                                         3.754408661907416e+00 };
+            const double LOW = 0.02425;
+
+            double p = ((double)(next() >> 11) + 0.5) * (1.0 / 9007199254740992.0); // (0, 1), never hits either end.
+            if (p < LOW || p > 1.0 - LOW) {
+                double q = std::sqrt(-2.0 * std::log(p < LOW ? p : 1.0 - p));
+                double x = (((((C[0] * q + C[1]) * q + C[2]) * q + C[3]) * q + C[4]) * q + C[5])
+                         / ((((D[0] * q + D[1]) * q + D[2]) * q + D[3]) * q + 1.0);
+                return p < LOW ? x : -x;
+            }
+            double q = p - 0.5;
+            double r = q * q;
+            return (((((A[0] * r + A[1]) * r + A[2]) * r + A[3]) * r + A[4]) * r + A[5]) * q
+                 / (((((B[0] * r + B[1]) * r + B[2]) * r + B[3]) * r + B[4]) * r + 1.0);
+        }
+    private:
+        static uint64_t rotl(uint64_t x, int r) {
+            return (x << r) | (x >> (64 - r));
+        }
+
+        uint64_t m_state[4];
+    };
+
+    namespace impl {
+        const char* const CORRUPT_VALUES[] = { "error", "1.2.3", "-1.00000", "nan?", "1.5 1.6", "#####" };
+
+        inline char* writeWhitespace(char* out, Random& random, unsigned maxLength) {
+            uint64_t bits = random.next();
+            uint64_t length = (bits & 0xFF) % (maxLength + 1);
+            bits >>= 8;
+            for (uint64_t i = 0; i < length; ++i, bits >>= 2) {
+                *out++ = (bits & 3) == 0 ? '\t' : ' ';
+            }
+            return out;
+        }
+
+        // Writes the value with a fixed number of decimals, right aligned in a field of the given width.
+        inline char* writeFixed(char* out, double value, unsigned decimals, unsigned width) {
+            static const uint64_t POWERS[] = { 1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+            static const char PAIRS[] =
+                "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+                "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+                "8081828384858687888990919293949596979899";
+
+            uint64_t scaled   = (uint64_t)(std::fabs(value) * (double)POWERS[decimals] + 0.5);
+            bool     negative = value < 0.0 && scaled > 0; // No "-0.00000".
+            uint64_t whole    = scaled / POWERS[decimals];
+            uint64_t fraction = scaled % POWERS[decimals];
+
+            unsigned wholeDigits = 1;
+            for (uint64_t w = whole; w >= 10; w /= 10) ++wholeDigits;
+
+            unsigned length = (negative ? 1 : 0) + wholeDigits + (decimals > 0 ? decimals + 1 : 0);
+            for (unsigned i = length; i < width; ++i) *out++ = ' ';
+            if (negative) *out++ = '-';
+
+            // Digits go in from the right, two at a time where we can.
+            char* p = out + wholeDigits;
+            do {
+                *--p = (char)('0' + whole % 10);
+                whole /= 10;
+            } while (whole > 0);
+            out += wholeDigits;
+
+            if (decimals > 0) {
+                *out++ = '.';
+                p = out + decimals;
+                unsigned remaining = decimals;
+                while (remaining >= 2) {
+                    unsigned pair = (unsigned)(fraction % 100);
+                    fraction /= 100;
+                    *--p = PAIRS[pair * 2 + 1];
+                    *--p = PAIRS[pair * 2];
+                    remaining -= 2;
+                }
+                if (remaining > 0) *--p = (char)('0' + fraction % 10);
+                out += decimals;
+            }
+            return out;
+        }
+    }
+
+    const unsigned MAX_DECIMALS = 9;
+
+    // Whether every charge the settings could produce can be written as text. writeFixed scales each one up to a
+    // whole number of the smallest decimal, which has to stay below 2^53 to be exact.
+    inline bool isWritableAsText(const Settings& settings) {
+        // The normal draws never go beyond about 8.3 standard deviations, as the uniform draw behind each one never
+        // comes within 2^-54 of 0 or 1.
+        unsigned largestMultiple = std::max(settings.minMultiple, settings.maxMultiple);
+        double largest = std::fabs(settings.elementaryCharge) * (double)largestMultiple + std::fabs(settings.noise) * 9.0;
+        return settings.decimals <= MAX_DECIMALS && largest * std::pow(10.0, settings.decimals) < 9007199254740992.0;
+    }
+
+    inline uint64_t getChunkCount(const Settings& settings) {
+        return (settings.lines + CHUNK_LINES - 1) / CHUNK_LINES;
+    }
+
+    // Appends the given chunk of the data set to out. Always produces the same bytes for the same settings and index.
+    inline void generateChunk(const Settings& settings, uint64_t index, std::string& out) {
+        uint64_t first = index * CHUNK_LINES;
+        uint64_t lines = std::min<uint64_t>(CHUNK_LINES, settings.lines - first);
+
+        Random random(settings.seed * 0x9E3779B97F4A7C15ULL + index);
+        uint64_t multiples = settings.maxMultiple >= settings.minMultiple ? settings.maxMultiple - settings.minMultiple + 1 : 1;
+
+        if (settings.binary) {
+            size_t start = out.size();
+            out.resize(start + (size_t)lines * sizeof(double));
+            char* p = &out[start];
+            for (uint64_t i = 0; i < lines; ++i) {
+                double charge = settings.elementaryCharge * (double)(settings.minMultiple + random.nextBelow(multiples))
+                              + settings.noise * random.nextGaussian();
+                if (settings.corruptFraction > 0.0 && random.nextDouble() < settings.corruptFraction) {
+                    charge = std::nan("");
+                }
+                std::memcpy(p, &charge, sizeof(charge));
+                p += sizeof(charge);
+            }
+            return;
+        }
+
+        // Write straight into the buffer, sized for the longest line we could possibly produce and trimmed after.
+        unsigned decimals = std::min(settings.decimals, MAX_DECIMALS);
+        const size_t MAX_LINE_LENGTH = 8 + 40 + 4 + 2 + decimals + 8;
+        size_t start = out.size();
+        out.resize(start + (size_t)lines * MAX_LINE_LENGTH);
+        char* const begin = &out[start];
+        char* p = begin;
+
+        for (uint64_t i = 0; i < lines; ++i) {
+            double charge = settings.elementaryCharge * (double)(settings.minMultiple + random.nextBelow(multiples))
+                          + settings.noise * random.nextGaussian();
+            bool corrupt = settings.corruptFraction > 0.0 && random.nextDouble() < settings.corruptFraction;
+
+            if (settings.oddWhitespace) {
+                p = impl::writeWhitespace(p, random, 8);
+            }
+            if (corrupt) {
+                const size_t corruptCount = sizeof(impl::CORRUPT_VALUES) / sizeof(impl::CORRUPT_VALUES[0]);
+                const char* value = impl::CORRUPT_VALUES[random.nextBelow(corruptCount)];
+                size_t length = std::strlen(value);
+                std::memcpy(p, value, length);
+                p += length;
+            } else {
+                // Same layout as millikan.dat, right-aligned with a trailing space, unless asked to be awkward.
+                p = impl::writeFixed(p, charge, decimals, settings.oddWhitespace ? 0 : decimals + 8);
+            }
+            if (settings.oddWhitespace) {
+                p = impl::writeWhitespace(p, random, 4);
+            } else {
+                *p++ = ' ';
+            }
+            if (settings.crlf) *p++ = '\r';
+            *p++ = '\n';
+        }
+        out.resize(start + (size_t)(p - begin));
+    }
+
+    // Writes the whole data set to the stream, generating chunks on the given number of threads while the
+    // previous batch of chunks is being written. Returns the number of bytes written. It gives up early if the
+    // stream fails, so check the stream afterwards.
+    inline uint64_t write(const Settings& settings, std::ostream& out, unsigned threads = 1) {
+        threads = std::max(threads, 1u);
+        uint64_t chunkCount = getChunkCount(settings);
+        uint64_t batchSize  = (uint64_t)threads * 4;
+
+        // Generates chunks [first, first + count) into buffers, spread over the threads.
+        auto generateBatch = [&settings, threads](uint64_t first, uint64_t count, std::vector<std::string>& buffers) {
+            buffers.resize((size_t)count);
+            std::vector<std::future<void>> workers;
+            for (unsigned t = 0; t < threads && t < count; ++t) {
+                workers.push_back(std::async(std::launch::async, [&, t]() {
+                    for (uint64_t i = t; i < count; i += threads) {
+                        buffers[(size_t)i].clear();
+                        generateChunk(settings, first + i, buffers[(size_t)i]);
+                    }
+                }));
+            }
+            for (auto& worker : workers) worker.get();
+        };
+
+        uint64_t bytes = 0;
+        std::vector<std::string> current, next;
+        generateBatch(0, std::min(batchSize, chunkCount), current);
+        for (uint64_t first = 0; first < chunkCount; first += batchSize) {
+            // Start on the next batch while this one goes out.
+            uint64_t nextFirst = first + batchSize;
+            std::future<void> pending;
+            if (nextFirst < chunkCount) {
+                pending = std::async(std::launch::async, generateBatch, nextFirst, std::min(batchSize, chunkCount - nextFirst), std::ref(next));
+            }
+
+            for (const std::string& buffer : current) {
+                out.write(buffer.data(), buffer.size());
+                bytes += buffer.size();
+            }
+
+            if (pending.valid()) pending.get();
+            if (!out) break; // No point generating the rest for a stream that's failed.
+            std::swap(current, next);
+        }
+        out.flush();
+        return bytes;
+    }
+}
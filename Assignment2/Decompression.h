@@ -0,0 +1,469 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+
+#include "LoaderPolicies.h"
+#include "Queues.h"
+#include "Trace.h"
+
+#if !defined(_WIN32) && defined(__has_include)
+#if __has_include(<dlfcn.h>)
+#include <dlfcn.h>
+#define DECOMPRESSION_HAS_DLOPEN
+#endif
+#if __has_include(<zlib.h>)
+#include <zlib.h>
+#define DECOMPRESSION_HAS_ZLIB
+#endif
+#endif
+
+/// Reading gzip and zstd compressed charge files as they are, without decompressing them to disk first.
+///
+/// Compressed files are recognised by their first few bytes, whatever they're called. The libraries are loaded
+/// at run time rather than linked, so building needs nothing extra and a machine without them just can't read
+/// compressed files (and says so). gzip also needs zlib's header at build time, for the layout of its stream;
+/// zstd's streaming interface is simple enough to declare here. Neither is available on Windows.
+namespace Decompression {
+    enum class Format {
+        NONE,
+        GZIP,
+        ZSTD
+    };
+
+    inline const char* getName(Format format) {
+        static const char* const NAMES[] = { "uncompressed", "gzip", "zstd" };
+        return NAMES[(size_t)format];
+    }
+
+    // Recognises compressed data from its first bytes.
+    inline Format detect(const char* data, size_t size) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+        if (size >= 2 && bytes[0] == 0x1F && bytes[1] == 0x8B) return Format::GZIP;
+        if (size >= 4 && bytes[0] == 0x28 && bytes[1] == 0xB5 && bytes[2] == 0x2F && bytes[3] == 0xFD) return Format::ZSTD;
+        return Format::NONE;
+    }
+    // Recognises a compressed file from its first bytes. Anything that can't be read counts as uncompressed, and
+    // is left for loading to fail on.
+    inline Format detect(const std::string& path) {
+        char magic[4];
+        size_t size = 0;
+#if defined(_WIN32)
+        std::ifstream file(path, std::ios::in | std::ios::binary);
+        file.read(magic, sizeof(magic));
+        size = (size_t)file.gcount();
+#else
+        int descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (descriptor < 0) return Format::NONE;
+        ssize_t count = ::read(descriptor, magic, sizeof(magic));
+        ::close(descriptor);
+        size = count > 0 ? (size_t)count : 0;
+#endif
+        return detect(magic, size);
+    }
+
+    namespace impl {
+        // Looks up a function in a library loaded at run time, typed to match the declaration given.
+        template <typename Function>
+        inline void find(void* library, const char* name, Function& function) {
+#if defined(DECOMPRESSION_HAS_DLOPEN)
+            function = reinterpret_cast<Function>(dlsym(library, name));
+#else
+            (void)library; (void)name;
+            function = nullptr;
+#endif
+        }
+
+        inline void* openLibrary(const char* name) {
+#if defined(DECOMPRESSION_HAS_DLOPEN)
+            return dlopen(name, RTLD_NOW | RTLD_LOCAL);
+#else
+            (void)name;
+            return nullptr;
+#endif
+        }
+
+#if defined(DECOMPRESSION_HAS_ZLIB)
+        struct Zlib {
+            int (*inflateInit2_)(z_streamp, int, const char*, int) = nullptr;
+            int (*inflate)(z_streamp, int) = nullptr;
+            int (*inflateReset)(z_streamp) = nullptr;
+            int (*inflateEnd)(z_streamp) = nullptr;
+            bool isLoaded = false;
+        };
+
+        // Loaded the first time it's wanted, and kept for the rest of the run.
+        inline const Zlib& getZlib() {
+            static const Zlib zlib = []() {
+                Zlib loaded;
+                void* library = openLibrary("libz.so.1");
+                if (library == nullptr) library = openLibrary("libz.so");
+                if (library == nullptr) return loaded;
+                find(library, "inflateInit2_", loaded.inflateInit2_);
+                find(library, "inflate",       loaded.inflate);
+                find(library, "inflateReset",  loaded.inflateReset);
+                find(library, "inflateEnd",    loaded.inflateEnd);
+                loaded.isLoaded = loaded.inflateInit2_ != nullptr && loaded.inflate != nullptr
+                               && loaded.inflateReset != nullptr && loaded.inflateEnd != nullptr;
+                return loaded;
+            }();
+            return zlib;
+        }
+#endif
+
+        // Declared as in zstd.h, which has kept these stable since 1.0.
+        struct ZstdInBuffer {
+            const void* src;
+            size_t size;
+            size_t pos;
+        };
+        struct ZstdOutBuffer {
+            void*  dst;
+            size_t size;
+            size_t pos;
+        };
+
+        struct Zstd {
+            void*    (*createDStream)() = nullptr;
+            size_t   (*freeDStream)(void*) = nullptr;
+            size_t   (*initDStream)(void*) = nullptr;
+            size_t   (*decompressStream)(void*, ZstdOutBuffer*, ZstdInBuffer*) = nullptr;
+            unsigned (*isError)(size_t) = nullptr;
+            bool isLoaded = false;
+        };
+
+        inline const Zstd& getZstd() {
+            static const Zstd zstd = []() {
+                Zstd loaded;
+                void* library = openLibrary("libzstd.so.1");
+                if (library == nullptr) library = openLibrary("libzstd.so");
+                if (library == nullptr) return loaded;
+                find(library, "ZSTD_createDStream",    loaded.createDStream);
+                find(library, "ZSTD_freeDStream",      loaded.freeDStream);
+                find(library, "ZSTD_initDStream",      loaded.initDStream);
+                find(library, "ZSTD_decompressStream", loaded.decompressStream);
+                find(library, "ZSTD_isError",          loaded.isError);
+                loaded.isLoaded = loaded.createDStream != nullptr && loaded.freeDStream != nullptr && loaded.initDStream != nullptr
+                               && loaded.decompressStream != nullptr && loaded.isError != nullptr;
+                return loaded;
+            }();
+            return zstd;
+        }
+    }
+
+    // Whether compressed data of the given format can be read here.
+    inline bool isAvailable(Format format) {
+        switch (format) {
+        case Format::GZIP:
+#if defined(DECOMPRESSION_HAS_ZLIB)
+            return impl::getZlib().isLoaded;
+#else
+            return false;
+#endif
+        case Format::ZSTD:
+            return impl::getZstd().isLoaded;
+        default:
+            return true;
+        }
+    }
+
+    /// Decodes one compressed stream a piece at a time, wherever the pieces happen to split. Uncompressed data
+    /// is passed straight through.
+    class Decoder {
+    public:
+        Decoder() {}
+        ~Decoder() {
+            reset();
+        }
+
+        Decoder(const Decoder&) = delete;
+        Decoder& operator=(const Decoder&) = delete;
+
+        // Returns false if the format can't be read here.
+        bool init(Format format) {
+            reset();
+            if (!isAvailable(format)) return false;
+            m_format = format;
+            m_isAtFrameEnd = true;
+
+            if (format == Format::GZIP) {
+#if defined(DECOMPRESSION_HAS_ZLIB)
+                m_zlib = std::make_unique<z_stream>();
+                // 15 for the biggest window, plus 32 to take a zlib header as well as a gzip one.
+                if (impl::getZlib().inflateInit2_(m_zlib.get(), 15 + 32, ZLIB_VERSION, (int)sizeof(z_stream)) != Z_OK) {
+                    m_zlib.reset();
+                    return false;
+                }
+#endif
+            } else if (format == Format::ZSTD) {
+                m_zstd = impl::getZstd().createDStream();
+                if (m_zstd == nullptr || impl::getZstd().isError(impl::getZstd().initDStream(m_zstd))) {
+                    reset();
+                    return false;
+                }
+            }
+            return true;
+        }
+        void reset() {
+#if defined(DECOMPRESSION_HAS_ZLIB)
+            if (m_zlib != nullptr) impl::getZlib().inflateEnd(m_zlib.get());
+            m_zlib.reset();
+#endif
+            if (m_zstd != nullptr) impl::getZstd().freeDStream(m_zstd);
+            m_zstd = nullptr;
+            m_format = Format::NONE;
+        }
+
+        // Decodes what it can of [in, in + inSize) into [out, out + outSize), saying how much of each it got
+        // through. Returns false if the data is corrupt.
+        bool decode(const char* in, size_t inSize, size_t& inUsed, char* out, size_t outSize, size_t& outUsed) {
+            inUsed = outUsed = 0;
+            switch (m_format) {
+            case Format::GZIP: {
+#if defined(DECOMPRESSION_HAS_ZLIB)
+                z_stream& stream = *m_zlib;
+                stream.next_in   = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+                stream.avail_in  = (uInt)std::min<size_t>(inSize, UINT32_MAX);
+                stream.next_out  = reinterpret_cast<Bytef*>(out);
+                stream.avail_out = (uInt)std::min<size_t>(outSize, UINT32_MAX);
+                uInt inOffered = stream.avail_in, outOffered = stream.avail_out;
+
+                int result = impl::getZlib().inflate(&stream, Z_NO_FLUSH);
+                inUsed  = inOffered - stream.avail_in;
+                outUsed = outOffered - stream.avail_out;
+                if (result == Z_STREAM_END) {
+                    // gzip files can be several members end to end (as from cat a.gz b.gz), so be ready for another.
+                    m_isAtFrameEnd = true;
+                    return impl::getZlib().inflateReset(&stream) == Z_OK;
+                }
+                if (inUsed > 0) m_isAtFrameEnd = false;
+                return result == Z_OK || result == Z_BUF_ERROR; // Z_BUF_ERROR just means it needs more to go on.
+#else
+                return false;
+#endif
+            }
+            case Format::ZSTD: {
+                impl::ZstdInBuffer  input  = { in, inSize, 0 };
+                impl::ZstdOutBuffer output = { out, outSize, 0 };
+                size_t result = impl::getZstd().decompressStream(m_zstd, &output, &input);
+                inUsed  = input.pos;
+                outUsed = output.pos;
+                if (impl::getZstd().isError(result)) return false;
+                m_isAtFrameEnd = result == 0;
+                return true;
+            }
+            default:
+                outUsed = inUsed = std::min(inSize, outSize);
+                std::memcpy(out, in, outUsed);
+                return true;
+            }
+        }
+
+        // Whether everything decoded so far finishes a whole compressed frame, which a file cut short doesn't.
+        bool isAtFrameEnd() const {
+            return m_isAtFrameEnd;
+        }
+    private:
+        Format m_format = Format::NONE;
+        bool m_isAtFrameEnd = true;
+#if defined(DECOMPRESSION_HAS_ZLIB)
+        std::unique_ptr<z_stream> m_zlib;
+#endif
+        void* m_zstd = nullptr;
+    };
+
+    /// A source (see LoaderPolicies.h) that decompresses what another source reads, on a thread of its own, so
+    /// decompressing one block overlaps with parsing the one before and loading takes about as long as the
+    /// slower of the two rather than both added together. Decoded blocks come from a small fixed pool that the
+    /// parser hands back as it goes, so memory stays bounded however big the file inflates to.
+    template <typename Inner>
+    class Source {
+    public:
+        static constexpr bool IS_STABLE = false;
+        static constexpr size_t BLOCK_SIZE  = 1 << 20; // Decompressed bytes per block.
+        static constexpr size_t BLOCK_COUNT = 4;       // Blocks in the pool, so up to three decoded ahead.
+
+        Source() {}
+        ~Source() {
+            close();
+        }
+
+        Source(const Source&) = delete;
+        Source& operator=(const Source&) = delete;
+
+        // Passed on to the inner source, for those that take them.
+        void setContents(Sources::Memory::ContentsPtr contents) {
+            m_inner.setContents(std::move(contents));
+        }
+        void setDropCache(bool isDroppingCache) {
+            m_inner.setDropCache(isDroppingCache);
+        }
+
+        // Fails, saying why, if the file's compressed in a format that can't be read here.
+        bool open(const std::string& path) {
+            close();
+            if (!m_inner.open(path)) return false;
+            m_path = path;
+
+            // The format's decided by the first block, which the decoding thread then starts from.
+            const char* data = nullptr;
+            size_t size = 0;
+            bool hasData = m_inner.next(data, size);
+            Format format = hasData ? detect(data, size) : Format::NONE;
+            if (!isAvailable(format)) {
+                std::cerr << "File: " << path << " is " << getName(format) << " compressed, which can't be read here." << std::endl;
+                m_inner.close();
+                return false;
+            }
+
+            m_freeBlocks.reset(new Queues::SpscQueue<Block*>(BLOCK_COUNT));
+            m_decoded.reset(new Queues::SpscQueue<Block*>(BLOCK_COUNT + 1)); // Room for the end marker too.
+            m_blocks.clear();
+            for (size_t i = 0; i < BLOCK_COUNT; ++i) {
+                m_blocks.emplace_back(new Block());
+                m_freeBlocks->push(m_blocks.back().get());
+            }
+            m_isStopping.store(false, std::memory_order_relaxed);
+            m_isCorrupt = false;
+            m_isReported = false;
+            m_current = nullptr;
+            m_isOpen = true;
+            m_decoder = std::thread([this, format, hasData, data, size]() { decodeAll(format, hasData, data, size); });
+            return true;
+        }
+        void close() {
+            if (!m_isOpen) return;
+            m_isStopping.store(true, std::memory_order_relaxed);
+            m_decoder.join();
+            m_inner.close();
+            m_isOpen = false;
+        }
+        bool isOpen() const {
+            return m_isOpen;
+        }
+        uint64_t getSize() const {
+            return 0; // Unknown until it's all been decompressed.
+        }
+
+        bool next(const char*& data, size_t& size) {
+            if (!m_isOpen) return false;
+            if (m_current != nullptr) {
+                m_freeBlocks->push(m_current);
+                m_current = nullptr;
+            }
+
+            Block* block;
+            m_decoded->pop(block);
+            if (block == nullptr) {
+                // The decoding thread's done, and pushes nothing more after the end marker.
+                m_decoded->push(nullptr);
+                if (m_isCorrupt && !m_isReported) {
+                    std::cerr << "File: " << m_path << " has corrupt or cut short compressed data." << std::endl;
+                    m_isReported = true;
+                }
+                return false;
+            }
+            m_current = block;
+            data = block->data.get();
+            size = block->size;
+            return true;
+        }
+        // Whether the compressed data was corrupt or cut short, or the inner source failed, once next has
+        // returned false. Only part of the file was read, so loading it fails.
+        bool isFailed() const {
+            return m_isCorrupt || m_inner.isFailed();
+        }
+        // Starts decompressing again from the beginning.
+        void rewind() {
+            std::string path = m_path;
+            close();
+            open(path);
+        }
+    private:
+        struct Block {
+            std::unique_ptr<char[]> data{ new char[BLOCK_SIZE] };
+            size_t size = 0;
+        };
+
+        // Waits for the queue, giving up if the source is being closed.
+        bool pushDecoded(Block* block) {
+            Queues::Backoff backoff;
+            while (!m_decoded->tryPush(std::move(block))) {
+                if (m_isStopping.load(std::memory_order_relaxed)) return false;
+                backoff.pause();
+            }
+            return true;
+        }
+        Block* popFree() {
+            Queues::Backoff backoff;
+            Block* block = nullptr;
+            while (!m_freeBlocks->tryPop(block)) {
+                if (m_isStopping.load(std::memory_order_relaxed)) return nullptr;
+                backoff.pause();
+            }
+            block->size = 0;
+            return block;
+        }
+
+        // Runs on the decoding thread, from the inner source's first block (already read) to its end.
+        void decodeAll(Format format, bool hasData, const char* data, size_t size) {
+            Decoder decoder;
+            bool isWorking = decoder.init(format);
+            Block* block = popFree();
+
+            while (isWorking && block != nullptr && hasData) {
+                Trace::Scope chunkTrace("decompress_chunk", "pipeline", m_path.c_str());
+                for (;;) {
+                    size_t room = BLOCK_SIZE - block->size;
+                    size_t inUsed, outUsed;
+                    if (!decoder.decode(data, size, inUsed, block->data.get() + block->size, room, outUsed)) {
+                        isWorking = false;
+                        break;
+                    }
+                    if (inUsed == 0 && outUsed == 0 && size > 0) {
+                        isWorking = false; // Stuck, which only corrupt data does.
+                        break;
+                    }
+                    data += inUsed;
+                    size -= inUsed;
+                    block->size += outUsed;
+
+                    if (block->size == BLOCK_SIZE) {
+                        if (!pushDecoded(block) || (block = popFree()) == nullptr) break;
+                    }
+                    // All the input's gone in and the decoder had no more to give.
+                    if (size == 0 && outUsed < room) break;
+                }
+                if (block == nullptr) break;
+                hasData = m_inner.next(data, size);
+            }
+
+            if (block == nullptr) return; // Stopping, the consumer's not waiting for anything.
+            m_isCorrupt = !isWorking || !decoder.isAtFrameEnd();
+            if (block->size > 0 && !pushDecoded(block)) return;
+            pushDecoded(nullptr);
+        }
+
+        Inner m_inner;
+        std::string m_path;
+        bool m_isOpen = false;
+
+        std::vector<std::unique_ptr<Block>> m_blocks;
+        std::unique_ptr<Queues::SpscQueue<Block*>> m_freeBlocks; // Parser to decoder.
+        std::unique_ptr<Queues::SpscQueue<Block*>> m_decoded;    // Decoder to parser, ending with a nullptr.
+        Block* m_current = nullptr; // The block last handed out by next.
+
+        std::thread m_decoder;
+        std::atomic<bool> m_isStopping{ false };
+        bool m_isCorrupt = false; // Written by the decoder before its end marker, so safe to read after it.
+        bool m_isReported = false;
+    };
+}
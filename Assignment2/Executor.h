@@ -0,0 +1,223 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <algorithm>
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <condition_variable>
+
+template <typename T> class Task;
+
+/// A fixed pool of worker threads that runs jobs in the order they're posted, and the tasks that await schedule.
+///
+/// With no threads at all, jobs run right away on the thread posting them and tasks never leave the thread that
+/// started them, so code written against the executor behaves exactly as plain serial code would.
+class Executor {
+public:
+    /// Which of a set of tasks have finished, for waiting on them from outside any coroutine (see Task).
+    class FinishedTasks {
+    public:
+        explicit FinishedTasks(size_t count) : m_isFinished(count, false) {}
+
+        void set(size_t index) {
+            // Notified under the lock, so a waiter can't get away and destroy this before it's done with.
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_isFinished[index] = true;
+            m_changed.notify_all();
+        }
+        void wait(size_t index) {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [&]() { return m_isFinished[index]; });
+        }
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        std::vector<bool> m_isFinished;
+    };
+
+    explicit Executor(unsigned threadCount = 0) {
+        m_threads.reserve(threadCount);
+        for (unsigned i = 0; i < threadCount; ++i) {
+            m_threads.emplace_back([this]() { work(); });
+        }
+    }
+    // Finishes every job already posted before returning.
+    ~Executor() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_isStopping = true;
+        }
+        m_wake.notify_all();
+        for (std::thread& thread : m_threads) {
+            thread.join();
+        }
+    }
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    unsigned getThreadCount() const {
+        return (unsigned)m_threads.size();
+    }
+
+    // Queues a job for the next free thread.
+    void post(std::function<void()> job) {
+        if (m_threads.empty()) {
+            job();
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push_back(std::move(job));
+        }
+        m_wake.notify_one();
+    }
+
+    // For a task to co_await, carrying on on one of the threads.
+    auto schedule() {
+        struct Schedule {
+            Executor& executor;
+
+            bool await_ready() const noexcept {
+                return executor.m_threads.empty();
+            }
+            void await_suspend(std::coroutine_handle<> handle) {
+                executor.post([handle]() { handle.resume(); });
+            }
+            void await_resume() const noexcept {}
+        };
+        return Schedule{ *this };
+    }
+
+    // Starts the task makeTask(i) for every i below count, with up to maxInFlight of them under way at once, and
+    // hands each result to consume(i, result) on the calling thread, in order of i. So output comes out the same
+    // however the work gets spread over the threads, while slow items (a file on a slow disk, say) overlap with
+    // the rest.
+    template <typename MakeTask, typename Consume>
+    void forEachInOrder(size_t count, size_t maxInFlight, MakeTask makeTask, Consume consume) {
+        typedef typename std::invoke_result_t<MakeTask&, size_t>::Result Result;
+        maxInFlight = std::max<size_t>(maxInFlight, 1);
+
+        FinishedTasks finished(count);
+        std::deque<Task<Result>> inFlight;
+        size_t next = 0;
+        try {
+            for (size_t i = 0; i < count; ++i) {
+                while (next < count && inFlight.size() < maxInFlight) {
+                    inFlight.push_back(makeTask(next));
+                    inFlight.back().start(finished, next);
+                    ++next;
+                }
+
+                finished.wait(i);
+                Result result = inFlight.front().takeResult();
+                inFlight.pop_front();
+                consume(i, std::move(result));
+            }
+        } catch (...) {
+            // The tasks still under way use makeTask's captures, which are about to go away.
+            for (size_t i = next - inFlight.size(); i < next; ++i) {
+                finished.wait(i);
+            }
+            throw;
+        }
+    }
+private:
+    void work() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this]() { return m_isStopping || !m_jobs.empty(); });
+                if (m_jobs.empty()) return; // Only when stopping, with nothing left to do.
+
+                job = std::move(m_jobs.front());
+                m_jobs.pop_front();
+            }
+            job();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::deque<std::function<void()>> m_jobs;
+    bool m_isStopping = false;
+
+    std::vector<std::thread> m_threads;
+};
+
+/// A coroutine that works something out, and doesn't start until it's told to. A task moves onto an executor's
+/// threads by awaiting Executor::schedule (or something that resumes it there, like AsyncReader::read), so one
+/// started from the main thread goes on to run wherever it's sent.
+///
+/// Tasks are run with Executor::forEachInOrder, which starts them, waits for them and takes their results.
+template <typename T>
+class Task {
+public:
+    typedef T Result;
+
+    struct promise_type {
+        std::optional<T> result;
+        std::exception_ptr exception;
+        Executor::FinishedTasks* finished = nullptr;
+        size_t index = 0;
+
+        Task get_return_object() {
+            return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        auto final_suspend() noexcept {
+            struct Finish {
+                bool await_ready() noexcept {
+                    return false;
+                }
+                void await_suspend(std::coroutine_handle<promise_type> handle) noexcept {
+                    // Once it's marked finished the task can be destroyed, so nothing of it is touched after.
+                    Executor::FinishedTasks* finished = handle.promise().finished;
+                    finished->set(handle.promise().index);
+                }
+                void await_resume() noexcept {}
+            };
+            return Finish();
+        }
+        void return_value(T value) {
+            result.emplace(std::move(value));
+        }
+        void unhandled_exception() {
+            exception = std::current_exception();
+        }
+    };
+
+    Task(Task&& other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    Task& operator=(Task&& other) noexcept {
+        std::swap(m_handle, other.m_handle);
+        return *this;
+    }
+    ~Task() {
+        if (m_handle) m_handle.destroy();
+    }
+
+    // Runs the task up to its first suspension, marking index in finished once it's done.
+    void start(Executor::FinishedTasks& finished, size_t index) {
+        m_handle.promise().finished = &finished;
+        m_handle.promise().index    = index;
+        m_handle.resume();
+    }
+    // The task's result (or what it threw), once it's finished.
+    T takeResult() {
+        if (m_handle.promise().exception) std::rethrow_exception(m_handle.promise().exception);
+        return std::move(*m_handle.promise().result);
+    }
+private:
+    explicit Task(std::coroutine_handle<promise_type> handle) : m_handle(handle) {}
+
+    std::coroutine_handle<promise_type> m_handle;
+};
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+
+#if defined(_WIN32)
+#include <io.h>
+#include <fcntl.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+/// Helpers for the files kept beside the data: incremental state, cached results, charge packs and line indexes.
+namespace Files {
+    inline unsigned long getProcessId() {
+#if defined(_WIN32)
+        return (unsigned long)_getpid();
+#else
+        return (unsigned long)getpid();
+#endif
+    }
+
+    namespace impl {
+        // Waits for everything written to the file at path to reach the disk. Returns false if it might not have.
+        inline bool syncFile(const std::string& path) {
+#if defined(_WIN32)
+            int descriptor = _open(path.c_str(), _O_WRONLY | _O_BINARY);
+            if (descriptor < 0) return false;
+            bool isSynced = _commit(descriptor) == 0;
+            _close(descriptor);
+#else
+            int descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (descriptor < 0) return false;
+            bool isSynced = fsync(descriptor) == 0;
+            ::close(descriptor);
+#endif
+            return isSynced;
+        }
+
+        // Waits for the names in the directory holding path to reach the disk, so a rename there sticks. There's
+        // no such thing on Windows, where renames are journalled with the file system, and some file systems
+        // elsewhere can't do it either, so it's only ever a best effort.
+        inline void syncDirectoryOf(const std::string& path) {
+#if !defined(_WIN32)
+            size_t slash = path.find_last_of('/');
+            std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+            int descriptor = ::open(directory.c_str(), O_RDONLY | O_CLOEXEC | O_DIRECTORY);
+            if (descriptor < 0) return;
+            fsync(descriptor);
+            ::close(descriptor);
+#else
+            (void)path;
+#endif
+        }
+    }
+
+    // Writes the file at path with whatever write(out) puts in the given stream, returning whether it all went in.
+    // It goes to a temporary file first, which is flushed to the disk and then renamed into place, so neither a
+    // crash nor a power cut part way through can leave a half-written file behind for the next run to trip over.
+    template <typename Write>
+    bool writeFileAtomically(const std::string& path, Write write) {
+        // Named for the process and the thread, as two of either can be writing the same file at once.
+        std::string tempPath = path + "." + std::to_string(getProcessId()) + "-"
+                             + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+        bool isWritten;
+        {
+            std::ofstream out(tempPath, std::ios::out | std::ios::binary | std::ios::trunc);
+            if (!out.is_open()) return false;
+            write(out);
+            out.close();
+            isWritten = !out.fail();
+        }
+        // Without this the rename can reach the disk before the data does.
+        isWritten = isWritten && impl::syncFile(tempPath);
+
+        if (isWritten) {
+#if defined(_WIN32)
+            // Windows won't rename over an existing file. Elsewhere rename replaces it in one go.
+            std::remove(path.c_str());
+#endif
+            if (std::rename(tempPath.c_str(), path.c_str()) == 0) {
+                impl::syncDirectoryOf(path);
+                return true;
+            }
+        }
+        std::remove(tempPath.c_str());
+        return false;
+    }
+}
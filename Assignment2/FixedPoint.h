@@ -0,0 +1,261 @@
+#pragma once
+
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include "DataAnalysis.h"
+
+/// Charges held as integers scaled by a power of ten, for files written to a fixed number of decimal places.
+///
+/// Most charges fit in 32 bits, half the size of a double. Sums of integers are exact, so they come out the same
+/// whatever order they're added in, however the work is split up, and only get turned into floating point right
+/// at the end for the summary.
+namespace FixedPoint {
+    using DataAnalysis::UInt128;
+
+    inline uint64_t getScale(unsigned decimals) {
+        uint64_t scale = 1;
+        for (unsigned i = 0; i < decimals; ++i) scale *= 10;
+        return scale;
+    }
+
+    /// A data set of charges scaled by 10^decimals. Held in 32 bits each unless one of them needs more.
+    class Charges {
+    public:
+        // Scales the given charges. Returns false, leaving this empty, if any charge has more decimal places than
+        // asked for or is too big to scale exactly.
+        bool assign(const double* charges, size_t size, unsigned decimals) {
+            start(decimals, size);
+            for (size_t i = 0; i < size; ++i) {
+                if (!add(charges[i])) {
+                    clear();
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // Starts over on charges scaled by 10^decimals, with room for the given number of them, for adding one at
+        // a time as they're read.
+        void start(unsigned decimals, size_t expectedSize = 0) {
+            clear();
+            m_decimals = decimals;
+            m_scale    = (double)getScale(decimals);
+            m_narrow.reserve(expectedSize);
+        }
+        // Scales a charge and adds it. Returns false, adding nothing, if it has more decimal places than asked for
+        // or is too big to scale exactly.
+        bool add(double charge) {
+            const double maxScaled = 9007199254740992.0; // 2^53, beyond which not every integer is a double.
+            double value = std::nearbyint(charge * m_scale);
+            // Exact when scaling back lands on the very same double that was parsed from the file.
+            if (!(value >= 0.0 && value <= maxScaled) || value / m_scale != charge) return false;
+
+            uint64_t scaled = (uint64_t)value;
+            if (scaled > std::numeric_limits<uint32_t>::max() && !m_isWide) widen();
+            if (m_isWide) {
+                m_wide.push_back(scaled);
+            } else {
+                m_narrow.push_back((uint32_t)scaled);
+            }
+            m_maximum = std::max(m_maximum, scaled);
+            ++m_size;
+            return true;
+        }
+        // Gives back a reservation that turned out well over, once everything's been added.
+        void finish() {
+            if (m_narrow.capacity() > m_narrow.size() + m_narrow.size() / 4 + 16) m_narrow.shrink_to_fit();
+            if (m_wide.capacity() > m_wide.size() + m_wide.size() / 4 + 16) m_wide.shrink_to_fit();
+        }
+
+        // Appends the charges to the end of the vector, scaled back to the very doubles they were scaled from.
+        void appendTo(std::vector<double>& charges) const {
+            charges.reserve(charges.size() + m_size);
+            for (size_t i = 0; i < m_size; ++i) {
+                charges.push_back((double)(m_isWide ? m_wide[i] : (uint64_t)m_narrow[i]) / m_scale);
+            }
+        }
+
+        void clear() {
+            std::vector<uint32_t>().swap(m_narrow);
+            std::vector<uint64_t>().swap(m_wide);
+            m_size    = 0;
+            m_maximum = 0;
+            m_isWide  = false;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+        bool empty() const {
+            return m_size == 0;
+        }
+        unsigned getDecimals() const {
+            return m_decimals;
+        }
+        uint64_t getMaximum() const {
+            return m_maximum;
+        }
+        size_t getSizeInBytes() const {
+            return m_narrow.capacity() * sizeof(uint32_t) + m_wide.capacity() * sizeof(uint64_t);
+        }
+
+        // Exactly one of these is non-null when not empty.
+        const uint32_t* getNarrow() const {
+            return m_narrow.empty() ? nullptr : m_narrow.data();
+        }
+        const uint64_t* getWide() const {
+            return m_wide.empty() ? nullptr : m_wide.data();
+        }
+    private:
+        // Moves everything so far to 64 bits, for a charge too big for 32.
+        void widen() {
+            m_wide.reserve(std::max(m_narrow.capacity(), m_narrow.size() + 1));
+            m_wide.assign(m_narrow.begin(), m_narrow.end());
+            std::vector<uint32_t>().swap(m_narrow);
+            m_isWide = true;
+        }
+
+        std::vector<uint32_t> m_narrow;
+        std::vector<uint64_t> m_wide;
+        size_t   m_size     = 0;
+        uint64_t m_maximum  = 0;
+        unsigned m_decimals = 0;
+        double   m_scale    = 1.0;
+        bool     m_isWide   = false;
+    };
+
+    /// Exact sums over scaled charges. Sums over separate parts of a data set merge into exactly the sums over all of it.
+    struct Sums {
+        uint64_t count = 0;
+        UInt128  sum;
+        UInt128  sumOfSquares;
+
+        void merge(const Sums& other) {
+            count += other.count;
+            sum += other.sum;
+            sumOfSquares += other.sumOfSquares;
+        }
+        void add(uint64_t value) {
+            ++count;
+            sum += value;
+            sumOfSquares += UInt128::multiply(value, value);
+        }
+    };
+
+    /// A DataAnalysis::Range as scaled charges: exactly those whose doubles the range contains, both ends included.
+    struct ScaledRange {
+        uint64_t lower = 0;
+        uint64_t upper = UINT64_MAX;
+
+        bool isEmpty() const {
+            return lower > upper;
+        }
+        bool contains(uint64_t value) const {
+            return value >= lower && value <= upper;
+        }
+    };
+
+    inline ScaledRange getScaledRange(const DataAnalysis::Range& range, unsigned decimals) {
+        const double scale = (double)getScale(decimals);
+        const double maxScaled = 9007199254740992.0; // 2^53, the most any scaled charge can be.
+
+        // Scaling the bounds rounds, so nudge each until it's the very first (or last) scaled charge whose double
+        // is in the range, same as comparing the doubles themselves would decide.
+        ScaledRange scaled;
+        if (range.lower > 0.0) {
+            double estimate = std::ceil(range.lower * scale);
+            if (!(estimate <= maxScaled)) {
+                scaled.lower = UINT64_MAX;
+            } else {
+                scaled.lower = (uint64_t)estimate;
+                while (scaled.lower > 0 && (double)(scaled.lower - 1) / scale >= range.lower) --scaled.lower;
+                while ((double)scaled.lower / scale < range.lower) ++scaled.lower;
+            }
+        }
+        if (range.upper < 0.0) {
+            scaled.upper = 0;
+            scaled.lower = 1; // Empty.
+        } else if (range.upper * scale < maxScaled) {
+            scaled.upper = (uint64_t)std::floor(range.upper * scale);
+            while ((double)(scaled.upper + 1) / scale <= range.upper) ++scaled.upper;
+            while (scaled.upper > 0 && (double)scaled.upper / scale > range.upper) --scaled.upper;
+            if ((double)scaled.upper / scale > range.upper) scaled.lower = 1; // Not even 0 is in it, so empty.
+        }
+        return scaled;
+    }
+
+    // Exact sums over just the charges in the range.
+    inline Sums accumulate(const Charges& charges, const ScaledRange& range) {
+        Sums sums;
+        const uint32_t* narrow = charges.getNarrow();
+        const uint64_t* wide = charges.getWide();
+        for (size_t i = 0; i < charges.size(); ++i) {
+            uint64_t value = narrow != nullptr ? narrow[i] : wide[i];
+            if (range.contains(value)) sums.add(value);
+        }
+        return sums;
+    }
+
+    inline Sums accumulate(const Charges& charges) {
+        Sums sums;
+        sums.count = charges.size();
+
+        if (const uint32_t* data = charges.getNarrow()) {
+            // A square of 32-bit values fits in 64 bits, so add up blocks short enough that their sums can't
+            // overflow in plain 64-bit integers (which vectorise), only carrying into 128 bits between blocks.
+            uint64_t maximumSquare = charges.getMaximum() * charges.getMaximum();
+            size_t blockLength = maximumSquare == 0 ? charges.size() : (size_t)std::min<uint64_t>(UINT64_MAX / maximumSquare, 1 << 20);
+            blockLength = std::max<size_t>(blockLength, 1);
+
+            for (size_t start = 0; start < charges.size(); start += blockLength) {
+                size_t end = std::min(start + blockLength, charges.size());
+                uint64_t sum = 0;
+                uint64_t sumOfSquares = 0;
+                for (size_t i = start; i < end; ++i) {
+                    uint64_t value = data[i];
+                    sum += value;
+                    sumOfSquares += value * value;
+                }
+                sums.sum += sum;
+                sums.sumOfSquares += sumOfSquares;
+            }
+        } else if (const uint64_t* data = charges.getWide()) {
+            for (size_t i = 0; i < charges.size(); ++i) {
+                sums.sum += data[i];
+                sums.sumOfSquares += UInt128::multiply(data[i], data[i]);
+            }
+        }
+        return sums;
+    }
+
+    // Turns exact sums of charges scaled by 10^decimals into the same summary DataAnalysis gives for doubles.
+    inline DataAnalysis::Summary summarise(const Sums& sums, unsigned decimals) {
+        // As running statistics over nothing at all (a range with no charges in it, say) would give.
+        if (sums.count == 0) return DataAnalysis::summarise(DataAnalysis::Accumulator());
+
+        const double scale = (double)getScale(decimals);
+        const double count = (double)sums.count;
+
+        DataAnalysis::Summary summary;
+        summary.count = sums.count;
+        summary.mean  = sums.sum.toDouble() / (count * scale); // One rounding, not two.
+
+        // n * sum(x^2) - sum(x)^2 is n(n - 1) times the variance, and worked out exactly if it fits in 128 bits.
+        double scaledVariance;
+        UInt128 countTimesSumOfSquares = sums.sumOfSquares;
+        if (sums.sum.high == 0 && countTimesSumOfSquares.multiplyBy(sums.count)) {
+            UInt128 difference = countTimesSumOfSquares - UInt128::multiply(sums.sum.low, sums.sum.low);
+            scaledVariance = difference.toDouble() / (count * (count - 1.0));
+        } else {
+            double sum = sums.sum.toDouble();
+            scaledVariance = (sums.sumOfSquares.toDouble() - sum * sum / count) / (count - 1.0);
+        }
+        summary.standardDeviation      = std::sqrt(scaledVariance) / scale;
+        summary.standardErrorInTheMean = DataAnalysis::computeStandardErrorInTheMean(summary.mean, (unsigned int)summary.count);
+        return summary;
+    }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+/// Shell-style wildcard matching of file names, for when the shell hasn't (or can't, on Windows) expand them for us.
+///
+/// Supports * (any run of characters), ? (any one character), [abc], [a-z] and [!abc] within a path component,
+/// and ** as a whole component to match any number of directories.
+namespace Glob {
+    inline bool hasWildcards(const std::string& pattern) {
+        return pattern.find_first_of("*?[") != std::string::npos;
+    }
+
+    namespace impl {
+        // Matches a single character against a [...] set starting at pattern, advances pattern past the set.
+        // Returns false with pattern untouched if the set isn't closed, so the '[' gets treated literally.
+        inline bool matchSet(const char*& pattern, char c, bool& matched) {
+            const char* p = pattern + 1;
+            bool negate = (*p == '!' || *p == '^');
+            if (negate) ++p;
+
+            matched = false;
+            bool first = true;
+            while (*p != '\0' && (*p != ']' || first)) {
+                if (p[1] == '-' && p[2] != '\0' && p[2] != ']') {
+                    if (c >= p[0] && c <= p[2]) matched = true;
+                    p += 3;
+                } else {
+                    if (c == *p) matched = true;
+                    ++p;
+                }
+                first = false;
+            }
+            if (*p != ']') return false;
+
+            if (negate) matched = !matched;
+            pattern = p + 1;
+            return true;
+        }
+    }
+
+    // Matches a name against a pattern for a single path component.
+    inline bool match(const char* pattern, const char* name) {
+        // Where to go back to if what follows the last * didn't work out.
+        const char* starPattern = nullptr;
+        const char* starName    = nullptr;
+
+        while (*name != '\0') {
+            bool advanced = false;
+            if (*pattern == '*') {
+                starPattern = ++pattern;
+                starName    = name;
+                continue;
+            } else if (*pattern == '?') {
+                ++pattern;
+                advanced = true;
+            } else if (*pattern == '[') {
+                bool matched;
+                const char* p = pattern;
+                if (impl::matchSet(p, *name, matched)) {
+                    if (matched) {
+                        pattern  = p;
+                        advanced = true;
+                    }
+                } else if (*name == '[') {
+                    ++pattern;
+                    advanced = true;
+                }
+            } else if (*pattern != '\0' && *pattern == *name) {
+                ++pattern;
+                advanced = true;
+            }
+
+            if (advanced) {
+                ++name;
+            } else if (starPattern != nullptr) {
+                // Let the last * swallow one more character and try again.
+                pattern = starPattern;
+                name    = ++starName;
+            } else {
+                return false;
+            }
+        }
+        // Any trailing *s can match nothing.
+        while (*pattern == '*') ++pattern;
+        return *pattern == '\0';
+    }
+
+    namespace impl {
+        inline void expandFrom(const std::filesystem::path& base, const std::vector<std::string>& components, size_t index, std::vector<std::string>& results) {
+            std::error_code error;
+            if (index == components.size()) {
+                if (std::filesystem::is_regular_file(base.empty() ? "." : base, error)) {
+                    results.push_back(base.string());
+                }
+                return;
+            }
+
+            const std::string& component = components[index];
+            std::filesystem::path directory = base.empty() ? std::filesystem::path(".") : base;
+
+            if (component == "**") {
+                // Zero directories...
+                expandFrom(base, components, index + 1, results);
+                // ...or any number of them.
+                for (std::filesystem::recursive_directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+                    if (it->is_directory(error)) {
+                        std::filesystem::path relative = base.empty() ? it->path().lexically_relative(".") : it->path();
+                        expandFrom(relative, components, index + 1, results);
+                    }
+                }
+            } else if (hasWildcards(component)) {
+                for (std::filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+                    std::string name = it->path().filename().string();
+                    // Like the shell, hidden files only match if the pattern explicitly asks for them.
+                    if (name[0] == '.' && component[0] != '.') continue;
+                    if (match(component.c_str(), name.c_str())) {
+                        expandFrom(base / name, components, index + 1, results);
+                    }
+                }
+            } else {
+                expandFrom(base / component, components, index + 1, results);
+            }
+        }
+    }
+
+    // Expands a pattern into the sorted list of regular files it matches.
+    inline std::vector<std::string> expand(const std::string& pattern) {
+        std::filesystem::path path(pattern);
+
+        std::vector<std::string> components;
+        for (const auto& component : path.relative_path()) {
+            if (!component.empty()) {
+                components.push_back(component.string());
+            }
+        }
+
+        std::vector<std::string> results;
+        impl::expandFrom(path.root_path(), components, 0, results);
+
+        std::sort(results.begin(), results.end());
+        results.erase(std::unique(results.begin(), results.end()), results.end());
+        return results;
+    }
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+/// Fast non-cryptographic hashing of data, used for checksums and cache keys.
+///
+/// Implements XXH64, which runs at close to memory bandwidth and can be fed data in arbitrarily sized pieces
+/// while still producing the same result as hashing it all in one go.
+namespace Hash {
+    namespace impl {
+        const uint64_t PRIME1 = 11400714785074694791ULL;
+        const uint64_t PRIME2 = 14029467366897019727ULL;
+        const uint64_t PRIME3 = 1609587929392839161ULL;
+        const uint64_t PRIME4 = 9650029242287828579ULL;
+        const uint64_t PRIME5 = 2870177450012600261ULL;
+
+        inline uint64_t rotl(uint64_t x, int r) {
+            return (x << r) | (x >> (64 - r));
+        }
+        // Reads are done through memcpy so that unaligned data is fine, compilers turn this into a single load.
+        inline uint64_t read64(const unsigned char* p) {
+            uint64_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        inline uint32_t read32(const unsigned char* p) {
+            uint32_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        inline uint64_t round(uint64_t acc, uint64_t input) {
+            acc += input * PRIME2;
+            acc = rotl(acc, 31);
+            return acc * PRIME1;
+        }
+        inline uint64_t mergeRound(uint64_t acc, uint64_t val) {
+            acc ^= round(0, val);
+            return acc * PRIME1 + PRIME4;
+        }
+    }
+
+    /// Streaming hasher, feed it data with update and get the hash with digest.
+    class Hasher {
+    public:
+        Hasher(uint64_t seed = 0) {
+            reset(seed);
+        }
+
+        void reset(uint64_t seed = 0) {
+            m_seed = seed;
+            m_v[0] = seed + impl::PRIME1 + impl::PRIME2;
+            m_v[1] = seed + impl::PRIME2;
+            m_v[2] = seed;
+            m_v[3] = seed - impl::PRIME1;
+            m_totalLength = 0;
+            m_bufferSize = 0;
+        }
+
+        void update(const void* data, size_t length) {
+            const unsigned char* p = static_cast<const unsigned char*>(data);
+            const unsigned char* const end = p + length;
+            m_totalLength += length;
+
+            // Not enough for a full stripe yet, just stash it away.
+            if (m_bufferSize + length < 32) {
+                std::memcpy(m_buffer + m_bufferSize, p, length);
+                m_bufferSize += length;
+                return;
+            }
+
+            // Finish off any stripe we had partially buffered from the last update.
+            if (m_bufferSize > 0) {
+                size_t fill = 32 - m_bufferSize;
+                std::memcpy(m_buffer + m_bufferSize, p, fill);
+                consumeStripe(m_buffer);
+                p += fill;
+                m_bufferSize = 0;
+            }
+
+            // Main loop, four independent lanes of 8 bytes each so the CPU can overlap the multiplies.
+            while (p + 32 <= end) {
+                consumeStripe(p);
+                p += 32;
+            }
+
+            // Keep the tail for next time.
+            m_bufferSize = (size_t)(end - p);
+            std::memcpy(m_buffer, p, m_bufferSize);
+        }
+
+        uint64_t digest() const {
+            uint64_t h;
+            if (m_totalLength >= 32) {
+                h = impl::rotl(m_v[0], 1) + impl::rotl(m_v[1], 7) + impl::rotl(m_v[2], 12) + impl::rotl(m_v[3], 18);
+                for (int i = 0; i < 4; ++i) {
+                    h = impl::mergeRound(h, m_v[i]);
+                }
+            } else {
+                h = m_seed + impl::PRIME5;
+            }
+            h += m_totalLength;
+
+            const unsigned char* p = m_buffer;
+            const unsigned char* const end = m_buffer + m_bufferSize;
+            while (p + 8 <= end) {
+                h ^= impl::round(0, impl::read64(p));
+                h = impl::rotl(h, 27) * impl::PRIME1 + impl::PRIME4;
+                p += 8;
+            }
+            if (p + 4 <= end) {
+                h ^= (uint64_t)impl::read32(p) * impl::PRIME1;
+                h = impl::rotl(h, 23) * impl::PRIME2 + impl::PRIME3;
+                p += 4;
+            }
+            while (p < end) {
+                h ^= (uint64_t)(*p) * impl::PRIME5;
+                h = impl::rotl(h, 11) * impl::PRIME1;
+                ++p;
+            }
+
+            // Avalanche so that every input bit affects every output bit.
+            h ^= h >> 33;
+            h *= impl::PRIME2;
+            h ^= h >> 29;
+            h *= impl::PRIME3;
+            h ^= h >> 32;
+            return h;
+        }
+
+        uint64_t getTotalLength() const {
+            return m_totalLength;
+        }
+    private:
+        void consumeStripe(const unsigned char* p) {
+            m_v[0] = impl::round(m_v[0], impl::read64(p));
+            m_v[1] = impl::round(m_v[1], impl::read64(p + 8));
+            m_v[2] = impl::round(m_v[2], impl::read64(p + 16));
+            m_v[3] = impl::round(m_v[3], impl::read64(p + 24));
+        }
+
+        uint64_t m_seed;
+        uint64_t m_v[4];
+        uint64_t m_totalLength;
+        unsigned char m_buffer[32];
+        size_t m_bufferSize;
+    };
+
+    // Hashes a block of memory in one go.
+    inline uint64_t compute(const void* data, size_t length, uint64_t seed = 0) {
+        Hasher hasher(seed);
+        hasher.update(data, length);
+        return hasher.digest();
+    }
+
+    // Mixes a value into an existing hash, for building up keys out of several parts.
+    inline uint64_t combine(uint64_t hash, uint64_t value) {
+        return compute(&value, sizeof(value), hash);
+    }
+}
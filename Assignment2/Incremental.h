@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <algorithm>
+#include <iostream>
+
+#include "ChargeDataModel.h"
+#include "DataAnalysis.h"
+#include "Files.h"
+#include "Hash.h"
+#include "Stats.h"
+#include "Trace.h"
+
+/// Incremental re-analysis of charge files that only ever get appended to.
+///
+/// After analysing a file we leave a small sidecar state file next to it recording how far into the file we got,
+/// a checksum of everything up to that point and the running statistics. Next time round, if the checksum of that
+/// prefix still matches, only the bytes after it need parsing. If it doesn't match, we just start over.
+namespace Incremental {
+    const uint32_t STATE_MAGIC   = 0x53414843; // "CHAS" when read as little-endian bytes.
+    const uint32_t STATE_VERSION = 3; // 3: saved statistics may include lines the parser now rejects.
+
+    const size_t READ_BLOCK_SIZE = 1 << 20;
+
+    struct AnalysisState {
+        uint64_t offset       = 0; // Byte offset just past the last full line processed.
+        uint64_t prefixHash   = 0; // Hash of the bytes [0, offset).
+        uint64_t corruptCount = 0; // Corrupt data points in the bytes [0, offset).
+        DataAnalysis::Accumulator accumulator;
+    };
+
+    /// What came of analysing a file incrementally.
+    struct Outcome {
+        DataAnalysis::Accumulator accumulator;
+        bool     resumed      = false; // Whether the saved state was usable.
+        uint64_t corruptCount = 0;     // Corrupt data points in the whole file, including any part covered by saved state.
+    };
+
+    inline std::string getStatePath(const std::string& filepath) {
+        return filepath + ".state";
+    }
+
+    // Loads a state file. Returns false if there isn't one or it isn't one we understand.
+    inline bool loadState(const std::string& statePath, AnalysisState& state) {
+        std::ifstream in(statePath, std::ios::in | std::ios::binary);
+        if (!in.is_open()) return false;
+
+        uint32_t magic = 0, version = 0;
+        in.read(reinterpret_cast<char*>(&magic),   sizeof(magic));
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        if (!in || magic != STATE_MAGIC || version != STATE_VERSION) return false;
+
+        in.read(reinterpret_cast<char*>(&state.offset),     sizeof(state.offset));
+        in.read(reinterpret_cast<char*>(&state.prefixHash), sizeof(state.prefixHash));
+        in.read(reinterpret_cast<char*>(&state.corruptCount), sizeof(state.corruptCount));
+        return state.accumulator.read(in);
+    }
+
+    // Saves a state file, never leaving a half-written one behind to trip us up next time.
+    inline bool saveState(const std::string& statePath, const AnalysisState& state) {
+        return Files::writeFileAtomically(statePath, [&](std::ostream& out) {
+            out.write(reinterpret_cast<const char*>(&STATE_MAGIC),      sizeof(STATE_MAGIC));
+            out.write(reinterpret_cast<const char*>(&STATE_VERSION),    sizeof(STATE_VERSION));
+            out.write(reinterpret_cast<const char*>(&state.offset),     sizeof(state.offset));
+            out.write(reinterpret_cast<const char*>(&state.prefixHash), sizeof(state.prefixHash));
+            out.write(reinterpret_cast<const char*>(&state.corruptCount), sizeof(state.corruptCount));
+            state.accumulator.write(out);
+        });
+    }
+
+    // Feeds the first length bytes of the file into the hasher. Returns false if the file ended early.
+    inline bool hashPrefix(std::ifstream& file, uint64_t length, Hash::Hasher& hasher) {
+        std::vector<char> buffer((size_t)std::min<uint64_t>(length, READ_BLOCK_SIZE));
+        while (length > 0) {
+            size_t toRead = (size_t)std::min<uint64_t>(length, buffer.size());
+            file.read(buffer.data(), toRead);
+            if ((size_t)file.gcount() != toRead) return false;
+
+            hasher.update(buffer.data(), toRead);
+            length -= toRead;
+        }
+        return true;
+    }
+
+    // Analyses the given file, picking up from its state file where possible, and updates the state file afterwards.
+    // Returns false if the file couldn't be opened.
+    inline bool analyseFile(const std::string& filepath, Outcome& outcome, bool reportCorruptPoints = true) {
+        std::ifstream file;
+        {
+            Stats::ScopedTimer timer(Stats::Phase::OPEN);
+            file.open(filepath, std::ios::in | std::ios::binary);
+        }
+        if (!file.is_open()) return false;
+
+        Stats::ScopedTimer timer(Stats::Phase::PARSE);
+        file.seekg(0, std::ios::end);
+        uint64_t fileSize = (uint64_t)file.tellg();
+        file.seekg(0, std::ios::beg);
+
+        std::string statePath = getStatePath(filepath);
+
+        // Check the saved state still describes the start of this file, if so carry on from it.
+        AnalysisState state;
+        Hash::Hasher hasher;
+        outcome = Outcome();
+        if (loadState(statePath, state) && state.offset <= fileSize) {
+            if (hashPrefix(file, state.offset, hasher) && hasher.digest() == state.prefixHash) {
+                outcome.resumed = true;
+            }
+        }
+
+        // Something in the prefix changed (or there was no state to begin with), start from scratch.
+        if (!outcome.resumed) {
+            state = AnalysisState();
+            hasher.reset();
+            file.clear();
+            file.seekg(0, std::ios::beg);
+        }
+
+        std::vector<char> buffer(READ_BLOCK_SIZE);
+        std::string partial; // Any incomplete line left at the end of a block.
+        std::string line;
+        uint64_t bytesRead = state.offset;
+        uint64_t lines = 0;
+        uint64_t corruptBefore = state.corruptCount;
+        while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+            Trace::Scope chunkTrace("parse_chunk", "pipeline", filepath.c_str());
+            const char* lineStart = buffer.data();
+            const char* const end = lineStart + file.gcount();
+            bytesRead += (uint64_t)file.gcount();
+
+            // Pull out each complete line in this block.
+            while (const char* newline = static_cast<const char*>(std::memchr(lineStart, '\n', end - lineStart))) {
+                // Lines wholly inside the block are parsed where they are, only one split across blocks is copied.
+                const char* parseStart = lineStart;
+                const char* parseEnd = newline;
+                if (!partial.empty()) {
+                    line = partial;
+                    line.append(lineStart, newline);
+                    parseStart = line.data();
+                    parseEnd = line.data() + line.size();
+                }
+
+                // Only complete lines count as processed, same as loading the file normally.
+                hasher.update(partial.data(), partial.size());
+                hasher.update(lineStart, newline + 1 - lineStart);
+                state.offset += partial.size() + (newline + 1 - lineStart);
+                partial.clear();
+
+                ++lines;
+                double charge;
+                if (ChargeParser::parse(ChargeParser::DEFAULT_BACKEND, parseStart, parseEnd, charge)) {
+                    state.accumulator.add(charge);
+                } else {
+                    Stats::ScopedTimer corruptTimer(Stats::Phase::CORRUPT);
+                    if (reportCorruptPoints) {
+                        std::cerr << "File: " << filepath << " has a corrupt data point." << std::endl
+                                  << "Skipping that data point." << std::endl;
+                    }
+                    ++state.corruptCount;
+                }
+
+                lineStart = newline + 1;
+            }
+            partial.append(lineStart, end);
+        }
+        // A read error part way through leaves only some of the file analysed, which mustn't be saved as if it were
+        // all there was.
+        if (file.bad()) return false;
+
+        Stats::add(Stats::Counter::BYTES_READ, bytesRead);
+        Stats::add(Stats::Counter::LINES, lines);
+        Stats::add(Stats::Counter::CORRUPT_POINTS, state.corruptCount - corruptBefore);
+
+        state.prefixHash = hasher.digest();
+        if (!saveState(statePath, state)) {
+            std::cerr << "Could not save analysis state to: " << statePath << "." << std::endl;
+        }
+
+        outcome.accumulator  = state.accumulator;
+        outcome.corruptCount = state.corruptCount;
+        return true;
+    }
+}
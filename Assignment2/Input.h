@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cctype>
+#include <algorithm>
+#include <iostream>
+
+namespace Input {
+    // Compares two strings in a case-insensitive manner.
+    inline bool icompare(const std::string& a, const std::string& b) {
+        // Simple shortcut, two strings must be the same length to be the same.
+        if (a.length() != b.length()) return false;
+
+        // Not-so-efficient algorithm that equates each pair of characters with the same index in the string objects' char arrays one at a time.
+        return std::equal(a.begin(), a.end(), b.begin(), [](char a, char b) {
+            // Case insensitive so simply force characters to their lower-case form.
+            return std::tolower(a) == std::tolower(b);
+        });
+    }
+
+    // Gets a user choice between two sets of valid responses. Returns 1 where the user response was in the first set and -1 where the response was in the second set.
+    inline int getBetweenTwoStringSetOptions(std::string message, const std::vector<std::string>& firstStringSet, const std::vector<std::string>& secondStringSet) {
+        int response;
+        std::string line;
+        // Grab a line from the cin buffer.
+        while (std::getline(std::cin, line)) {
+            // Iterate over valid true strings and compare them with the grabbed line in a case-insensitive manner.
+            const auto& itTrue = std::find_if(firstStringSet.begin(), firstStringSet.end(), [&line](const std::string& a) {
+                return icompare(a, line);
+            });
+            // Iterate over valid false strings and compare them with the grabbed line in a case-insensitive manner.
+            const auto& itFalse = std::find_if(secondStringSet.begin(), secondStringSet.end(), [&line](const std::string& a) {
+                return icompare(a, line);
+            });
+
+            // If either iterator is not pointing at the end of their respective string arrays, then the grabbed line must have matched one of the valid strings in one of those arrays.
+            if (itTrue != firstStringSet.end()) {
+                response = 1;
+                break;
+            } else if (itFalse != secondStringSet.end()) {
+                response = -1;
+                break;
+            }
+
+            std::cout << "Sorry, the value you inputted was not valid." << std::endl;
+            std::cout << message;
+        }
+        // Can only get here via the if block, but returning inside the if block makes VS throw a warning, I don't like warnings.
+        return response;
+    }
+
+    // Gets a bool from the user.
+    inline bool getBool() {
+        static const std::vector<std::string> validTrues = {
+            "yes",
+            "y",
+            "true",
+            "1"
+        };
+        static const std::vector<std::string> validFalses = {
+            "no",
+            "n",
+            "false",
+            "0"
+        };
+
+        return getBetweenTwoStringSetOptions("Yay, or nay? [y/n]:\n", validTrues, validFalses) == 1;
+    }
+}
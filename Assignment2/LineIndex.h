@@ -0,0 +1,306 @@
+#pragma once
+
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+#include "Decompression.h"
+#include "Files.h"
+#include "LoaderPolicies.h"
+#include "Stats.h"
+
+/// An index of where the lines of a text charge file start, kept in a sidecar beside it (<file>.idx).
+///
+/// It holds the byte offset of every STRIDE-th line and the number of lines, so the line count is there without
+/// reading the file, any line is at most STRIDE - 1 newlines on from an offset in the index, and the file splits
+/// into parts of equal numbers of lines without a scan. That in turn makes a uniform random sample of lines cheap:
+/// each costs a short search from its nearest indexed line instead of reading everything before it.
+///
+/// Building one counts the newlines on several threads, over the file mapped into memory. An index records the
+/// size and modification time of the file it was built from, and is ignored once those change.
+namespace LineIndex {
+    static constexpr uint32_t MAGIC   = 0x58444943; // "CIDX" when read as little-endian bytes.
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint64_t STRIDE  = 1024;        // Lines between offsets in the index.
+    static constexpr uint64_t MIN_BYTES_PER_THREAD = 4 << 20; // Smaller files aren't worth starting threads for.
+    static constexpr uint64_t DEFAULT_SEED = 1;
+
+    inline std::string getIndexPath(const std::string& filepath) {
+        return filepath + ".idx";
+    }
+
+    namespace impl {
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t stride;
+            uint64_t fileSize;
+            int64_t  modifiedTime;
+            uint64_t lineCount;
+            uint64_t entryCount;
+        };
+
+        // Size and modification time of the file, false if it isn't there.
+        inline bool getIdentity(const std::string& filepath, uint64_t& size, int64_t& modifiedTime) {
+            std::error_code error;
+            size = (uint64_t)std::filesystem::file_size(filepath, error);
+            if (error) return false;
+            modifiedTime = (int64_t)std::filesystem::last_write_time(filepath, error).time_since_epoch().count();
+            return !error;
+        }
+
+        // Start of the line count lines on from the one at start, or nullptr if the data ends first. Counts the
+        // newlines a block at a time (which vectorises) until the line's in sight, rather than finding every one.
+        inline const char* skipLines(const char* start, const char* end, uint64_t count) {
+            const size_t BLOCK_SIZE = 256;
+            while (count > 0 && (size_t)(end - start) >= BLOCK_SIZE) {
+                uint64_t newlines = (uint64_t)std::count(start, start + BLOCK_SIZE, '\n');
+                if (newlines >= count) break;
+                count -= newlines;
+                start += BLOCK_SIZE;
+            }
+            for (; count > 0; --count) {
+                const char* newline = static_cast<const char*>(std::memchr(start, '\n', end - start));
+                if (newline == nullptr) return nullptr;
+                start = newline + 1;
+            }
+            return start;
+        }
+    }
+
+    class Index {
+    public:
+        // Builds the index of a text file, counting its lines on up to threads threads. Returns false if it couldn't
+        // be read, or is compressed (where byte offsets into it would mean nothing).
+        bool build(const std::string& filepath, unsigned threads = 1) {
+            clear();
+            if (Decompression::detect(filepath) != Decompression::Format::NONE) return false;
+            if (!impl::getIdentity(filepath, m_fileSize, m_modifiedTime)) return false;
+
+            Sources::Mapped source;
+            {
+                Stats::ScopedTimer timer(Stats::Phase::OPEN);
+                if (!source.open(filepath)) return false;
+            }
+            const char* data = nullptr;
+            size_t size = 0;
+            source.next(data, size); // The whole file in one go, or nothing if it's empty.
+
+            Stats::ScopedTimer timer(Stats::Phase::LINE_COUNT);
+            threads = (unsigned)std::max<uint64_t>(1, std::min<uint64_t>(std::max(threads, 1u), size / MIN_BYTES_PER_THREAD));
+            std::vector<size_t> starts(threads + 1);
+            for (unsigned i = 0; i <= threads; ++i) {
+                starts[i] = (size_t)((uint64_t)size * i / threads);
+            }
+
+            // First count the newlines in each part, which tells every part the number of the first line ending
+            // in it. Then each part notes where the lines it starts on stride boundaries begin.
+            std::vector<uint64_t> counts(threads, 0);
+            forEachPart(threads, [&](unsigned part) {
+                counts[part] = (uint64_t)std::count(data + starts[part], data + starts[part + 1], '\n');
+            });
+            std::vector<uint64_t> firstLines(threads, 0);
+            for (unsigned i = 1; i < threads; ++i) {
+                firstLines[i] = firstLines[i - 1] + counts[i - 1];
+            }
+            m_lineCount = firstLines[threads - 1] + counts[threads - 1];
+
+            m_entries.assign((size_t)((m_lineCount + STRIDE - 1) / STRIDE), 0);
+            forEachPart(threads, [&](unsigned part) {
+                uint64_t line = firstLines[part];
+                const char* position = data + starts[part];
+                const char* const end = data + starts[part + 1];
+                while (const char* newline = static_cast<const char*>(std::memchr(position, '\n', end - position))) {
+                    ++line; // The line after this newline.
+                    if (line % STRIDE == 0 && line < m_lineCount) {
+                        m_entries[(size_t)(line / STRIDE)] = (uint64_t)(newline + 1 - data);
+                    }
+                    position = newline + 1;
+                }
+            });
+
+            Stats::add(Stats::Counter::BYTES_READ, size);
+            Stats::add(Stats::Counter::LINES, m_lineCount);
+            return true;
+        }
+
+        // Loads the index beside the file. Returns false if there isn't one, it isn't one we understand, or the
+        // file's changed since it was built.
+        bool load(const std::string& filepath) {
+            clear();
+            std::ifstream in(getIndexPath(filepath), std::ios::in | std::ios::binary);
+            if (!in.is_open()) return false;
+
+            impl::Header header = {};
+            in.read(reinterpret_cast<char*>(&header), sizeof(header));
+            uint64_t fileSize;
+            int64_t modifiedTime;
+            if (!in || header.magic != MAGIC || header.version != VERSION || header.stride != STRIDE
+                || header.entryCount != (header.lineCount + STRIDE - 1) / STRIDE
+                || !impl::getIdentity(filepath, fileSize, modifiedTime)
+                || header.fileSize != fileSize || header.modifiedTime != modifiedTime) {
+                return false;
+            }
+
+            m_entries.resize((size_t)header.entryCount);
+            in.read(reinterpret_cast<char*>(m_entries.data()), (std::streamsize)(m_entries.size() * sizeof(uint64_t)));
+            if (!in) {
+                clear();
+                return false;
+            }
+            m_fileSize     = fileSize;
+            m_modifiedTime = modifiedTime;
+            m_lineCount    = header.lineCount;
+            return true;
+        }
+
+        // Saves the index beside the file. Writes to a temporary file first and swaps it in, so a half-written
+        // index is never left behind. Returns false if it couldn't be saved.
+        bool save(const std::string& filepath) const {
+            impl::Header header = {};
+            header.magic        = MAGIC;
+            header.version      = VERSION;
+            header.stride       = STRIDE;
+            header.fileSize     = m_fileSize;
+            header.modifiedTime = m_modifiedTime;
+            header.lineCount    = m_lineCount;
+            header.entryCount   = m_entries.size();
+
+            return Files::writeFileAtomically(getIndexPath(filepath), [&](std::ostream& out) {
+                out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+                out.write(reinterpret_cast<const char*>(m_entries.data()), (std::streamsize)(m_entries.size() * sizeof(uint64_t)));
+            });
+        }
+
+        void clear() {
+            m_entries.clear();
+            m_lineCount = 0;
+            m_fileSize = 0;
+            m_modifiedTime = 0;
+        }
+
+        // Lines in the file, not counting a last one without a newline (which isn't a record).
+        uint64_t getLineCount() const {
+            return m_lineCount;
+        }
+        uint64_t getFileSize() const {
+            return m_fileSize;
+        }
+
+        // Byte offset of the nearest indexed line at or before the given one, with how many lines on from there
+        // the line is (always under STRIDE).
+        uint64_t seek(uint64_t line, uint64_t& linesToSkip) const {
+            linesToSkip = line % STRIDE;
+            return m_entries[(size_t)(line / STRIDE)];
+        }
+
+        // Splits the lines into parts of as near equal numbers as the index allows, giving the byte offset where
+        // each part starts followed by the end of the file, so part i is [offsets[i], offsets[i + 1]). Every part
+        // starts on a line.
+        std::vector<uint64_t> getPartitions(unsigned parts) const {
+            std::vector<uint64_t> offsets;
+            parts = std::max(parts, 1u);
+            for (unsigned i = 0; i < parts; ++i) {
+                size_t entry = (size_t)((uint64_t)m_entries.size() * i / parts);
+                offsets.push_back(entry < m_entries.size() ? m_entries[entry] : m_fileSize);
+            }
+            offsets.push_back(m_fileSize);
+            return offsets;
+        }
+    private:
+        // Runs work(part) for every part, each on its own thread but the last, which runs on this one.
+        template <typename Work>
+        static void forEachPart(unsigned parts, const Work& work) {
+            std::vector<std::thread> threads;
+            for (unsigned part = 0; part + 1 < parts; ++part) {
+                threads.emplace_back([&work, part]() { work(part); });
+            }
+            work(parts - 1);
+            for (std::thread& thread : threads) {
+                thread.join();
+            }
+        }
+
+        std::vector<uint64_t> m_entries; // Byte offset of line i * STRIDE.
+        uint64_t m_lineCount    = 0;
+        uint64_t m_fileSize     = 0;
+        int64_t  m_modifiedTime = 0;
+    };
+
+    // Loads the index beside the file if it's up to date, otherwise builds one (on up to threads threads) and
+    // saves it there for next time. Returns false if the file couldn't be indexed at all, though an index that
+    // only couldn't be saved is still used.
+    inline bool getIndex(const std::string& filepath, unsigned threads, Index& index) {
+        if (index.load(filepath)) return true;
+        if (!index.build(filepath, threads)) return false;
+        index.save(filepath);
+        return true;
+    }
+
+    // Parses a uniform random sample of count lines of the file (with replacement, so a line can come up more than
+    // once), going through the index to find each. The same seed picks the same lines. Corrupt lines picked are
+    // counted rather than reported. Returns false if the file couldn't be opened.
+    template <typename Parser = RecordParsers::Text>
+    bool sample(const std::string& filepath, const Index& index, uint64_t count, uint64_t seed, std::vector<double>& charges,
+                unsigned int& corruptCount) {
+        static_assert(!Parser::RECORDS_ARE_VALUES, "Line indexes are only for files of lines");
+        charges.clear();
+        corruptCount = 0;
+
+        Sources::Mapped source;
+        {
+            Stats::ScopedTimer timer(Stats::Phase::OPEN);
+            if (!source.open(filepath)) return false;
+        }
+        const char* data = nullptr;
+        size_t size = 0;
+        source.next(data, size);
+        if (index.getLineCount() == 0 || size != index.getFileSize()) return true;
+
+        Stats::ScopedTimer timer(Stats::Phase::PARSE);
+        std::mt19937_64 random(seed);
+        std::uniform_int_distribution<uint64_t> pick(0, index.getLineCount() - 1);
+        std::vector<uint64_t> lines((size_t)count);
+        for (uint64_t& line : lines) {
+            line = pick(random);
+        }
+        // In file order, so the pages come in front to back.
+        std::sort(lines.begin(), lines.end());
+
+        Parser parser;
+        const char* const end = data + size;
+        charges.reserve(lines.size());
+        const char* lastStart = nullptr; // Where the last line picked starts, and its number.
+        uint64_t lastLine = 0;
+        for (uint64_t line : lines) {
+            // Go on from the last line picked if it's nearer than the index gets us, as it is when the picks are dense.
+            uint64_t linesToSkip;
+            const char* recordStart = data + index.seek(line, linesToSkip);
+            if (lastStart != nullptr && line - lastLine < linesToSkip) {
+                recordStart = lastStart;
+                linesToSkip = line - lastLine;
+            }
+            recordStart = impl::skipLines(recordStart, end, linesToSkip);
+            lastStart = recordStart;
+            lastLine = line;
+
+            // Only missing if the file's been rewritten to the same size and time since it was indexed.
+            double charge;
+            const char* recordEnd = recordStart != nullptr ? parser.findRecordEnd(recordStart, end) : nullptr;
+            if (recordEnd != nullptr && parser.parseRecord(recordStart, recordEnd, charge)) {
+                charges.push_back(charge);
+            } else {
+                ++corruptCount;
+            }
+        }
+        Stats::add(Stats::Counter::LINES, lines.size());
+        return true;
+    }
+}
@@ -0,0 +1,823 @@
+#pragma once
+
+#include <cmath>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+#include <memory_resource>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#include <iostream>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "ChargeParser.h"
+#include "DataAnalysis.h"
+#include "FixedPoint.h"
+
+/// The pieces a charge loader (see BasicChargeDataModel) is put together from: where the bytes come from, how
+/// they split into records holding a charge each, and where the charges are kept. Each is a plain class used as
+/// a template parameter, so the loader built from them has no virtual calls and everything per record inlines.
+///
+/// A source has open, close, isOpen, getSize (0 if unknown), next (the next block of bytes, false at the end),
+/// isFailed (whether next stopped on an error rather than at the end, which fails the load) and rewind. A record
+/// parser has findRecordEnd, getRemainder, parseRecord, countRecordEnds and estimateRecordCount. A storage has
+/// clear, reserve, add, finish and size, plus forEachRun to visit the charges, which come as one run if the
+/// storage is contiguous.
+
+namespace Sources {
+    namespace impl {
+        // Hints to the page cache about how a file's going to be read. They only do anything where the system
+        // has posix_fadvise (Linux and most other Unixes), and failing is harmless, so failures are ignored.
+        enum class Advice {
+            SEQUENTIAL, // Read ahead further than usual, and don't bother keeping what's behind.
+            WILL_NEED,  // Start reading the range in now, before it's asked for.
+            DONT_NEED   // Drop the range from the cache, it won't be read again.
+        };
+
+        inline void advise(int descriptor, Advice advice, uint64_t offset = 0, uint64_t length = 0) {
+#if defined(POSIX_FADV_SEQUENTIAL)
+            static const int ADVICE[] = { POSIX_FADV_SEQUENTIAL, POSIX_FADV_WILLNEED, POSIX_FADV_DONTNEED };
+            posix_fadvise(descriptor, (off_t)offset, (off_t)length, ADVICE[(int)advice]);
+#else
+            (void)descriptor; (void)advice; (void)offset; (void)length;
+#endif
+        }
+    }
+
+    /// Reads the file a block at a time. Each block is only valid until the next.
+    ///
+    /// Where the system takes hints, it's told the file will be read sequentially, and asked for the next stretch
+    /// of the file ahead of the reading so a cold file comes in at full disk speed. With setDropCache, each block
+    /// is dropped from the page cache once read, so a big batch doesn't push out what other programs have cached.
+    class File {
+    public:
+        static constexpr bool IS_STABLE = false;
+        static constexpr size_t READ_BLOCK_SIZE = 1 << 20;
+        static constexpr uint64_t READ_AHEAD = 8 << 20; // How far ahead of the reading to ask for the file.
+
+        // Takes effect from the next open.
+        void setDropCache(bool isDroppingCache) {
+            m_isDroppingCache = isDroppingCache;
+        }
+
+        bool open(const std::string& path) {
+            close();
+#if defined(_WIN32)
+            m_file.open(path, std::ios::in | std::ios::binary);
+            if (!m_file.is_open()) return false;
+
+            std::error_code error;
+            m_size = (uint64_t)std::filesystem::file_size(path, error);
+            if (error) m_size = 0;
+#else
+            m_descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (m_descriptor < 0) return false;
+
+            struct stat status;
+            m_size = fstat(m_descriptor, &status) == 0 ? (uint64_t)status.st_size : 0;
+            impl::advise(m_descriptor, impl::Advice::SEQUENTIAL);
+            m_offset = 0;
+            m_advisedTo = 0;
+#endif
+            m_buffer.resize(READ_BLOCK_SIZE);
+            m_isFailed = false;
+            return true;
+        }
+        void close() {
+#if defined(_WIN32)
+            if (m_file.is_open()) m_file.close();
+#else
+            if (m_descriptor >= 0) {
+                // Pages that were still on their way in when their block was dropped are caught here.
+                if (m_isDroppingCache) impl::advise(m_descriptor, impl::Advice::DONT_NEED);
+                ::close(m_descriptor);
+            }
+            m_descriptor = -1;
+#endif
+            std::vector<char>().swap(m_buffer);
+        }
+        bool isOpen() const {
+#if defined(_WIN32)
+            return m_file.is_open();
+#else
+            return m_descriptor >= 0;
+#endif
+        }
+        uint64_t getSize() const {
+            return m_size;
+        }
+
+        bool next(const char*& data, size_t& size) {
+            data = m_buffer.data();
+#if defined(_WIN32)
+            m_file.read(m_buffer.data(), m_buffer.size());
+            size = (size_t)m_file.gcount();
+            if (m_file.bad()) m_isFailed = true;
+#else
+            // Keep the next stretch of the file on its way in while this block is parsed.
+            if (m_offset + READ_AHEAD / 2 >= m_advisedTo && m_advisedTo < m_size) {
+                impl::advise(m_descriptor, impl::Advice::WILL_NEED, m_advisedTo, READ_AHEAD);
+                m_advisedTo += READ_AHEAD;
+            }
+
+            ssize_t count;
+            do {
+                count = ::read(m_descriptor, m_buffer.data(), m_buffer.size());
+            } while (count < 0 && errno == EINTR);
+            size = count > 0 ? (size_t)count : 0;
+            if (count < 0) m_isFailed = true; // Not the end, just as far as could be read (an I/O error, say).
+
+            if (m_isDroppingCache && size > 0) {
+                // It's in our buffer now, the cache's copy won't be wanted again.
+                impl::advise(m_descriptor, impl::Advice::DONT_NEED, m_offset, size);
+            }
+            m_offset += size;
+#endif
+            return size > 0;
+        }
+        bool isFailed() const {
+            return m_isFailed;
+        }
+        void rewind() {
+#if defined(_WIN32)
+            m_file.clear();
+            m_file.seekg(0, std::ios::beg);
+#else
+            lseek(m_descriptor, 0, SEEK_SET);
+            m_offset = 0;
+            m_advisedTo = 0;
+#endif
+            m_isFailed = false;
+        }
+    private:
+#if defined(_WIN32)
+        std::ifstream m_file;
+#else
+        int      m_descriptor = -1;
+        uint64_t m_offset     = 0; // Where the next read starts.
+        uint64_t m_advisedTo  = 0; // How far into the file we've asked for so far.
+#endif
+        std::vector<char> m_buffer;
+        uint64_t m_size = 0;
+        bool m_isDroppingCache = false;
+        bool m_isFailed = false;
+    };
+
+    /// Maps the whole file into memory and hands it over as a single block, so nothing is copied. The block stays
+    /// valid for as long as anything holds the keep-alive from getKeepAlive, even after the source is closed.
+    ///
+    /// The mapping is marked as read sequentially and needed soon, so the file streams in ahead of the parser
+    /// rather than a page fault at a time. With setDropCache, the file is dropped from the page cache once the
+    /// mapping goes.
+    class Mapped {
+    public:
+        static constexpr bool IS_STABLE = true;
+
+        // Takes effect from the next open.
+        void setDropCache(bool isDroppingCache) {
+            m_isDroppingCache = isDroppingCache;
+        }
+
+        bool open(const std::string& path) {
+            close();
+            auto mapping = std::make_shared<Mapping>();
+#if defined(_WIN32)
+            mapping->file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if (mapping->file == INVALID_HANDLE_VALUE) return false;
+
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(mapping->file, &size)) return false;
+            mapping->size = (size_t)size.QuadPart;
+            if (mapping->size > 0) {
+                mapping->mapping = CreateFileMappingA(mapping->file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+                if (mapping->mapping == nullptr) return false;
+                mapping->address = MapViewOfFile(mapping->mapping, FILE_MAP_READ, 0, 0, 0);
+                if (mapping->address == nullptr) return false;
+            }
+#else
+            int descriptor = ::open(path.c_str(), O_RDONLY);
+            if (descriptor < 0) return false;
+
+            struct stat status;
+            if (fstat(descriptor, &status) != 0) {
+                ::close(descriptor);
+                return false;
+            }
+            mapping->size = (size_t)status.st_size;
+            if (mapping->size > 0) {
+                void* address = mmap(nullptr, mapping->size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+                if (address == MAP_FAILED) {
+                    ::close(descriptor);
+                    return false;
+                }
+                mapping->address = address;
+                madvise(address, mapping->size, MADV_SEQUENTIAL);
+                madvise(address, mapping->size, MADV_WILLNEED);
+            }
+            if (m_isDroppingCache) {
+                mapping->descriptor = descriptor; // Kept for dropping the cache once unmapped.
+            } else {
+                ::close(descriptor); // The mapping keeps the file open for us.
+            }
+#endif
+            m_mapping = mapping;
+            m_isConsumed = false;
+            return true;
+        }
+        void close() {
+            m_mapping.reset();
+        }
+        bool isOpen() const {
+            return m_mapping != nullptr;
+        }
+        uint64_t getSize() const {
+            return m_mapping != nullptr ? (uint64_t)m_mapping->size : 0;
+        }
+
+        bool next(const char*& data, size_t& size) {
+            if (m_mapping == nullptr || m_isConsumed || m_mapping->size == 0) return false;
+            m_isConsumed = true;
+            data = static_cast<const char*>(m_mapping->address);
+            size = m_mapping->size;
+            return true;
+        }
+        bool isFailed() const {
+            return false;
+        }
+        void rewind() {
+            m_isConsumed = false;
+        }
+
+        std::shared_ptr<const void> getKeepAlive() const {
+            return m_mapping;
+        }
+    private:
+        struct Mapping {
+            void*  address = nullptr;
+            size_t size    = 0;
+#if defined(_WIN32)
+            HANDLE file    = INVALID_HANDLE_VALUE;
+            HANDLE mapping = nullptr;
+#else
+            int descriptor = -1; // Only kept open when the cache is to be dropped.
+#endif
+            ~Mapping() {
+#if defined(_WIN32)
+                if (address != nullptr) UnmapViewOfFile(address);
+                if (mapping != nullptr) CloseHandle(mapping);
+                if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#else
+                if (address != nullptr) munmap(address, size);
+                if (descriptor >= 0) {
+                    impl::advise(descriptor, impl::Advice::DONT_NEED);
+                    ::close(descriptor);
+                }
+#endif
+            }
+        };
+
+        std::shared_ptr<Mapping> m_mapping;
+        bool m_isConsumed = false;
+        bool m_isDroppingCache = false;
+    };
+
+    /// Standard input (given as "-") or a named pipe, read a block at a time as the data arrives. Nothing can be
+    /// read twice, so it can't rewind and its size is never known, but it only ever holds the one block.
+    class Stream {
+    public:
+        static constexpr bool IS_STABLE = false;
+        static constexpr size_t READ_BLOCK_SIZE = 1 << 20;
+
+        // Whether the path is standard input or anything else that can only be read once, front to back.
+        static bool isStream(const std::string& path) {
+            if (path == "-") return true;
+#if defined(_WIN32)
+            return path.compare(0, 9, "\\\\.\\pipe\\") == 0;
+#else
+            struct stat status;
+            return stat(path.c_str(), &status) == 0 && (S_ISFIFO(status.st_mode) || S_ISCHR(status.st_mode) || S_ISSOCK(status.st_mode));
+#endif
+        }
+
+        bool open(const std::string& path) {
+            close();
+#if defined(_WIN32)
+            if (path == "-") {
+                _setmode(_fileno(stdin), _O_BINARY);
+                m_in = &std::cin;
+            } else {
+                m_file.open(path, std::ios::in | std::ios::binary);
+                if (!m_file.is_open()) return false;
+                m_in = &m_file;
+            }
+#else
+            if (path == "-") {
+                m_descriptor = STDIN_FILENO;
+            } else {
+                m_descriptor = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+                if (m_descriptor < 0) return false;
+            }
+#endif
+            m_buffer.resize(READ_BLOCK_SIZE);
+            m_isFailed = false;
+            return true;
+        }
+        void close() {
+#if defined(_WIN32)
+            if (m_file.is_open()) m_file.close();
+            m_in = nullptr;
+#else
+            if (m_descriptor > STDIN_FILENO) ::close(m_descriptor); // Standard input isn't ours to close.
+            m_descriptor = -1;
+#endif
+            std::vector<char>().swap(m_buffer);
+        }
+        bool isOpen() const {
+#if defined(_WIN32)
+            return m_in != nullptr;
+#else
+            return m_descriptor >= 0;
+#endif
+        }
+        uint64_t getSize() const {
+            return 0;
+        }
+
+        // Hands over whatever has arrived, up to a block, waiting if nothing has yet.
+        bool next(const char*& data, size_t& size) {
+            data = m_buffer.data();
+#if defined(_WIN32)
+            m_in->read(m_buffer.data(), m_buffer.size());
+            size = (size_t)m_in->gcount();
+            if (m_in->bad()) m_isFailed = true;
+#else
+            ssize_t count;
+            do {
+                count = ::read(m_descriptor, m_buffer.data(), m_buffer.size());
+            } while (count < 0 && errno == EINTR);
+            size = count > 0 ? (size_t)count : 0;
+            if (count < 0) m_isFailed = true;
+#endif
+            return size > 0;
+        }
+        bool isFailed() const {
+            return m_isFailed;
+        }
+        void rewind() {}
+    private:
+#if defined(_WIN32)
+        std::istream* m_in = nullptr;
+        std::ifstream m_file;
+#else
+        int m_descriptor = -1;
+#endif
+        std::vector<char> m_buffer;
+        bool m_isFailed = false;
+    };
+
+    /// A file's contents already read into memory by someone else (see AsyncReader and BatchReader), handed over as
+    /// a single block. Opening ignores the path and just checks there are contents to hand over.
+    class Memory {
+    public:
+        static constexpr bool IS_STABLE = true;
+        typedef std::shared_ptr<const std::vector<char>> ContentsPtr;
+
+        void setContents(ContentsPtr contents) {
+            m_contents = std::move(contents);
+        }
+
+        bool open(const std::string&) {
+            m_isOpen = m_contents != nullptr;
+            m_isConsumed = false;
+            return m_isOpen;
+        }
+        void close() {
+            m_isOpen = false;
+        }
+        bool isOpen() const {
+            return m_isOpen;
+        }
+        uint64_t getSize() const {
+            return m_contents != nullptr ? (uint64_t)m_contents->size() : 0;
+        }
+
+        bool next(const char*& data, size_t& size) {
+            if (!m_isOpen || m_isConsumed || m_contents->empty()) return false;
+            m_isConsumed = true;
+            data = m_contents->data();
+            size = m_contents->size();
+            return true;
+        }
+        bool isFailed() const {
+            return false;
+        }
+        void rewind() {
+            m_isConsumed = false;
+        }
+
+        std::shared_ptr<const void> getKeepAlive() const {
+            return m_contents;
+        }
+    private:
+        ContentsPtr m_contents;
+        bool m_isOpen     = false;
+        bool m_isConsumed = false;
+    };
+}
+
+namespace RecordParsers {
+    /// One charge per line of text, as in millikan.dat. A last line without a newline isn't a record.
+    class Text {
+    public:
+        static constexpr bool RECORDS_ARE_VALUES = false;
+
+        // End of the record starting at begin (just past its newline), or nullptr if it doesn't end before end.
+        const char* findRecordEnd(const char* begin, const char* end) const {
+            const char* newline = static_cast<const char*>(std::memchr(begin, '\n', end - begin));
+            return newline != nullptr ? newline + 1 : nullptr;
+        }
+        // How many bytes from data finish a record whose first partialLength bytes came in an earlier block,
+        // or SIZE_MAX if they don't.
+        size_t getRemainder(size_t, const char* data, size_t size) const {
+            const char* newline = static_cast<const char*>(std::memchr(data, '\n', size));
+            return newline != nullptr ? (size_t)(newline + 1 - data) : SIZE_MAX;
+        }
+        bool parseRecord(const char* begin, const char* end, double& charge) const {
+            return ChargeParser::parse(ChargeParser::DEFAULT_BACKEND, begin, end - 1, charge);
+        }
+
+        // Counts the records ending in a block. Carry holds any state needed across blocks.
+        size_t countRecordEnds(const char* data, size_t size, size_t&) const {
+            return (size_t)std::count(data, data + size, '\n');
+        }
+        // Guesses how many records a source of totalSize bytes holds from its first block, for reserving
+        // storage. Errs a little high, 0 if there's no telling.
+        size_t estimateRecordCount(const char* data, size_t size, uint64_t totalSize) const {
+            size_t sampleSize = std::min<size_t>(size, 1 << 16);
+            size_t sampleRecords = (size_t)std::count(data, data + sampleSize, '\n');
+            if (sampleRecords == 0 || totalSize == 0) return 0;
+            return (size_t)((double)totalSize * (double)sampleRecords / (double)sampleSize * 1.05) + 16;
+        }
+    };
+
+    /// Lines of text that are all the same length, as the generator and the original instrument write them.
+    /// The length is learnt from the first line, after which the storage can be sized exactly up front and each
+    /// record is found by checking the one byte where its newline should be. A line of any other length is
+    /// still read correctly, just found the slow way.
+    class FixedWidth {
+    public:
+        static constexpr bool RECORDS_ARE_VALUES = false;
+
+        const char* findRecordEnd(const char* begin, const char* end) const {
+            if (m_width > 0 && (size_t)(end - begin) >= m_width && begin[m_width - 1] == '\n'
+                    && std::memchr(begin, '\n', m_width - 1) == nullptr) {
+                return begin + m_width;
+            }
+            return m_text.findRecordEnd(begin, end);
+        }
+        size_t getRemainder(size_t partialLength, const char* data, size_t size) const {
+            return m_text.getRemainder(partialLength, data, size);
+        }
+        bool parseRecord(const char* begin, const char* end, double& charge) const {
+            return m_text.parseRecord(begin, end, charge);
+        }
+
+        size_t countRecordEnds(const char* data, size_t size, size_t& carry) const {
+            return m_text.countRecordEnds(data, size, carry);
+        }
+        size_t estimateRecordCount(const char* data, size_t size, uint64_t totalSize) {
+            const char* firstEnd = m_text.findRecordEnd(data, data + size);
+            if (firstEnd == nullptr) return 0;
+            m_width = (size_t)(firstEnd - data);
+            return (size_t)(totalSize / m_width) + 1;
+        }
+    private:
+        Text   m_text;
+        size_t m_width = 0; // Including the newline, 0 until learnt.
+    };
+
+    /// Packed little-endian doubles, as the generator writes with --binary. Anything that isn't a finite charge
+    /// that isn't negative (NaN, infinities, negative numbers) is corrupt. A trailing part-record is ignored.
+    class Binary {
+    public:
+        static constexpr bool RECORDS_ARE_VALUES = true; // A record's bytes are the charge itself.
+        static constexpr size_t RECORD_SIZE = sizeof(double);
+
+        const char* findRecordEnd(const char* begin, const char* end) const {
+            return (size_t)(end - begin) >= RECORD_SIZE ? begin + RECORD_SIZE : nullptr;
+        }
+        size_t getRemainder(size_t partialLength, const char*, size_t size) const {
+            return RECORD_SIZE - partialLength <= size ? RECORD_SIZE - partialLength : SIZE_MAX;
+        }
+        bool parseRecord(const char* begin, const char*, double& charge) const {
+            double value;
+            std::memcpy(&value, begin, sizeof(value)); // Every platform we build for is little-endian.
+            if (!(value >= 0.0) || std::isinf(value)) return false;
+            charge = value;
+            return true;
+        }
+
+        size_t countRecordEnds(const char*, size_t size, size_t& carry) const {
+            carry += size;
+            size_t records = carry / RECORD_SIZE;
+            carry %= RECORD_SIZE;
+            return records;
+        }
+        size_t estimateRecordCount(const char*, size_t, uint64_t totalSize) const {
+            return (size_t)(totalSize / RECORD_SIZE);
+        }
+    };
+}
+
+namespace Storages {
+    /// Charges in a std::vector, contiguous and easy to hand over.
+    class Vector {
+    public:
+        static constexpr bool IS_CONTIGUOUS = true;
+        static constexpr bool IS_VIEW = false;
+
+        void clear() {
+            std::vector<double>().swap(m_values);
+        }
+        void reserve(size_t count) {
+            m_values.reserve(count);
+        }
+        void add(double charge, const char*) {
+            m_values.push_back(charge);
+        }
+        void finish() {
+            // Give back a reservation that turned out well over, rather than hold on to it.
+            if (m_values.capacity() > m_values.size() + m_values.size() / 4 + 16) m_values.shrink_to_fit();
+        }
+
+        size_t size() const {
+            return m_values.size();
+        }
+        double* data() {
+            return m_values.data();
+        }
+        template <typename Function> void forEachRun(Function function) const {
+            if (!m_values.empty()) function(m_values.data(), m_values.size());
+        }
+
+        std::vector<double>& getVector() {
+            return m_values;
+        }
+        // Takes charges loaded some other way (by ParallelLoader, say) as the contents.
+        void assign(std::vector<double>&& charges) {
+            m_values = std::move(charges);
+        }
+    private:
+        std::vector<double> m_values;
+    };
+
+    /// Charges scaled to fixed point as they're parsed (see FixedPoint.h), so a data set held that way never needs
+    /// a vector of doubles as well. Should a charge turn up with more decimal places than asked for, everything
+    /// goes back to doubles from then on, and the charges come out of getVector instead.
+    class Scaled {
+    public:
+        static constexpr bool IS_CONTIGUOUS = false;
+        static constexpr bool IS_VIEW = false;
+
+        void setDecimals(unsigned decimals) {
+            m_decimals = decimals;
+        }
+
+        void clear() {
+            m_charges.start(m_decimals);
+            std::vector<double>().swap(m_values);
+            m_isScaled = true;
+        }
+        void reserve(size_t count) {
+            m_charges.start(m_decimals, count);
+        }
+        void add(double charge, const char*) {
+            if (m_isScaled) {
+                if (m_charges.add(charge)) return;
+                giveUpScaling();
+            }
+            m_values.push_back(charge);
+        }
+        void finish() {
+            m_charges.finish();
+        }
+        // Takes charges loaded some other way (by ParallelLoader, say) and scales them if they all allow it.
+        void assign(std::vector<double>&& charges) {
+            m_isScaled = m_charges.assign(charges.data(), charges.size(), m_decimals);
+            if (m_isScaled) {
+                std::vector<double>().swap(charges);
+            } else {
+                m_values = std::move(charges);
+            }
+        }
+
+        size_t size() const {
+            return m_isScaled ? m_charges.size() : m_values.size();
+        }
+        // Whether every charge could be scaled. If not, they're all doubles instead.
+        bool isScaled() const {
+            return m_isScaled;
+        }
+        FixedPoint::Charges& getCharges() {
+            return m_charges;
+        }
+        std::vector<double>& getVector() {
+            return m_values;
+        }
+    private:
+        void giveUpScaling() {
+            m_charges.appendTo(m_values);
+            m_charges.clear();
+            m_isScaled = false;
+        }
+
+        FixedPoint::Charges m_charges;
+        std::vector<double> m_values;
+        unsigned m_decimals = 0;
+        bool     m_isScaled = true;
+    };
+
+    /// Charges in a contiguous array carved out of an arena. Point any number of loads at the same arena and
+    /// they're all freed in one go when it goes, with no heap traffic per file. By default each storage has an
+    /// arena of its own.
+    class Arena {
+    public:
+        static constexpr bool IS_CONTIGUOUS = true;
+        static constexpr bool IS_VIEW = false;
+
+        Arena() :
+            m_ownArena(new std::pmr::monotonic_buffer_resource()),
+            m_values(new std::pmr::vector<double>(m_ownArena.get())) {}
+
+        // Use the given arena, which must outlive this, rather than our own.
+        void setArena(std::pmr::memory_resource* arena) {
+            // A pmr vector never changes arena, so make a new one (dropping the old before its arena goes).
+            m_values.reset(new std::pmr::vector<double>(arena));
+            m_ownArena.reset();
+        }
+
+        void clear() {
+            m_values->clear();
+        }
+        void reserve(size_t count) {
+            m_values->reserve(count);
+        }
+        void add(double charge, const char*) {
+            m_values->push_back(charge);
+        }
+        void finish() {}
+
+        size_t size() const {
+            return m_values->size();
+        }
+        double* data() {
+            return m_values->data();
+        }
+        template <typename Function> void forEachRun(Function function) const {
+            if (!m_values->empty()) function(m_values->data(), m_values->size());
+        }
+    private:
+        std::unique_ptr<std::pmr::monotonic_buffer_resource> m_ownArena;
+        std::unique_ptr<std::pmr::vector<double>> m_values;
+    };
+
+    /// Charges in fixed-size chunks, so growing never copies what's already there and no single huge
+    /// allocation is needed. Not contiguous, so only usable through forEachRun.
+    class Chunked {
+    public:
+        static constexpr bool IS_CONTIGUOUS = false;
+        static constexpr bool IS_VIEW = false;
+        static constexpr size_t CHUNK_SIZE = 1 << 16; // Charges per chunk.
+
+        void clear() {
+            m_chunks.clear();
+            m_size = 0;
+        }
+        void reserve(size_t) {}
+        void add(double charge, const char*) {
+            if (m_size % CHUNK_SIZE == 0) m_chunks.emplace_back(new double[CHUNK_SIZE]);
+            m_chunks.back()[m_size % CHUNK_SIZE] = charge;
+            ++m_size;
+        }
+        void finish() {}
+
+        size_t size() const {
+            return m_size;
+        }
+        template <typename Function> void forEachRun(Function function) const {
+            for (size_t i = 0; i < m_chunks.size(); ++i) {
+                function(m_chunks[i].get(), std::min(CHUNK_SIZE, m_size - i * CHUNK_SIZE));
+            }
+        }
+    private:
+        std::vector<std::unique_ptr<double[]>> m_chunks;
+        size_t m_size = 0;
+    };
+
+    /// No charges kept at all, only running statistics over them, so loading takes the same memory however much
+    /// data there is. For streams that might go on for ever. With nothing to visit, there's no forEachRun.
+    class Running {
+    public:
+        static constexpr bool IS_CONTIGUOUS = false;
+        static constexpr bool IS_VIEW = false;
+
+        // Only charges in the range go into the statistics. Everything does unless this is called.
+        void setRange(const DataAnalysis::Range& range) {
+            m_range = range;
+        }
+
+        void clear() {
+            m_accumulator.reset();
+        }
+        void reserve(size_t) {}
+        void add(double charge, const char*) {
+            if (m_range.contains(charge)) m_accumulator.add(charge);
+        }
+        void finish() {}
+
+        size_t size() const {
+            return (size_t)m_accumulator.getCount();
+        }
+        const DataAnalysis::Accumulator& getAccumulator() const {
+            return m_accumulator;
+        }
+    private:
+        DataAnalysis::Accumulator m_accumulator;
+        DataAnalysis::Range m_range;
+    };
+
+    /// Charges left where they are in the source's memory, for binary records from a stable source such as a
+    /// mapped file: nothing is copied, the storage just notes each run of valid records between corrupt ones.
+    class View {
+    public:
+        static constexpr bool IS_CONTIGUOUS = false;
+        static constexpr bool IS_VIEW = true;
+
+        void clear() {
+            m_runs.clear();
+            m_copies.clear();
+            m_keepAlive.reset();
+            m_size = 0;
+        }
+        void reserve(size_t) {}
+        // Keeps the source's memory alive for as long as this refers to it.
+        void setKeepAlive(std::shared_ptr<const void> keepAlive) {
+            m_keepAlive = std::move(keepAlive);
+        }
+        // The record is the charge's bytes in the source, or nullptr if it had to be put together from more
+        // than one block, in which case we keep a copy.
+        void add(double charge, const char* record) {
+            ++m_size;
+            const double* value = reinterpret_cast<const double*>(record);
+            if (record != nullptr && reinterpret_cast<uintptr_t>(record) % alignof(double) == 0) {
+                if (!m_runs.empty() && m_runs.back().values + m_runs.back().count == value) {
+                    ++m_runs.back().count;
+                } else {
+                    m_runs.push_back(Run{ value, 1 });
+                }
+                return;
+            }
+            m_copies.push_back(charge); // A deque, so earlier copies never move.
+            m_runs.push_back(Run{ &m_copies.back(), 1 });
+        }
+        void finish() {}
+
+        size_t size() const {
+            return m_size;
+        }
+        template <typename Function> void forEachRun(Function function) const {
+            for (const Run& run : m_runs) function(run.values, run.count);
+        }
+    private:
+        struct Run {
+            const double* values;
+            size_t        count;
+        };
+        std::vector<Run> m_runs;
+        std::deque<double> m_copies;
+        std::shared_ptr<const void> m_keepAlive;
+        size_t m_size = 0;
+    };
+}
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <iostream>
+#include <algorithm>
+#include <filesystem>
+#include <system_error>
+
+#include "LoaderPolicies.h"
+#include "Queues.h"
+#include "Stats.h"
+#include "Trace.h"
+
+/// Loading one big text file with several threads parsing it at once.
+///
+/// A reader thread cuts the file into chunks at line boundaries and hands them through a lock-free queue to
+/// whichever parser thread is free. The parsed charges come back through another, and are put back together
+/// here in file order, so the charges (and everything worked out from them) come out exactly as they would from
+/// a single thread. Chunks come from a fixed pool and go back to the reader once used, which bounds the memory
+/// in use and holds the reader back when the parsers can't keep up.
+namespace ParallelLoader {
+    static constexpr size_t CHUNK_SIZE = 1 << 20; // Bytes of text per chunk, give or take a line.
+    static constexpr uint64_t MIN_CHUNKS = 4;    // Smaller files aren't worth starting threads for.
+
+    namespace impl {
+        struct Chunk {
+            size_t   index = 0;
+            std::vector<char>   text; // Whole lines only.
+            std::vector<double> charges;
+            uint64_t lines        = 0;
+            unsigned corruptCount = 0;
+        };
+
+        // Cuts the source into chunks of whole lines and queues them for the parsers, in order. Returns the
+        // number of chunks.
+        template <typename Source>
+        size_t read(Source& source, Queues::SpscQueue<Chunk*>& freeChunks, Queues::MpmcQueue<Chunk*>& toParse, uint64_t& bytesRead) {
+            size_t index = 0;
+            Chunk* chunk;
+            freeChunks.pop(chunk);
+            chunk->text.clear();
+
+            const char* data;
+            size_t size;
+            while (source.next(data, size)) {
+                Trace::Scope chunkTrace("read_chunk");
+                bytesRead += size;
+
+                // A mapped source hands over the whole file at once, so fill chunks a slice at a time.
+                while (size > 0) {
+                    size_t room = chunk->text.size() < CHUNK_SIZE ? CHUNK_SIZE - chunk->text.size() : CHUNK_SIZE;
+                    size_t slice = std::min(size, room);
+                    chunk->text.insert(chunk->text.end(), data, data + slice);
+                    data += slice;
+                    size -= slice;
+                    if (chunk->text.size() < CHUNK_SIZE) continue;
+
+                    // Cut after the last newline, carrying the part-line over into the next chunk. A line longer
+                    // than a whole chunk just keeps growing this one.
+                    auto lastNewline = std::find(chunk->text.rbegin(), chunk->text.rend(), '\n');
+                    if (lastNewline == chunk->text.rend()) continue;
+                    size_t cut = (size_t)(chunk->text.rend() - lastNewline);
+
+                    Chunk* nextChunk;
+                    freeChunks.pop(nextChunk);
+                    nextChunk->text.assign(chunk->text.begin() + cut, chunk->text.end());
+                    chunk->text.resize(cut);
+                    chunk->index = index++;
+                    toParse.push(chunk);
+                    chunk = nextChunk;
+                }
+            }
+
+            // Whatever follows the last newline is a last line without an end, which has never counted as a data point.
+            auto lastNewline = std::find(chunk->text.rbegin(), chunk->text.rend(), '\n');
+            chunk->text.resize((size_t)(chunk->text.rend() - lastNewline));
+            if (!chunk->text.empty()) {
+                chunk->index = index++;
+                toParse.push(chunk);
+            }
+            return index;
+        }
+
+        // Parses chunks until handed a nullptr.
+        template <typename Parser>
+        void parse(Queues::MpmcQueue<Chunk*>& toParse, Queues::MpmcQueue<Chunk*>& parsed, const std::string& filepath) {
+            Parser parser;
+            bool isFirstChunk = true;
+            for (;;) {
+                Chunk* chunk;
+                toParse.pop(chunk);
+                if (chunk == nullptr) return;
+
+                Trace::Scope chunkTrace("parse_chunk", "pipeline", filepath.c_str());
+                Stats::ScopedTimer timer(Stats::Phase::PARSE);
+                const char* recordStart = chunk->text.data();
+                const char* const end = recordStart + chunk->text.size();
+
+                // Chunks start on a line, so any chunk will do for a parser that learns the layout from the first.
+                if (isFirstChunk) {
+                    parser.estimateRecordCount(recordStart, chunk->text.size(), 0);
+                    isFirstChunk = false;
+                }
+
+                chunk->charges.clear();
+                chunk->lines = 0;
+                chunk->corruptCount = 0;
+                while (const char* recordEnd = parser.findRecordEnd(recordStart, end)) {
+                    double possibleCharge;
+                    if (parser.parseRecord(recordStart, recordEnd, possibleCharge)) {
+                        chunk->charges.push_back(possibleCharge);
+                    } else {
+                        ++chunk->corruptCount;
+                    }
+                    ++chunk->lines;
+                    recordStart = recordEnd;
+                }
+                parsed.push(chunk);
+            }
+        }
+    }
+
+    // Whether a file's big enough that parsing it on more than one thread pays for starting them.
+    inline bool isWorthwhile(const std::string& filepath) {
+        std::error_code error;
+        uint64_t size = (uint64_t)std::filesystem::file_size(filepath, error);
+        return !error && size >= MIN_CHUNKS * CHUNK_SIZE;
+    }
+
+    // Loads the charges in a file of lines, parsing on parserThreads threads besides a reader thread. Gives the
+    // same charges, in the same order, as loading on one thread would. With dropCache, the file's dropped from the
+    // page cache as it's read. Returns false if the file couldn't be opened.
+    template <typename Source, typename Parser>
+    bool load(const std::string& filepath, unsigned parserThreads, bool reportCorruptPoints, bool dropCache,
+              std::vector<double>& charges, unsigned int& corruptCount) {
+        static_assert(!Parser::RECORDS_ARE_VALUES, "Chunks are cut at newlines, so only parsers of lines will do");
+
+        Source source;
+        source.setDropCache(dropCache);
+        {
+            Stats::ScopedTimer timer(Stats::Phase::OPEN);
+            if (!source.open(filepath)) return false;
+        }
+        parserThreads = std::max(parserThreads, 1u);
+
+        // Two chunks per parser keeps each busy while the next is read, plus one being read and one being merged.
+        const size_t chunkCount = (size_t)parserThreads * 2 + 2;
+        std::vector<std::unique_ptr<impl::Chunk>> chunks(chunkCount);
+        Queues::SpscQueue<impl::Chunk*> freeChunks(chunkCount);
+        Queues::MpmcQueue<impl::Chunk*> toParse(chunkCount + parserThreads); // Room for the chunks and a nullptr per parser.
+        Queues::MpmcQueue<impl::Chunk*> parsed(chunkCount);
+        for (std::unique_ptr<impl::Chunk>& chunk : chunks) {
+            chunk.reset(new impl::Chunk());
+            chunk->text.reserve(CHUNK_SIZE + CHUNK_SIZE / 16);
+            freeChunks.push(chunk.get());
+        }
+
+        std::atomic<size_t> totalChunks{ SIZE_MAX }; // Until the reader's got to the end.
+        uint64_t bytesRead = 0;
+        std::thread reader([&]() {
+            totalChunks.store(impl::read(source, freeChunks, toParse, bytesRead), std::memory_order_release);
+            for (unsigned i = 0; i < parserThreads; ++i) {
+                toParse.push(nullptr);
+            }
+        });
+        std::vector<std::thread> parsers;
+        for (unsigned i = 0; i < parserThreads; ++i) {
+            parsers.emplace_back([&]() { impl::parse<Parser>(toParse, parsed, filepath); });
+        }
+
+        // Chunks can come back out of order, but never more than chunkCount apart, so each has its own slot
+        // until its turn comes.
+        charges.clear();
+        corruptCount = 0;
+        uint64_t lines = 0;
+        std::vector<impl::Chunk*> waiting(chunkCount, nullptr);
+        size_t next = 0;
+        Queues::Backoff backoff;
+        while (next < totalChunks.load(std::memory_order_acquire)) {
+            impl::Chunk* chunk;
+            if (parsed.tryPop(chunk)) {
+                waiting[chunk->index % chunkCount] = chunk;
+                backoff.reset();
+            } else if (waiting[next % chunkCount] == nullptr) {
+                backoff.pause();
+                continue;
+            }
+
+            while ((chunk = waiting[next % chunkCount]) != nullptr) {
+                if (next == 0) {
+                    // Size the charges from the first chunk, errring a little high.
+                    double chargesPerByte = (double)chunk->charges.size() / (double)std::max<size_t>(chunk->text.size(), 1);
+                    charges.reserve((size_t)((double)source.getSize() * chargesPerByte * 1.05) + 16);
+                }
+                charges.insert(charges.end(), chunk->charges.begin(), chunk->charges.end());
+                lines += chunk->lines;
+                corruptCount += chunk->corruptCount;
+                if (reportCorruptPoints) {
+                    for (unsigned i = 0; i < chunk->corruptCount; ++i) {
+                        std::cerr << "File: " << filepath << " has a corrupt data point." << std::endl
+                                  << "Skipping that data point." << std::endl;
+                    }
+                }
+
+                waiting[next % chunkCount] = nullptr;
+                freeChunks.push(chunk);
+                ++next;
+            }
+        }
+
+        reader.join();
+        for (std::thread& parser : parsers) {
+            parser.join();
+        }
+        const bool isFailed = source.isFailed();
+        source.close();
+        if (isFailed) return false;
+
+        Stats::add(Stats::Counter::BYTES_READ, bytesRead);
+        Stats::add(Stats::Counter::LINES, lines);
+        Stats::add(Stats::Counter::CORRUPT_POINTS, corruptCount);
+        return true;
+    }
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define QUEUES_HAS_PAUSE
+#endif
+
+/// Bounded lock-free queues for handing work between threads without a mutex in the way.
+///
+/// Both have a fixed capacity (rounded up to a power of two) and never allocate after construction. tryPush
+/// and tryPop give up straight away when the queue is full or empty; push and pop wait, spinning briefly and
+/// then backing off, which is what puts backpressure on a producer that's getting ahead of its consumers.
+namespace Queues {
+    // Keeps the producer's and consumer's sides of a queue on separate cache lines, so they don't fight over one.
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    /// Waiting that starts out as a busy spin, for when the other side is only a moment away, and turns into
+    /// yielding and then sleeping, so a thread stuck behind a slow stage doesn't burn a core.
+    class Backoff {
+    public:
+        void pause() {
+            if (m_count < SPIN_LIMIT) {
+#if defined(QUEUES_HAS_PAUSE)
+                _mm_pause();
+#endif
+            } else if (m_count < YIELD_LIMIT) {
+                std::this_thread::yield();
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+            if (m_count < YIELD_LIMIT) ++m_count;
+        }
+        void reset() {
+            m_count = 0;
+        }
+    private:
+        static constexpr unsigned SPIN_LIMIT  = 64;
+        static constexpr unsigned YIELD_LIMIT = 128;
+        unsigned m_count = 0;
+    };
+
+    inline size_t roundUpToPowerOfTwo(size_t value) {
+        size_t power = 1;
+        while (power < value) power <<= 1;
+        return power;
+    }
+
+    /// For exactly one thread pushing and one thread popping. Each side only ever writes its own index, and keeps
+    /// a cached copy of the other side's so it only has to look at the other cache line when it seems full or empty.
+    template <typename T>
+    class SpscQueue {
+    public:
+        explicit SpscQueue(size_t capacity) :
+            m_mask(roundUpToPowerOfTwo(capacity < 2 ? 2 : capacity) - 1),
+            m_slots(new T[m_mask + 1]) {}
+
+        SpscQueue(const SpscQueue&) = delete;
+        SpscQueue& operator=(const SpscQueue&) = delete;
+
+        size_t getCapacity() const {
+            return m_mask + 1;
+        }
+
+        // Producer only. Only moves from value if it went in.
+        bool tryPush(T&& value) {
+            size_t tail = m_tail.load(std::memory_order_relaxed);
+            if (tail - m_cachedHead > m_mask) {
+                m_cachedHead = m_head.load(std::memory_order_acquire);
+                if (tail - m_cachedHead > m_mask) return false;
+            }
+            m_slots[tail & m_mask] = std::move(value);
+            m_tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+        void push(T value) {
+            Backoff backoff;
+            while (!tryPush(std::move(value))) backoff.pause();
+        }
+
+        // Consumer only.
+        bool tryPop(T& value) {
+            size_t head = m_head.load(std::memory_order_relaxed);
+            if (head == m_cachedTail) {
+                m_cachedTail = m_tail.load(std::memory_order_acquire);
+                if (head == m_cachedTail) return false;
+            }
+            value = std::move(m_slots[head & m_mask]);
+            m_head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+        void pop(T& value) {
+            Backoff backoff;
+            while (!tryPop(value)) backoff.pause();
+        }
+    private:
+        const size_t m_mask;
+        std::unique_ptr<T[]> m_slots;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_head{ 0 }; // Next slot to pop, written by the consumer.
+        size_t m_cachedTail = 0;                                  // The consumer's last look at m_tail.
+
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_tail{ 0 }; // Next slot to push, written by the producer.
+        size_t m_cachedHead = 0;                                  // The producer's last look at m_head.
+    };
+
+    /// For any number of threads pushing and popping (Dmitry Vyukov's bounded queue). Each slot carries a
+    /// sequence number saying whose turn it is, so a push or pop costs one compare-and-swap on the shared index
+    /// when uncontended, and the slot itself is handed over without any lock.
+    template <typename T>
+    class MpmcQueue {
+    public:
+        explicit MpmcQueue(size_t capacity) :
+            m_mask(roundUpToPowerOfTwo(capacity < 2 ? 2 : capacity) - 1),
+            m_cells(new Cell[m_mask + 1]) {
+            for (size_t i = 0; i <= m_mask; ++i) {
+                m_cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpmcQueue(const MpmcQueue&) = delete;
+        MpmcQueue& operator=(const MpmcQueue&) = delete;
+
+        size_t getCapacity() const {
+            return m_mask + 1;
+        }
+
+        // Only moves from value if it went in.
+        bool tryPush(T&& value) {
+            Cell* cell;
+            size_t position = m_enqueuePosition.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &m_cells[position & m_mask];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+                if (difference == 0) {
+                    // The slot's free for this position, claim it.
+                    if (m_enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+                } else if (difference < 0) {
+                    return false; // Full, the slot still holds a value from a lap ago.
+                } else {
+                    position = m_enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+            cell->value = std::move(value);
+            cell->sequence.store(position + 1, std::memory_order_release);
+            return true;
+        }
+        void push(T value) {
+            Backoff backoff;
+            while (!tryPush(std::move(value))) backoff.pause();
+        }
+
+        bool tryPop(T& value) {
+            Cell* cell;
+            size_t position = m_dequeuePosition.load(std::memory_order_relaxed);
+            for (;;) {
+                cell = &m_cells[position & m_mask];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t difference = (intptr_t)sequence - (intptr_t)(position + 1);
+                if (difference == 0) {
+                    if (m_dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) break;
+                } else if (difference < 0) {
+                    return false; // Empty, nothing's been pushed into this slot yet.
+                } else {
+                    position = m_dequeuePosition.load(std::memory_order_relaxed);
+                }
+            }
+            value = std::move(cell->value);
+            // Free the slot for the push one lap on.
+            cell->sequence.store(position + m_mask + 1, std::memory_order_release);
+            return true;
+        }
+        void pop(T& value) {
+            Backoff backoff;
+            while (!tryPop(value)) backoff.pause();
+        }
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        const size_t m_mask;
+        std::unique_ptr<Cell[]> m_cells;
+
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_enqueuePosition{ 0 };
+        alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_dequeuePosition{ 0 };
+    };
+}
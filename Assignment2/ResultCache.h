@@ -0,0 +1,153 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <system_error>
+
+#include "DataAnalysis.h"
+#include "Files.h"
+#include "Hash.h"
+
+/// On-disk cache of analysis results, so identical files don't get parsed over and over again.
+///
+/// Results are keyed on a hash of the file's contents together with a hash of the analysis options. To save even
+/// hashing the file, we also remember the content hash of each path along with the size and modification time the
+/// file had when we hashed it; if neither has changed since, we trust the remembered hash.
+class ResultCache {
+public:
+    /// Identifies a cached result.
+    struct Key {
+        bool     isValid     = false; // Whether the file could be hashed at all.
+        uint64_t contentHash = 0;
+        uint64_t optionsHash = 0;
+    };
+
+    void init(std::string directory = ".chargecache") {
+        m_directory = directory;
+
+        std::error_code error;
+        std::filesystem::create_directories(m_directory + "/paths", error);
+        m_isUsable = !error;
+    }
+
+    bool isUsable() const {
+        return m_isUsable;
+    }
+
+    // Looks up the result for the file analysed with the given options. Returns true on a hit.
+    // The key is filled in whenever the file could be read, so a miss can be stored afterwards without hashing again.
+    bool lookup(const std::string& filepath, uint64_t optionsHash, DataAnalysis::Summary& summary, Key& key) {
+        key = Key();
+        if (!m_isUsable) return false;
+        if (!getContentHash(filepath, key.contentHash)) return false;
+        key.isValid     = true;
+        key.optionsHash = optionsHash;
+
+        std::ifstream in(getResultPath(key), std::ios::in | std::ios::binary);
+        if (!in.is_open()) return false;
+
+        uint32_t magic = 0, version = 0;
+        in.read(reinterpret_cast<char*>(&magic),   sizeof(magic));
+        in.read(reinterpret_cast<char*>(&version), sizeof(version));
+        if (!in || magic != RESULT_MAGIC || version != RESULT_VERSION) return false;
+
+        in.read(reinterpret_cast<char*>(&summary), sizeof(summary));
+        return (bool)in;
+    }
+
+    // Stores the result under a key filled in by an earlier lookup.
+    void store(const Key& key, const DataAnalysis::Summary& summary) {
+        if (!m_isUsable || !key.isValid) return;
+
+        Files::writeFileAtomically(getResultPath(key), [&](std::ostream& out) {
+            out.write(reinterpret_cast<const char*>(&RESULT_MAGIC),   sizeof(RESULT_MAGIC));
+            out.write(reinterpret_cast<const char*>(&RESULT_VERSION), sizeof(RESULT_VERSION));
+            out.write(reinterpret_cast<const char*>(&summary),        sizeof(summary));
+        });
+    }
+
+    // Hashes an entire file's contents. Returns false if the file couldn't be read.
+    static bool hashFile(const std::string& filepath, uint64_t& hash) {
+        std::ifstream file;
+        // We read in big blocks straight into our own buffer, going through the stream's buffer too would only
+        // add a copy and keep us from getting near memory bandwidth.
+        file.rdbuf()->pubsetbuf(nullptr, 0);
+        file.open(filepath, std::ios::in | std::ios::binary);
+        if (!file.is_open()) return false;
+
+        std::vector<char> buffer(HASH_BLOCK_SIZE);
+        Hash::Hasher hasher;
+        while (file.read(buffer.data(), buffer.size()) || file.gcount() > 0) {
+            hasher.update(buffer.data(), (size_t)file.gcount());
+        }
+
+        hash = hasher.digest();
+        return file.eof();
+    }
+private:
+    static constexpr uint32_t RESULT_MAGIC    = 0x52414843; // "CHAR" when read as little-endian bytes.
+    static constexpr uint32_t RESULT_VERSION  = 2;
+    static constexpr size_t   HASH_BLOCK_SIZE = 1 << 22;
+
+    /// What we remember about a path from the last time its contents were hashed.
+    struct PathEntry {
+        uint64_t size;
+        int64_t  modifiedTime;
+        uint64_t contentHash;
+    };
+
+    static std::string toHex(uint64_t value) {
+        char buffer[17];
+        std::snprintf(buffer, sizeof(buffer), "%016llx", (unsigned long long)value);
+        return buffer;
+    }
+
+    std::string getResultPath(const Key& key) const {
+        return m_directory + "/" + toHex(key.contentHash) + "-" + toHex(key.optionsHash) + ".result";
+    }
+    std::string getPathEntryPath(const std::filesystem::path& filepath) const {
+        std::string key = filepath.string();
+        return m_directory + "/paths/" + toHex(Hash::compute(key.data(), key.size())) + ".path";
+    }
+
+    // Gets the content hash for a file, using the remembered one if the file looks untouched since.
+    bool getContentHash(const std::string& filepath, uint64_t& contentHash) {
+        std::error_code error;
+        std::filesystem::path absolutePath = std::filesystem::absolute(filepath, error);
+        if (error) return false;
+
+        PathEntry current;
+        current.size = (uint64_t)std::filesystem::file_size(absolutePath, error);
+        if (error) return false;
+        current.modifiedTime = (int64_t)std::filesystem::last_write_time(absolutePath, error).time_since_epoch().count();
+        if (error) return false;
+
+        std::string entryPath = getPathEntryPath(absolutePath);
+
+        // Fast path, we've seen this exact file before.
+        PathEntry remembered;
+        std::ifstream in(entryPath, std::ios::in | std::ios::binary);
+        if (in.read(reinterpret_cast<char*>(&remembered), sizeof(remembered))
+                && remembered.size == current.size
+                && remembered.modifiedTime == current.modifiedTime) {
+            contentHash = remembered.contentHash;
+            return true;
+        }
+        in.close();
+
+        if (!hashFile(filepath, current.contentHash)) return false;
+        contentHash = current.contentHash;
+
+        Files::writeFileAtomically(entryPath, [&](std::ostream& out) {
+            out.write(reinterpret_cast<const char*>(&current), sizeof(current));
+        });
+        return true;
+    }
+
+    std::string m_directory;
+    bool m_isUsable = false;
+};
@@ -0,0 +1,306 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include <ostream>
+#include <charconv>
+
+#include "DataAnalysis.h"
+#include "Analyser.h"
+
+/// Buffers up output and hands it to a stream in large blocks, rather than flushing every line.
+class OutputBuffer {
+public:
+    OutputBuffer(std::ostream& out, size_t capacity = 1 << 16) :
+        m_out(out) {
+        m_buffer.reserve(capacity);
+        m_capacity = capacity;
+    }
+    ~OutputBuffer() {
+        flush();
+    }
+
+    void append(const char* data, size_t length) {
+        if (m_buffer.size() + length > m_capacity) {
+            flush();
+            // Too big to be worth buffering.
+            if (length > m_capacity) {
+                m_out.write(data, length);
+                return;
+            }
+        }
+        m_buffer.append(data, length);
+    }
+    void append(const std::string& s) {
+        append(s.data(), s.size());
+    }
+    void append(const char* s) {
+        append(s, std::strlen(s));
+    }
+    void append(char c) {
+        if (m_buffer.size() + 1 > m_capacity) flush();
+        m_buffer.push_back(c);
+    }
+
+    // Appends a double in the shortest form that reads back to exactly the same value.
+    void appendDouble(double value) {
+        char digits[32];
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        append(digits, (size_t)(result.ptr - digits));
+#else
+        // No floating point to_chars in this standard library, 17 significant digits always round-trips.
+        int length = std::snprintf(digits, sizeof(digits), "%.17g", value);
+        append(digits, (size_t)length);
+#endif
+    }
+    // Appends a double the same way iostreams would by default, for human-readable output.
+    void appendDoubleShort(double value) {
+        char digits[32];
+        int length = std::snprintf(digits, sizeof(digits), "%g", value);
+        append(digits, (size_t)length);
+    }
+    void appendInteger(uint64_t value) {
+        char digits[24];
+        auto result = std::to_chars(digits, digits + sizeof(digits), value);
+        append(digits, (size_t)(result.ptr - digits));
+    }
+
+    void flush() {
+        if (!m_buffer.empty()) {
+            m_out.write(m_buffer.data(), m_buffer.size());
+            m_buffer.clear();
+        }
+        m_out.flush();
+    }
+private:
+    std::ostream& m_out;
+    std::string   m_buffer;
+    size_t        m_capacity;
+};
+
+/// Somewhere for the results of analysing files to go.
+class ResultSink {
+public:
+    ResultSink(std::ostream& out) :
+        m_buffer(out) {
+        // Empty.
+    }
+    virtual ~ResultSink() {}
+
+    virtual void writeResult(const std::string& file, const DataAnalysis::Summary& summary, Analyser::Route route) = 0;
+    virtual void writeFailure(const std::string& file, const std::string& reason) = 0;
+
+    void flush() {
+        m_buffer.flush();
+    }
+protected:
+    static const char* getRouteName(Analyser::Route route) {
+        switch (route) {
+            case Analyser::Route::CACHED:  return "cached";
+            case Analyser::Route::RESUMED: return "resumed";
+            default:                       return "loaded";
+        }
+    }
+
+    OutputBuffer m_buffer;
+};
+
+/// The human-readable report, as written by the interactive mode.
+class TextResultSink : public ResultSink {
+public:
+    TextResultSink(std::ostream& out) :
+        ResultSink(out) {
+        // Empty.
+    }
+
+    virtual void writeResult(const std::string& file, const DataAnalysis::Summary& summary, Analyser::Route route) override {
+        m_buffer.append("File read from: ");
+        m_buffer.append(file);
+        m_buffer.append('\n');
+        if (route == Analyser::Route::CACHED) {
+            m_buffer.append("    (Result taken from cache.)\n");
+        } else if (route == Analyser::Route::RESUMED) {
+            m_buffer.append("    (Resumed from saved analysis state.)\n");
+        }
+        m_buffer.append("    The computed mean is:\n        (");
+        m_buffer.appendDoubleShort(summary.mean);
+        m_buffer.append(" +/- ");
+        m_buffer.appendDoubleShort(summary.standardErrorInTheMean);
+        m_buffer.append(")C\n    The computed standard deviation is:\n        ");
+        m_buffer.appendDoubleShort(summary.standardDeviation);
+        m_buffer.append("C\n");
+        if (summary.corruptCount > 0) {
+            m_buffer.append("    Skipped ");
+            m_buffer.appendInteger(summary.corruptCount);
+            m_buffer.append(" corrupt data point(s).\n");
+        }
+    }
+    virtual void writeFailure(const std::string&, const std::string&) override {
+        // Failures are reported on stderr for people, nothing to add to the report itself.
+    }
+};
+
+/// Comma-separated values with a header row, quoting file names where needed.
+class CsvResultSink : public ResultSink {
+public:
+    CsvResultSink(std::ostream& out) :
+        ResultSink(out) {
+        m_buffer.append("file,status,count,mean,standard_deviation,standard_error_in_the_mean,corrupt_count,error\n");
+    }
+
+    virtual void writeResult(const std::string& file, const DataAnalysis::Summary& summary, Analyser::Route route) override {
+        appendField(file);
+        m_buffer.append(',');
+        m_buffer.append(getRouteName(route));
+        m_buffer.append(',');
+        m_buffer.appendInteger(summary.count);
+        m_buffer.append(',');
+        m_buffer.appendDouble(summary.mean);
+        m_buffer.append(',');
+        m_buffer.appendDouble(summary.standardDeviation);
+        m_buffer.append(',');
+        m_buffer.appendDouble(summary.standardErrorInTheMean);
+        m_buffer.append(',');
+        m_buffer.appendInteger(summary.corruptCount);
+        m_buffer.append(",\n");
+    }
+    virtual void writeFailure(const std::string& file, const std::string& reason) override {
+        appendField(file);
+        m_buffer.append(",failed,,,,,,");
+        appendField(reason);
+        m_buffer.append('\n');
+    }
+private:
+    void appendField(const std::string& field) {
+        if (field.find_first_of(",\"\r\n") == std::string::npos) {
+            m_buffer.append(field);
+            return;
+        }
+
+        m_buffer.append('"');
+        for (char c : field) {
+            if (c == '"') m_buffer.append('"');
+            m_buffer.append(c);
+        }
+        m_buffer.append('"');
+    }
+};
+
+/// One JSON object per line.
+class JsonLinesResultSink : public ResultSink {
+public:
+    JsonLinesResultSink(std::ostream& out) :
+        ResultSink(out) {
+        // Empty.
+    }
+
+    virtual void writeResult(const std::string& file, const DataAnalysis::Summary& summary, Analyser::Route route) override {
+        m_buffer.append("{\"file\":");
+        appendString(file);
+        m_buffer.append(",\"status\":\"");
+        m_buffer.append(getRouteName(route));
+        m_buffer.append("\",\"count\":");
+        m_buffer.appendInteger(summary.count);
+        m_buffer.append(",\"mean\":");
+        appendNumber(summary.mean);
+        m_buffer.append(",\"standard_deviation\":");
+        appendNumber(summary.standardDeviation);
+        m_buffer.append(",\"standard_error_in_the_mean\":");
+        appendNumber(summary.standardErrorInTheMean);
+        m_buffer.append(",\"corrupt_count\":");
+        m_buffer.appendInteger(summary.corruptCount);
+        m_buffer.append("}\n");
+    }
+    virtual void writeFailure(const std::string& file, const std::string& reason) override {
+        m_buffer.append("{\"file\":");
+        appendString(file);
+        m_buffer.append(",\"status\":\"failed\",\"error\":");
+        appendString(reason);
+        m_buffer.append("}\n");
+    }
+private:
+    void appendString(const std::string& s) {
+        m_buffer.append('"');
+        for (char c : s) {
+            switch (c) {
+                case '"':  m_buffer.append("\\\""); break;
+                case '\\': m_buffer.append("\\\\"); break;
+                case '\n': m_buffer.append("\\n");  break;
+                case '\r': m_buffer.append("\\r");  break;
+                case '\t': m_buffer.append("\\t");  break;
+                default:
+                    if ((unsigned char)c < 0x20) {
+                        char escaped[8];
+                        std::snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned int)c);
+                        m_buffer.append(escaped);
+                    } else {
+                        m_buffer.append(c);
+                    }
+            }
+        }
+        m_buffer.append('"');
+    }
+    void appendNumber(double value) {
+        // JSON has no way to spell NaN or infinity.
+        if (!std::isfinite(value)) {
+            m_buffer.append("null");
+            return;
+        }
+        m_buffer.appendDouble(value);
+    }
+};
+
+/// Packed binary records, for when whatever reads the results is a program too.
+///
+/// The stream starts with the magic "CHRB" and a uint32 version, followed by one record per file, all little-endian:
+///     uint32 file name length, file name bytes, uint8 status (0 loaded, 1 resumed, 2 cached, 3 failed),
+///     then for everything but failures: uint64 count, double mean, double standard deviation,
+///     double standard error in the mean, uint64 corrupt count.
+class BinaryResultSink : public ResultSink {
+public:
+    static constexpr uint32_t VERSION = 1;
+
+    BinaryResultSink(std::ostream& out) :
+        ResultSink(out) {
+        m_buffer.append("CHRB", 4);
+        appendRaw(VERSION);
+    }
+
+    virtual void writeResult(const std::string& file, const DataAnalysis::Summary& summary, Analyser::Route route) override {
+        appendName(file);
+        appendRaw((uint8_t)(route == Analyser::Route::CACHED ? 2 : route == Analyser::Route::RESUMED ? 1 : 0));
+        appendRaw(summary.count);
+        appendRaw(summary.mean);
+        appendRaw(summary.standardDeviation);
+        appendRaw(summary.standardErrorInTheMean);
+        appendRaw(summary.corruptCount);
+    }
+    virtual void writeFailure(const std::string& file, const std::string&) override {
+        appendName(file);
+        appendRaw((uint8_t)3);
+    }
+private:
+    template <typename T>
+    void appendRaw(T value) {
+        m_buffer.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+    void appendName(const std::string& file) {
+        appendRaw((uint32_t)file.size());
+        m_buffer.append(file);
+    }
+};
+
+// Makes a sink for the named format (text, csv, jsonl or binary), or nullptr if we don't know the format.
+inline std::unique_ptr<ResultSink> createResultSink(const std::string& format, std::ostream& out) {
+    if (format == "text")   return std::unique_ptr<ResultSink>(new TextResultSink(out));
+    if (format == "csv")    return std::unique_ptr<ResultSink>(new CsvResultSink(out));
+    if (format == "jsonl")  return std::unique_ptr<ResultSink>(new JsonLinesResultSink(out));
+    if (format == "binary") return std::unique_ptr<ResultSink>(new BinaryResultSink(out));
+    return nullptr;
+}
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "Queues.h"
+
+/// A ring buffer of charges in POSIX shared memory, for taking them straight from a live acquisition process
+/// instead of having it write a file for us to read back.
+///
+/// One producer process writes and one consumer reads. Each side only ever writes its own sequence counter (how
+/// many charges it has written or read so far), so neither ever takes a lock, and the producer waits for room
+/// rather than overwriting charges the consumer hasn't got to. The producer marks the ring finished when it's
+/// done. The consumer treats it as finished too if the producer dies without saying so.
+///
+/// Consumer has the interface of a source (see LoaderPolicies.h) over the charges as raw doubles, so
+/// BasicChargeDataModel<SharedRing::Consumer, RecordParsers::Binary, ...> loads from a ring just as from a
+/// binary file. It can't rewind, so getLineCount won't work on it. Not available on Windows.
+namespace SharedRing {
+    static constexpr uint32_t MAGIC   = 0x474E4952; // "RING" when read as little-endian bytes.
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint64_t DEFAULT_CAPACITY = 1 << 20; // Charges, 8 MiB of them.
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+                  "Counters shared between processes have to be lock-free");
+
+    namespace impl {
+        /// The start of the shared memory, followed by the charges themselves.
+        struct Header {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t capacity;     // Charges the ring holds, a power of two.
+            int64_t  producerId;   // Process id of the producer, for noticing if it's gone.
+
+            alignas(Queues::CACHE_LINE_SIZE) std::atomic<uint64_t> written; // Charges written so far, by the producer.
+            std::atomic<uint32_t> isFinished;                               // Set by the producer once it's written its last.
+
+            alignas(Queues::CACHE_LINE_SIZE) std::atomic<uint64_t> read;    // Charges read so far, by the consumer.
+        };
+
+        inline size_t getRegionSize(uint64_t capacity) {
+            return sizeof(Header) + (size_t)capacity * sizeof(double);
+        }
+
+        // Shared memory names need a leading slash, which is easy to forget on the command line.
+        inline std::string getSharedName(const std::string& name) {
+            return !name.empty() && name[0] == '/' ? name : "/" + name;
+        }
+
+        inline double* getCharges(Header* header) {
+            return reinterpret_cast<double*>(reinterpret_cast<char*>(header) + sizeof(Header));
+        }
+    }
+
+    /// The writing end. Creates the ring, and removes its name again when closed, though a consumer already
+    /// attached keeps its mapping until it's done.
+    class Producer {
+    public:
+        ~Producer() {
+            close();
+        }
+
+        // Creates the named ring with room for capacity charges (rounded up to a power of two), replacing any
+        // ring left behind under the same name. Returns false if it couldn't be created.
+        bool create(const std::string& name, uint64_t capacity = DEFAULT_CAPACITY) {
+            close();
+#if defined(_WIN32)
+            (void)name; (void)capacity;
+            return false;
+#else
+            m_name = impl::getSharedName(name);
+            capacity = Queues::roundUpToPowerOfTwo((size_t)std::max<uint64_t>(capacity, 2));
+            m_size = impl::getRegionSize(capacity);
+
+            shm_unlink(m_name.c_str());
+            int descriptor = shm_open(m_name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+            if (descriptor < 0) return false;
+            if (ftruncate(descriptor, (off_t)m_size) != 0) {
+                ::close(descriptor);
+                shm_unlink(m_name.c_str());
+                return false;
+            }
+            void* address = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+            ::close(descriptor);
+            if (address == MAP_FAILED) {
+                shm_unlink(m_name.c_str());
+                return false;
+            }
+
+            // The memory starts out zeroed, which leaves the counters at zero. The magic goes in last, so a
+            // consumer never attaches to a header that's only half there.
+            m_header = static_cast<impl::Header*>(address);
+            m_header->version    = VERSION;
+            m_header->capacity   = capacity;
+            m_header->producerId = (int64_t)getpid();
+            std::atomic_thread_fence(std::memory_order_release);
+            m_header->magic = MAGIC;
+            m_charges = impl::getCharges(m_header);
+            m_mask = capacity - 1;
+            m_written = 0;
+            return true;
+#endif
+        }
+        void close() {
+#if !defined(_WIN32)
+            if (m_header == nullptr) return;
+            finish();
+            munmap(m_header, m_size);
+            shm_unlink(m_name.c_str());
+            m_header = nullptr;
+#endif
+        }
+        bool isOpen() const {
+            return m_header != nullptr;
+        }
+
+        // Writes as many of the charges as there's room for without waiting, returning how many that was.
+        size_t tryWrite(const double* charges, size_t count) {
+            uint64_t read = m_header->read.load(std::memory_order_acquire);
+            uint64_t room = m_mask + 1 - (m_written - read);
+            count = (size_t)std::min<uint64_t>(count, room);
+
+            // In up to two pieces, either side of the end of the ring.
+            size_t start = (size_t)(m_written & m_mask);
+            size_t first = std::min<size_t>(count, (size_t)(m_mask + 1) - start);
+            std::memcpy(m_charges + start, charges, first * sizeof(double));
+            std::memcpy(m_charges, charges + first, (count - first) * sizeof(double));
+
+            m_written += count;
+            m_header->written.store(m_written, std::memory_order_release);
+            return count;
+        }
+        // Writes all of the charges, waiting for the consumer to make room as need be.
+        void write(const double* charges, size_t count) {
+            Queues::Backoff backoff;
+            while (count > 0) {
+                size_t done = tryWrite(charges, count);
+                charges += done;
+                count -= done;
+                if (done > 0) {
+                    backoff.reset();
+                } else {
+                    backoff.pause();
+                }
+            }
+        }
+
+        // Tells the consumer there are no more charges to come.
+        void finish() {
+            m_header->isFinished.store(1, std::memory_order_release);
+        }
+        // Waits for a consumer to read everything written, so closing doesn't take the ring away before one's
+        // even attached.
+        void waitUntilRead() {
+            Queues::Backoff backoff;
+            while (m_header->read.load(std::memory_order_acquire) < m_written) backoff.pause();
+        }
+
+        uint64_t getWrittenCount() const {
+            return m_written;
+        }
+    private:
+        impl::Header* m_header = nullptr;
+        double*  m_charges = nullptr;
+        size_t   m_size    = 0;
+        uint64_t m_mask    = 0;
+        uint64_t m_written = 0; // Our own copy of the written counter.
+        std::string m_name;
+    };
+
+    /// The reading end. Hands the charges over as blocks of raw doubles straight out of the ring, each only
+    /// valid until the next, which is when its slots go back to the producer.
+    class Consumer {
+    public:
+        static constexpr bool IS_STABLE = false;
+        static constexpr size_t MAX_BLOCK_CHARGES = 1 << 16; // So the producer gets room back a bit at a time.
+
+        ~Consumer() {
+            close();
+        }
+
+        // Attaches to the named ring. Returns false if there isn't one, or it isn't one we understand.
+        bool open(const std::string& name) {
+            close();
+#if defined(_WIN32)
+            (void)name;
+            return false;
+#else
+            int descriptor = shm_open(impl::getSharedName(name).c_str(), O_RDWR, 0);
+            if (descriptor < 0) return false;
+
+            struct stat status;
+            void* address = MAP_FAILED;
+            if (fstat(descriptor, &status) == 0 && (size_t)status.st_size >= sizeof(impl::Header)) {
+                address = mmap(nullptr, (size_t)status.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+            }
+            ::close(descriptor);
+            if (address == MAP_FAILED) return false;
+
+            m_header = static_cast<impl::Header*>(address);
+            m_size = (size_t)status.st_size;
+            uint64_t capacity = m_header->capacity;
+            if (m_header->magic != MAGIC || m_header->version != VERSION || capacity == 0 || (capacity & (capacity - 1)) != 0
+                || impl::getRegionSize(capacity) > m_size) {
+                close();
+                return false;
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            m_charges = impl::getCharges(m_header);
+            m_mask = capacity - 1;
+            m_read = m_header->read.load(std::memory_order_relaxed); // Picks up where a last consumer left off.
+            m_pending = 0;
+            m_isProducerGone = false;
+            return true;
+#endif
+        }
+        void close() {
+#if !defined(_WIN32)
+            if (m_header == nullptr) return;
+            release();
+            munmap(m_header, m_size);
+            m_header = nullptr;
+#endif
+        }
+        bool isOpen() const {
+            return m_header != nullptr;
+        }
+        uint64_t getSize() const {
+            return 0; // Unknown until the producer's finished.
+        }
+
+        // Waits for the next block of charges, false once the producer's finished and everything's been read.
+        bool next(const char*& data, size_t& size) {
+            release();
+
+            Queues::Backoff backoff;
+            unsigned idlePauses = 0;
+            for (;;) {
+                uint64_t written = m_header->written.load(std::memory_order_acquire);
+                if (written != m_read) {
+                    size_t start = (size_t)(m_read & m_mask);
+                    m_pending = (size_t)std::min<uint64_t>({ written - m_read, m_mask + 1 - start, MAX_BLOCK_CHARGES });
+                    data = reinterpret_cast<const char*>(m_charges + start);
+                    size = m_pending * sizeof(double);
+                    return true;
+                }
+
+                if (m_header->isFinished.load(std::memory_order_acquire)) {
+                    // Anything written before finishing is visible now, so look once more.
+                    if (m_header->written.load(std::memory_order_acquire) == m_read) return false;
+                    continue;
+                }
+                // Every so often while waiting, make sure there's still a producer to wait for.
+                if (++idlePauses % PRODUCER_CHECK_INTERVAL == 0 && !isProducerAlive()) {
+                    m_isProducerGone = true;
+                    return false;
+                }
+                backoff.pause();
+            }
+        }
+        // A producer going away isn't an error, what it wrote is still good (see isProducerGone).
+        bool isFailed() const {
+            return false;
+        }
+        void rewind() {}
+
+        // Whether reading stopped because the producer went away without finishing.
+        bool isProducerGone() const {
+            return m_isProducerGone;
+        }
+        // Charges read so far, including any read by an earlier consumer of the same ring.
+        uint64_t getReadCount() const {
+            return m_read + m_pending;
+        }
+    private:
+        static constexpr unsigned PRODUCER_CHECK_INTERVAL = 2048; // Pauses, roughly a tenth of a second once sleeping.
+
+        // Gives the slots of the last block back to the producer.
+        void release() {
+            if (m_pending == 0) return;
+            m_read += m_pending;
+            m_pending = 0;
+            m_header->read.store(m_read, std::memory_order_release);
+        }
+
+        bool isProducerAlive() const {
+#if defined(_WIN32)
+            return false;
+#else
+            return kill((pid_t)m_header->producerId, 0) == 0 || errno != ESRCH;
+#endif
+        }
+
+        impl::Header* m_header = nullptr;
+        const double* m_charges = nullptr;
+        size_t   m_size    = 0;
+        uint64_t m_mask    = 0;
+        uint64_t m_read    = 0; // Our own copy of the read counter, not counting the block handed out.
+        size_t   m_pending = 0; // Charges in the block last handed out.
+        bool m_isProducerGone = false;
+    };
+}
@@ -0,0 +1,298 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+#include "Trace.h"
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+/// Lightweight timing and counting of what the program spends its time on, for working out which phase got
+/// slower without needing a profiler to hand.
+///
+/// Everything is off until enable is called, at which point each phase records how many times it ran and for how
+/// long, and the counters start counting. While off, a timer costs a single relaxed load.
+///
+/// Allocations (counted when AllocationHooks.h is part of the program and enabled) are put down to whichever phase
+/// the allocating thread is in, so a phase that starts allocating per line stands out.
+namespace Stats {
+    enum class Phase {
+        OPEN,
+        CACHE_LOOKUP,
+        LINE_COUNT,
+        PARSE,
+        CORRUPT,
+        REDUCE,
+        OUTPUT,
+        COUNT
+    };
+
+    enum class Counter {
+        FILES,
+        BYTES_READ,
+        LINES,
+        CORRUPT_POINTS,
+        ALLOCATIONS,
+        ALLOCATED_BYTES,
+        BLOCKS_SKIPPED, // Charge pack blocks a range query settled from their headers alone.
+        BLOCKS_DECODED, // Charge pack blocks a range query had to decode.
+        COUNT
+    };
+
+    inline const char* getName(Phase phase) {
+        static const char* const NAMES[] = { "open", "cache_lookup", "line_count", "parse", "corrupt", "reduce", "output" };
+        return NAMES[(size_t)phase];
+    }
+    inline const char* getName(Counter counter) {
+        static const char* const NAMES[] = { "files", "bytes_read", "lines", "corrupt_points", "allocations", "allocated_bytes", "blocks_skipped", "blocks_decoded" };
+        return NAMES[(size_t)counter];
+    }
+
+    /// Allocations made by one thread, split by the phase they were made in. The last slot is for allocations
+    /// made outside of any phase.
+    struct Allocations {
+        uint64_t counts[(size_t)Phase::COUNT + 1] = {};
+        uint64_t bytes[(size_t)Phase::COUNT + 1] = {};
+
+        uint64_t getTotalCount() const {
+            uint64_t total = 0;
+            for (uint64_t count : counts) total += count;
+            return total;
+        }
+
+        Allocations operator-(const Allocations& other) const {
+            Allocations difference;
+            for (size_t i = 0; i <= (size_t)Phase::COUNT; ++i) {
+                difference.counts[i] = counts[i] - other.counts[i];
+                difference.bytes[i]  = bytes[i] - other.bytes[i];
+            }
+            return difference;
+        }
+    };
+
+    /// What analysing a single file took.
+    struct FileRecord {
+        std::string file;
+        uint64_t    lines; // Lines parsed this run, so 0 for results that came out of the cache.
+        Allocations allocations;
+    };
+
+    namespace impl {
+        struct Registry {
+            std::atomic<bool>     isEnabled{ false };
+            std::atomic<uint64_t> phaseCalls[(size_t)Phase::COUNT];
+            std::atomic<uint64_t> phaseNanoseconds[(size_t)Phase::COUNT];
+            std::atomic<uint64_t> counters[(size_t)Counter::COUNT];
+            std::atomic<uint64_t> phaseAllocations[(size_t)Phase::COUNT + 1];
+            std::atomic<uint64_t> phaseAllocatedBytes[(size_t)Phase::COUNT + 1];
+            std::chrono::steady_clock::time_point start;
+
+            std::mutex mutex;
+            std::vector<FileRecord> files;
+
+            Registry() {
+                for (auto& calls : phaseCalls) calls.store(0, std::memory_order_relaxed);
+                for (auto& nanoseconds : phaseNanoseconds) nanoseconds.store(0, std::memory_order_relaxed);
+                for (auto& counter : counters) counter.store(0, std::memory_order_relaxed);
+                for (auto& allocations : phaseAllocations) allocations.store(0, std::memory_order_relaxed);
+                for (auto& bytes : phaseAllocatedBytes) bytes.store(0, std::memory_order_relaxed);
+            }
+        };
+
+        inline Registry& getRegistry() {
+            static Registry registry;
+            return registry;
+        }
+
+        // Both are plain thread locals with constant initialisation, so are safe to touch from operator new.
+        inline Phase& getActivePhase() {
+            thread_local Phase phase = Phase::COUNT; // COUNT for when the thread isn't in any phase.
+            return phase;
+        }
+        inline Allocations& getThreadAllocations() {
+            thread_local Allocations allocations;
+            return allocations;
+        }
+        inline uint64_t* getThreadCounters() {
+            thread_local uint64_t counters[(size_t)Counter::COUNT] = {};
+            return counters;
+        }
+
+        inline void writeString(std::ostream& out, const std::string& s) {
+            out << '"';
+            for (char c : s) {
+                if (c == '"' || c == '\\') out << '\\';
+                if ((unsigned char)c < 0x20) continue;
+                out << c;
+            }
+            out << '"';
+        }
+    }
+
+    inline void enable() {
+        impl::getRegistry().start = std::chrono::steady_clock::now();
+        impl::getRegistry().isEnabled.store(true, std::memory_order_relaxed);
+    }
+    inline bool isEnabled() {
+        return impl::getRegistry().isEnabled.load(std::memory_order_relaxed);
+    }
+
+    inline void add(Counter counter, uint64_t amount = 1) {
+        if (!isEnabled()) return;
+        impl::getRegistry().counters[(size_t)counter].fetch_add(amount, std::memory_order_relaxed);
+        impl::getThreadCounters()[(size_t)counter] += amount;
+    }
+    inline uint64_t get(Counter counter) {
+        return impl::getRegistry().counters[(size_t)counter].load(std::memory_order_relaxed);
+    }
+    // Gets how much the calling thread alone has added to a counter, for putting work down to a file when
+    // other threads are busy with other files at the same time.
+    inline uint64_t getThreadCount(Counter counter) {
+        return impl::getThreadCounters()[(size_t)counter];
+    }
+
+    // Counts an allocation against the calling thread's current phase. Called from the allocation hooks.
+    inline void addAllocation(uint64_t size) {
+        if (!isEnabled()) return;
+        impl::Registry& registry = impl::getRegistry();
+        size_t phase = (size_t)impl::getActivePhase();
+        registry.counters[(size_t)Counter::ALLOCATIONS].fetch_add(1, std::memory_order_relaxed);
+        registry.counters[(size_t)Counter::ALLOCATED_BYTES].fetch_add(size, std::memory_order_relaxed);
+        registry.phaseAllocations[phase].fetch_add(1, std::memory_order_relaxed);
+        registry.phaseAllocatedBytes[phase].fetch_add(size, std::memory_order_relaxed);
+
+        Allocations& allocations = impl::getThreadAllocations();
+        ++allocations.counts[phase];
+        allocations.bytes[phase] += size;
+    }
+
+    // Gets every allocation the calling thread has made so far. Take one before and after some work and subtract
+    // to get what that work allocated.
+    inline Allocations getThreadAllocations() {
+        return impl::getThreadAllocations();
+    }
+
+    // Keeps what analysing a file took, to go out with the rest in writeJson.
+    inline void addFile(const std::string& file, uint64_t lines, const Allocations& allocations) {
+        if (!isEnabled()) return;
+        impl::Registry& registry = impl::getRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.files.push_back(FileRecord{ file, lines, allocations });
+    }
+
+    /// Adds the time between its construction and destruction to a phase.
+    class ScopedTimer {
+    public:
+        ScopedTimer(Phase phase) :
+            m_trace(getName(phase), "phase"),
+            m_phase(phase),
+            m_isTiming(isEnabled()) {
+            if (!m_isTiming) return;
+
+            Phase& activePhase = impl::getActivePhase();
+            m_previousPhase = activePhase;
+            activePhase = m_phase;
+            m_start = std::chrono::steady_clock::now();
+        }
+        ~ScopedTimer() {
+            if (!m_isTiming) return;
+            impl::getActivePhase() = m_previousPhase;
+
+            auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - m_start);
+            impl::Registry& registry = impl::getRegistry();
+            registry.phaseCalls[(size_t)m_phase].fetch_add(1, std::memory_order_relaxed);
+            registry.phaseNanoseconds[(size_t)m_phase].fetch_add((uint64_t)elapsed.count(), std::memory_order_relaxed);
+        }
+
+        ScopedTimer(const ScopedTimer&) = delete;
+        ScopedTimer& operator=(const ScopedTimer&) = delete;
+    private:
+        Trace::Scope m_trace; // Every timed phase also shows up in the trace, when one is being recorded.
+        Phase m_phase;
+        Phase m_previousPhase = Phase::COUNT;
+        bool  m_isTiming;
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    // Gets the most memory the process has had resident at once, in bytes, or 0 if we can't tell.
+    inline uint64_t getPeakResidentBytes() {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return (uint64_t)counters.PeakWorkingSetSize;
+        }
+        return 0;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#if defined(__APPLE__)
+        return (uint64_t)usage.ru_maxrss;        // Already bytes on macOS.
+#else
+        return (uint64_t)usage.ru_maxrss * 1024; // Kilobytes everywhere else.
+#endif
+#endif
+    }
+
+    // Writes everything recorded so far as a single JSON object.
+    inline void writeJson(std::ostream& out) {
+        impl::Registry& registry = impl::getRegistry();
+        double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - registry.start).count();
+
+        out << "{\"wall_seconds\":" << wallSeconds;
+        for (size_t i = 0; i < (size_t)Counter::COUNT; ++i) {
+            out << ",\"" << getName((Counter)i) << "\":" << registry.counters[i].load(std::memory_order_relaxed);
+        }
+
+        double perSecond = wallSeconds > 0.0 ? 1.0 / wallSeconds : 0.0;
+        out << ",\"lines_per_second\":" << (double)get(Counter::LINES) * perSecond
+            << ",\"bytes_per_second\":" << (double)get(Counter::BYTES_READ) * perSecond
+            << ",\"peak_rss_bytes\":" << getPeakResidentBytes();
+
+        out << ",\"phases\":{";
+        for (size_t i = 0; i < (size_t)Phase::COUNT; ++i) {
+            if (i > 0) out << ",";
+            out << "\"" << getName((Phase)i) << "\":{\"calls\":" << registry.phaseCalls[i].load(std::memory_order_relaxed)
+                << ",\"seconds\":" << (double)registry.phaseNanoseconds[i].load(std::memory_order_relaxed) * 1e-9
+                << ",\"allocations\":" << registry.phaseAllocations[i].load(std::memory_order_relaxed)
+                << ",\"allocated_bytes\":" << registry.phaseAllocatedBytes[i].load(std::memory_order_relaxed) << "}";
+        }
+        out << ",\"other\":{\"allocations\":" << registry.phaseAllocations[(size_t)Phase::COUNT].load(std::memory_order_relaxed)
+            << ",\"allocated_bytes\":" << registry.phaseAllocatedBytes[(size_t)Phase::COUNT].load(std::memory_order_relaxed) << "}}";
+
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        out << ",\"per_file\":[";
+        for (size_t f = 0; f < registry.files.size(); ++f) {
+            const FileRecord& record = registry.files[f];
+            uint64_t allocations = record.allocations.getTotalCount();
+            if (f > 0) out << ",";
+            out << "{\"file\":";
+            impl::writeString(out, record.file);
+            out << ",\"lines\":" << record.lines << ",\"allocations\":" << allocations;
+            if (record.lines > 0) out << ",\"allocations_per_line\":" << (double)allocations / (double)record.lines;
+            out << ",\"phases\":{";
+            for (size_t i = 0; i <= (size_t)Phase::COUNT; ++i) {
+                if (i > 0) out << ",";
+                out << "\"" << (i < (size_t)Phase::COUNT ? getName((Phase)i) : "other") << "\":{\"allocations\":"
+                    << record.allocations.counts[i] << ",\"allocated_bytes\":" << record.allocations.bytes[i] << "}";
+            }
+            out << "}}";
+        }
+        out << "]}" << std::endl;
+    }
+}
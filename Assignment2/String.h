@@ -0,0 +1,28 @@
+#pragma once
+
+#include <string>
+#include <cctype>
+#include <algorithm>
+
+/// Collection of helper function to act on strings.
+namespace String {
+    // Trims a string from the left.
+    inline void ltrim(std::string& s) {
+        // Erase from the beginning of the string to wherever the first non-whitespace character is.
+        s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](char a) {
+            return !std::isspace((int)a);
+        }));
+    }
+    // Trims a string from the right.
+    inline void rtrim(std::string& s) {
+        // Erase from the end of the string to wherever the last non-whitespace character is.
+        s.erase(std::find_if(s.rbegin(), s.rend(), [](char a) {
+            return !std::isspace((int)a);
+        }).base(), s.end()); // base returns the string iterator of the found reverse iterator.
+    }
+    // Trims a string from both ends.
+    inline void trim(std::string& s) {
+        ltrim(s);
+        rtrim(s);
+    }
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+/// Event tracing in the Chrome trace format, which Perfetto (ui.perfetto.dev) and chrome://tracing can both open.
+///
+/// Each thread records into its own fixed-size ring buffer, so recording an event never takes a lock or allocates,
+/// and if a thread records more events than fit only its oldest ones are lost. Events are recorded when a scope
+/// ends as a single complete event holding both its start and its duration, so a lost event can never leave a
+/// begin without its end. Everything is written out in one go by writeJson once the work is done.
+namespace Trace {
+    const size_t EVENTS_PER_THREAD = 1 << 16;
+    const size_t DETAIL_LENGTH     = 48;
+
+    struct Event {
+        const char* name;     // Must be a string literal, or otherwise live until the trace is written.
+        const char* category;
+        uint64_t    start;    // Nanoseconds since tracing was enabled.
+        uint64_t    duration;
+        char        detail[DETAIL_LENGTH]; // Optional extra, such as the file being worked on. Truncated to fit.
+    };
+
+    namespace impl {
+        struct ThreadBuffer {
+            uint32_t threadId;
+            std::unique_ptr<Event[]> events{ new Event[EVENTS_PER_THREAD] };
+            std::atomic<uint64_t> recorded{ 0 }; // Total ever recorded, the ring holds the last EVENTS_PER_THREAD.
+        };
+
+        struct Registry {
+            std::atomic<bool> isEnabled{ false };
+            std::chrono::steady_clock::time_point start;
+
+            std::mutex mutex;
+            std::vector<std::unique_ptr<ThreadBuffer>> buffers; // Outlive their threads, so we can write them at the end.
+        };
+
+        inline Registry& getRegistry() {
+            static Registry registry;
+            return registry;
+        }
+
+        inline ThreadBuffer& getThreadBuffer() {
+            thread_local ThreadBuffer* buffer = nullptr;
+            if (buffer == nullptr) {
+                Registry& registry = getRegistry();
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                registry.buffers.emplace_back(new ThreadBuffer());
+                buffer = registry.buffers.back().get();
+                buffer->threadId = (uint32_t)registry.buffers.size();
+            }
+            return *buffer;
+        }
+
+        inline uint64_t now() {
+            return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - getRegistry().start).count();
+        }
+
+        inline void writeEscaped(std::ostream& out, const char* s) {
+            for (; *s != '\0'; ++s) {
+                if (*s == '"' || *s == '\\') out << '\\';
+                if ((unsigned char)*s < 0x20) continue;
+                out << *s;
+            }
+        }
+    }
+
+    inline void enable() {
+        impl::getRegistry().start = std::chrono::steady_clock::now();
+        impl::getRegistry().isEnabled.store(true, std::memory_order_relaxed);
+    }
+    inline bool isEnabled() {
+        return impl::getRegistry().isEnabled.load(std::memory_order_relaxed);
+    }
+
+    // Records an event on the calling thread's ring buffer.
+    inline void record(const char* name, const char* category, uint64_t start, uint64_t duration, const char* detail = nullptr) {
+        impl::ThreadBuffer& buffer = impl::getThreadBuffer();
+        uint64_t index = buffer.recorded.load(std::memory_order_relaxed);
+
+        Event& event = buffer.events[index % EVENTS_PER_THREAD];
+        event.name     = name;
+        event.category = category;
+        event.start    = start;
+        event.duration = duration;
+        event.detail[0] = '\0';
+        if (detail != nullptr) {
+            std::strncpy(event.detail, detail, DETAIL_LENGTH - 1);
+            event.detail[DETAIL_LENGTH - 1] = '\0';
+        }
+
+        // Publish the event for whoever writes the trace.
+        buffer.recorded.store(index + 1, std::memory_order_release);
+    }
+
+    /// Records an event covering its own lifetime.
+    class Scope {
+    public:
+        Scope(const char* name, const char* category = "pipeline", const char* detail = nullptr) :
+            m_name(name),
+            m_category(category),
+            m_detail(detail),
+            m_isTracing(isEnabled()) {
+            if (m_isTracing) m_start = impl::now();
+        }
+        ~Scope() {
+            if (m_isTracing) record(m_name, m_category, m_start, impl::now() - m_start, m_detail);
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        const char* m_name;
+        const char* m_category;
+        const char* m_detail;
+        bool        m_isTracing;
+        uint64_t    m_start = 0;
+    };
+
+    // Writes every event recorded so far as Chrome trace JSON. Should be called once the threads recording
+    // events have finished with them. Returns false if the file couldn't be written.
+    inline bool writeJson(const std::string& path) {
+        std::ofstream out(path, std::ios::out | std::ios::trunc);
+        if (!out.is_open()) return false;
+
+        impl::Registry& registry = impl::getRegistry();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for (const auto& buffer : registry.buffers) {
+            if (!first) out << ",";
+            first = false;
+            out << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->threadId
+                << ",\"args\":{\"name\":\"thread " << buffer->threadId << "\"}}";
+
+            uint64_t recorded = buffer->recorded.load(std::memory_order_acquire);
+            uint64_t oldest   = recorded > EVENTS_PER_THREAD ? recorded - EVENTS_PER_THREAD : 0;
+            for (uint64_t i = oldest; i < recorded; ++i) {
+                const Event& event = buffer->events[i % EVENTS_PER_THREAD];
+                char timing[64];
+                std::snprintf(timing, sizeof(timing), "\"ts\":%.3f,\"dur\":%.3f", (double)event.start * 1e-3, (double)event.duration * 1e-3);
+
+                out << ",\n{\"name\":\"";
+                impl::writeEscaped(out, event.name);
+                out << "\",\"cat\":\"";
+                impl::writeEscaped(out, event.category);
+                out << "\",\"ph\":\"X\"," << timing << ",\"pid\":1,\"tid\":" << buffer->threadId;
+                if (event.detail[0] != '\0') {
+                    out << ",\"args\":{\"detail\":\"";
+                    impl::writeEscaped(out, event.detail);
+                    out << "\"}";
+                }
+                out << "}";
+            }
+        }
+        out << "\n]}\n";
+        return (bool)out;
+    }
+}
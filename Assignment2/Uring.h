@@ -0,0 +1,213 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+#include <initializer_list>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && defined(__NR_io_uring_register)
+#define URING_HAS_SYSCALLS
+#endif
+#endif
+#endif
+
+#if defined(URING_HAS_SYSCALLS)
+namespace Uring {
+    /// An io_uring driven with raw system calls, so there's nothing extra to link. Entries are added to the
+    /// submission ring with addEntry, handed to the kernel with enter, and what comes back is read with
+    /// takeCompletions.
+    ///
+    /// Adding and entering isn't thread safe, and nor are waiting and taking completions, but one thread can be
+    /// doing each at once.
+    class Ring {
+    public:
+        Ring() = default;
+        ~Ring() {
+            close();
+        }
+
+        Ring(const Ring&) = delete;
+        Ring& operator=(const Ring&) = delete;
+
+        // Sets up a ring with room for at least the given number of entries, that can do every one of the given
+        // operations. Returns false if io_uring isn't there (other systems, older kernels, or sandboxes that forbid
+        // it) or can't do them all.
+        bool open(unsigned entries, std::initializer_list<uint8_t> opcodes) {
+            io_uring_params parameters;
+            std::memset(&parameters, 0, sizeof(parameters));
+            m_descriptor = (int)syscall(__NR_io_uring_setup, entries, &parameters);
+            if (m_descriptor < 0) return false;
+
+            m_submissionRingSize = parameters.sq_off.array + parameters.sq_entries * sizeof(unsigned);
+            m_completionRingSize = parameters.cq_off.cqes + parameters.cq_entries * sizeof(io_uring_cqe);
+            bool isSingleMapping = (parameters.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (isSingleMapping) {
+                m_submissionRingSize = m_completionRingSize = std::max(m_submissionRingSize, m_completionRingSize);
+            }
+
+            m_submissionRing = mmap(nullptr, m_submissionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                    m_descriptor, IORING_OFF_SQ_RING);
+            if (m_submissionRing == MAP_FAILED) return fail();
+            if (isSingleMapping) {
+                m_completionRing = m_submissionRing;
+            } else {
+                m_completionRing = mmap(nullptr, m_completionRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                        m_descriptor, IORING_OFF_CQ_RING);
+                if (m_completionRing == MAP_FAILED) return fail();
+            }
+            m_entriesSize = parameters.sq_entries * sizeof(io_uring_sqe);
+            m_entries = (io_uring_sqe*)mmap(nullptr, m_entriesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                            m_descriptor, IORING_OFF_SQES);
+            if (m_entries == MAP_FAILED) return fail();
+
+            char* submission = static_cast<char*>(m_submissionRing);
+            m_submissionTail  = (unsigned*)(submission + parameters.sq_off.tail);
+            m_submissionMask  = (unsigned*)(submission + parameters.sq_off.ring_mask);
+            m_submissionArray = (unsigned*)(submission + parameters.sq_off.array);
+            char* completion = static_cast<char*>(m_completionRing);
+            m_completionHead = (unsigned*)(completion + parameters.cq_off.head);
+            m_completionTail = (unsigned*)(completion + parameters.cq_off.tail);
+            m_completionMask = (unsigned*)(completion + parameters.cq_off.ring_mask);
+            m_completions    = (io_uring_cqe*)(completion + parameters.cq_off.cqes);
+            m_entryCount     = parameters.sq_entries;
+            return isSupported(opcodes) || fail();
+        }
+        void close() {
+            if (m_entries != MAP_FAILED) munmap(m_entries, m_entriesSize);
+            if (m_completionRing != MAP_FAILED && m_completionRing != m_submissionRing) {
+                munmap(m_completionRing, m_completionRingSize);
+            }
+            if (m_submissionRing != MAP_FAILED) munmap(m_submissionRing, m_submissionRingSize);
+            if (m_descriptor >= 0) ::close(m_descriptor);
+
+            m_descriptor     = -1;
+            m_submissionRing = MAP_FAILED;
+            m_completionRing = MAP_FAILED;
+            m_entries        = (io_uring_sqe*)MAP_FAILED;
+            m_queued         = 0;
+        }
+        bool isOpen() const {
+            return m_descriptor >= 0;
+        }
+
+        // Number of entries the submission ring has room for.
+        unsigned getEntryCount() const {
+            return m_entryCount;
+        }
+
+        // Gets the next free submission entry, cleared, to be filled in and then handed over with enter.
+        io_uring_sqe& addEntry(uint8_t opcode, uint64_t userData) {
+            // Only this side ever writes the tail, the kernel just reads it.
+            unsigned tail  = *m_submissionTail + m_queued;
+            unsigned index = tail & *m_submissionMask;
+            io_uring_sqe& entry = m_entries[index];
+            std::memset(&entry, 0, sizeof(entry));
+            entry.opcode    = opcode;
+            entry.user_data = userData;
+            m_submissionArray[index] = index;
+            ++m_queued;
+            return entry;
+        }
+
+        // Number of entries added but not yet handed over.
+        unsigned getQueued() const {
+            return m_queued;
+        }
+
+        // Hands the kernel everything added since last time, and waits for at least minComplete completions
+        // (which needn't be from what was just added). Returns false if the ring itself failed, with whatever the
+        // kernel hadn't taken withdrawn, so it never turns up later.
+        bool enter(unsigned minComplete) {
+            __atomic_store_n(m_submissionTail, *m_submissionTail + m_queued, __ATOMIC_RELEASE);
+            unsigned toSubmit = m_queued;
+            m_queued = 0;
+
+            for (;;) {
+                unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+                int submitted = (int)syscall(__NR_io_uring_enter, m_descriptor, toSubmit, minComplete, flags, nullptr, 0);
+                if (submitted < 0) {
+                    if (errno == EINTR) continue;
+                    __atomic_store_n(m_submissionTail, *m_submissionTail - toSubmit, __ATOMIC_RELEASE);
+                    return false;
+                }
+                toSubmit -= std::min((unsigned)submitted, toSubmit);
+                if (toSubmit == 0) return true;
+            }
+        }
+
+        // Waits for at least one completion without handing anything over, so it can be called from a thread of its
+        // own while another adds entries. Returns false if the ring itself failed.
+        bool wait() {
+            for (;;) {
+                int result = (int)syscall(__NR_io_uring_enter, m_descriptor, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+                if (result >= 0) return true;
+                if (errno != EINTR) return false;
+            }
+        }
+
+        // Passes each completion waiting to handle(userData, result), and returns how many there were.
+        template <typename Handle>
+        unsigned takeCompletions(Handle handle) {
+            unsigned head  = *m_completionHead;
+            unsigned tail  = __atomic_load_n(m_completionTail, __ATOMIC_ACQUIRE);
+            unsigned count = tail - head;
+            for (; head != tail; ++head) {
+                const io_uring_cqe& completion = m_completions[head & *m_completionMask];
+                handle(completion.user_data, completion.res);
+            }
+            __atomic_store_n(m_completionHead, head, __ATOMIC_RELEASE);
+            return count;
+        }
+    private:
+        // Kernels from 5.1 set up a ring, but opens, reads and closes only came in 5.6, and before then every one
+        // fails with -EINVAL. So the kernel's asked which operations it knows. Kernels before 5.6 can't be asked,
+        // which is as good as a no.
+        bool isSupported(std::initializer_list<uint8_t> opcodes) {
+            const unsigned maxOps = 256;
+            std::vector<char> buffer(sizeof(io_uring_probe) + maxOps * sizeof(io_uring_probe_op), 0);
+            io_uring_probe* probe = (io_uring_probe*)buffer.data();
+            if (syscall(__NR_io_uring_register, m_descriptor, IORING_REGISTER_PROBE, probe, maxOps) < 0) return false;
+
+            for (uint8_t opcode : opcodes) {
+                if (opcode > probe->last_op || (probe->ops[opcode].flags & IO_URING_OP_SUPPORTED) == 0) return false;
+            }
+            return true;
+        }
+
+        // Always returns false, for bailing out of open.
+        bool fail() {
+            close();
+            return false;
+        }
+
+        int m_descriptor = -1;
+
+        void*  m_submissionRing     = MAP_FAILED;
+        size_t m_submissionRingSize = 0;
+        void*  m_completionRing     = MAP_FAILED;
+        size_t m_completionRingSize = 0;
+        io_uring_sqe* m_entries     = (io_uring_sqe*)MAP_FAILED;
+        size_t m_entriesSize        = 0;
+        unsigned m_entryCount       = 0;
+
+        unsigned* m_submissionTail  = nullptr;
+        unsigned* m_submissionMask  = nullptr;
+        unsigned* m_submissionArray = nullptr;
+        unsigned* m_completionHead  = nullptr;
+        unsigned* m_completionTail  = nullptr;
+        unsigned* m_completionMask  = nullptr;
+        io_uring_cqe* m_completions = nullptr;
+
+        unsigned m_queued = 0; // Entries added but not yet handed over.
+    };
+}
+#endif
@@ -0,0 +1,597 @@
+#include <cmath>
+#include <cctype>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <deque>
+#include <thread>
+#include <filesystem>
+
+#include "String.h"
+#include "ChargeParser.h"
+#include "ChargeDataModel.h"
+#include "ChargePack.h"
+#include "LineIndex.h"
+#include "ParallelLoader.h"
+#include "Queues.h"
+#include "SharedRing.h"
+#include "DataAnalysis.h"
+#include "DatasetGenerator.h"
+#include "PerfCounters.h"
+
+/// Benchmarks of the loader and analysis kernels over synthetic data sets of increasing size.
+namespace Benchmark {
+    const uint64_t MAX_LINES        = 1000000000; // The loader counts lines in an unsigned int.
+    const uint64_t MAX_PARSER_LINES = 100000000;  // --parsers holds the text and every line's range in memory.
+
+    struct Settings {
+        uint64_t    minLines     = 100;
+        uint64_t    maxLines     = 1000000;
+        unsigned    repetitions  = 5;
+        uint64_t    maxTrimLines = 10000000; // Every line is held as its own string for the trim benchmark.
+        std::string directory;
+        bool        keepFiles    = false;
+        bool        perf         = false; // Read hardware counters around each measured region.
+        bool        parsers      = false; // Compare the parser backends instead of benchmarking every kernel.
+    };
+
+    /// Timings of one kernel over one data set.
+    struct Measurement {
+        std::string kernel;
+        uint64_t    elements = 0;
+        uint64_t    bytes    = 0;
+        std::vector<double> seconds; // One per repetition.
+        bool        hasCounters = false;
+        PerfCounters::Values counters; // Summed over every repetition.
+    };
+
+    // Stops the compiler from optimising away work whose result we don't otherwise use.
+    volatile double sink = 0.0;
+
+    // Counters to read around each measured region, or null when not asked for.
+    PerfCounters* counters = nullptr;
+
+    // Writes a file of the given number of lines in the same layout as millikan.dat, setting bytes to its size.
+    // Returns false, having said so on stderr, if it couldn't be written.
+    inline bool writeSyntheticFile(const std::string& path, uint64_t lines, uint64_t& bytes, uint64_t seed = 1,
+                                   double corruptFraction = 0.0) {
+        DatasetGenerator::Settings settings;
+        settings.lines           = lines;
+        settings.seed            = seed;
+        settings.corruptFraction = corruptFraction;
+
+        std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (out.is_open()) {
+            bytes = DatasetGenerator::write(settings, out, std::max(std::thread::hardware_concurrency(), 1u));
+            out.close();
+            if (!out.fail()) return true;
+            std::filesystem::remove(path);
+        }
+        std::cerr << "Could not write data set: " << path << "." << std::endl;
+        return false;
+    }
+
+    // Runs the kernel the given number of times, calling setup (untimed) before each.
+    inline Measurement measure(const std::string& kernel, uint64_t elements, uint64_t bytes, unsigned repetitions,
+                               const std::function<void()>& setup, const std::function<void()>& run) {
+        Measurement measurement;
+        measurement.kernel   = kernel;
+        measurement.elements = elements;
+        measurement.bytes    = bytes;
+        for (unsigned i = 0; i < repetitions; ++i) {
+            if (setup) setup();
+
+            if (counters != nullptr) counters->start();
+            auto start = std::chrono::steady_clock::now();
+            run();
+            auto end = std::chrono::steady_clock::now();
+            if (counters != nullptr) {
+                measurement.counters.add(counters->stop());
+                measurement.hasCounters = true;
+            }
+
+            measurement.seconds.push_back(std::chrono::duration<double>(end - start).count());
+        }
+        return measurement;
+    }
+
+    inline void printHeader() {
+        std::cout << std::left  << std::setw(46) << "kernel"
+                  << std::right << std::setw(12) << "elements"
+                  << std::setw(14) << "mean (ms)"
+                  << std::setw(12) << "ns/elem"
+                  << std::setw(12) << "MB/s"
+                  << std::setw(12) << "stddev %";
+        if (counters != nullptr) {
+            std::cout << std::setw(13) << "cycles/elem"
+                      << std::setw(12) << "instr/elem"
+                      << std::setw(8)  << "IPC"
+                      << std::setw(14) << "cache-m/elem"
+                      << std::setw(14) << "branch-m/elem";
+        }
+        std::cout << std::endl;
+    }
+    inline void print(const Measurement& measurement) {
+        double mean = 0.0;
+        for (double s : measurement.seconds) mean += s;
+        mean /= (double)measurement.seconds.size();
+
+        double variance = 0.0;
+        for (double s : measurement.seconds) variance += (s - mean) * (s - mean);
+        if (measurement.seconds.size() > 1) variance /= (double)(measurement.seconds.size() - 1);
+        double relativeDeviation = mean > 0.0 ? 100.0 * std::sqrt(variance) / mean : 0.0;
+
+        double nsPerElement = measurement.elements > 0 ? 1e9 * mean / (double)measurement.elements : 0.0;
+        double megabytesPerSecond = mean > 0.0 ? (double)measurement.bytes / mean / 1e6 : 0.0;
+
+        std::cout << std::left  << std::setw(46) << measurement.kernel
+                  << std::right << std::setw(12) << measurement.elements
+                  << std::setw(14) << std::fixed << std::setprecision(3) << mean * 1e3
+                  << std::setw(12) << std::setprecision(2) << nsPerElement
+                  << std::setw(12) << std::setprecision(1) << megabytesPerSecond
+                  << std::setw(12) << std::setprecision(1) << relativeDeviation;
+
+        if (measurement.hasCounters) {
+            // Per element of a single run, so directly comparable with ns/elem.
+            const PerfCounters::Values& values = measurement.counters;
+            double runs = (double)measurement.elements * (double)measurement.seconds.size();
+            auto printPerElement = [&](PerfCounters::Event event, int width, int precision) {
+                std::cout << std::setw(width);
+                if (values.has(event) && runs > 0.0) {
+                    std::cout << std::setprecision(precision) << (double)values.get(event) / runs;
+                } else {
+                    std::cout << "-";
+                }
+            };
+            printPerElement(PerfCounters::Event::CYCLES, 13, 2);
+            printPerElement(PerfCounters::Event::INSTRUCTIONS, 12, 2);
+            std::cout << std::setw(8);
+            if (values.has(PerfCounters::Event::CYCLES) && values.has(PerfCounters::Event::INSTRUCTIONS) && values.get(PerfCounters::Event::CYCLES) > 0) {
+                std::cout << std::setprecision(2) << (double)values.get(PerfCounters::Event::INSTRUCTIONS) / (double)values.get(PerfCounters::Event::CYCLES);
+            } else {
+                std::cout << "-";
+            }
+            printPerElement(PerfCounters::Event::CACHE_MISSES, 14, 4);
+            printPerElement(PerfCounters::Event::BRANCH_MISSES, 14, 4);
+        }
+        std::cout << std::defaultfloat << std::endl;
+    }
+
+    // Benchmarks every kernel over a data set of the given number of lines. Returns false if the data set
+    // couldn't be written.
+    inline bool runForSize(const Settings& settings, uint64_t lines) {
+        std::string path = (std::filesystem::path(settings.directory) / ("bench_" + std::to_string(lines) + ".dat")).string();
+        uint64_t fileBytes = 0;
+        if (!writeSyntheticFile(path, lines, fileBytes)) return false;
+        unsigned repetitions = settings.repetitions;
+
+        // Loading: the line count pass on its own and the full load.
+        print(measure("ChargeDataModel::getLineCount", lines, fileBytes, repetitions, nullptr, [&]() {
+            ChargeDataModel model;
+            model.init(path);
+            model.openFile();
+            sink = sink + model.getLineCount();
+        }));
+
+        // A line index, built on one thread and on every core, then used to sample a hundredth of the lines.
+        LineIndex::Index index;
+        print(measure("LineIndex::Index::build (1 thread)", lines, fileBytes, repetitions, nullptr, [&]() {
+            index.build(path, 1);
+            sink = sink + index.getLineCount();
+        }));
+        unsigned indexThreads = std::max(std::thread::hardware_concurrency(), 1u);
+        print(measure("LineIndex::Index::build (" + std::to_string(indexThreads) + " threads)", lines, fileBytes, repetitions, nullptr, [&]() {
+            index.build(path, indexThreads);
+            sink = sink + index.getLineCount();
+        }));
+        uint64_t sampleSize = std::max<uint64_t>(lines / 100, 1);
+        print(measure("LineIndex::sample (1% of lines)", sampleSize, 0, repetitions, nullptr, [&]() {
+            std::vector<double> sampled;
+            unsigned int corruptCount;
+            LineIndex::sample(path, index, sampleSize, LineIndex::DEFAULT_SEED, sampled, corruptCount);
+            sink = sink + sampled.size();
+        }));
+
+        std::vector<double> charges;
+        print(measure("ChargeDataModel::loadDataFromFile", lines, fileBytes, repetitions, nullptr, [&]() {
+            ChargeDataModel model;
+            model.init(path, false);
+            model.takeChargeData(charges);
+        }));
+
+        // Other compositions of the loader policies over the same file. The model is only passed for its type.
+        auto measureLoader = [&](const std::string& kernel, const std::string& file, uint64_t bytes, auto* model) {
+            print(measure("ChargeDataModel<" + kernel + ">", lines, bytes, repetitions, nullptr, [&]() {
+                std::remove_pointer_t<decltype(model)> loader;
+                loader.init(file, false);
+                loader.load();
+                sink = sink + loader.getStorage().size();
+            }));
+        };
+        measureLoader("Mapped, Text, Vector", path, fileBytes, (BasicChargeDataModel<Sources::Mapped, RecordParsers::Text, Storages::Vector>*)nullptr);
+        measureLoader("Mapped, FixedWidth, Vector", path, fileBytes, (BasicChargeDataModel<Sources::Mapped, RecordParsers::FixedWidth, Storages::Vector>*)nullptr);
+        measureLoader("File, Text, Arena", path, fileBytes, (BasicChargeDataModel<Sources::File, RecordParsers::Text, Storages::Arena>*)nullptr);
+        measureLoader("File, Text, Chunked", path, fileBytes, (BasicChargeDataModel<Sources::File, RecordParsers::Text, Storages::Chunked>*)nullptr);
+
+        unsigned parserThreads = std::max(std::thread::hardware_concurrency(), 2u);
+        print(measure("ParallelLoader::load (" + std::to_string(parserThreads) + " parsers)", lines, fileBytes, repetitions, nullptr, [&]() {
+            unsigned int corruptCount;
+            ParallelLoader::load<Sources::File, RecordParsers::Text>(path, parserThreads, false, false, charges, corruptCount);
+        }));
+
+        std::string binaryPath = path + ".bin";
+        {
+            std::ofstream out(binaryPath, std::ios::binary | std::ios::trunc);
+            out.write((const char*)charges.data(), (std::streamsize)(charges.size() * sizeof(double)));
+        }
+        uint64_t binaryBytes = (uint64_t)charges.size() * sizeof(double);
+        measureLoader("File, Binary, Vector", binaryPath, binaryBytes, (BasicChargeDataModel<Sources::File, RecordParsers::Binary, Storages::Vector>*)nullptr);
+        measureLoader("Mapped, Binary, View", binaryPath, binaryBytes, (BasicChargeDataModel<Sources::Mapped, RecordParsers::Binary, Storages::View>*)nullptr);
+        if (!settings.keepFiles) std::filesystem::remove(binaryPath);
+
+        // The same charges packed, decoded in full and summarised from the block headers alone.
+        std::string packPath = path + ".cpk";
+        FixedPoint::Charges scaledCharges;
+        if (scaledCharges.assign(charges.data(), charges.size(), 5) && ChargePack::write(packPath, scaledCharges, 0)) {
+            uint64_t packBytes = std::filesystem::file_size(packPath);
+            std::vector<double> decoded;
+            print(measure("ChargePack::Reader::decodeAll", lines, packBytes, repetitions, nullptr, [&]() {
+                ChargePack::Reader reader;
+                std::string error;
+                if (!reader.open(packPath, error)) return;
+                reader.decodeAll(decoded);
+                sink = sink + decoded.size();
+            }));
+            print(measure("ChargePack::Reader::summarise", lines, packBytes, repetitions, nullptr, [&]() {
+                ChargePack::Reader reader;
+                std::string error;
+                if (!reader.open(packPath, error)) return;
+                sink = sink + reader.summarise().mean;
+            }));
+            // Synthetic charges are in no order, so most blocks straddle the ends of a range and get decoded.
+            DataAnalysis::Range range;
+            range.lower = 1.5;
+            range.upper = 1.7;
+            print(measure("ChargePack::Reader::summarise (range)", lines, packBytes, repetitions, nullptr, [&]() {
+                ChargePack::Reader reader;
+                std::string error;
+                if (!reader.open(packPath, error)) return;
+                sink = sink + reader.summarise(range).mean;
+            }));
+            if (!settings.keepFiles) std::filesystem::remove(packPath);
+        }
+
+#if !defined(_WIN32)
+        // The same charges handed over live from another thread through a shared-memory ring, rather than a file.
+        std::string ringName = "/chargebench." + std::to_string(getpid());
+        print(measure("ChargeDataModel<SharedRing, Binary, Vector>", lines, binaryBytes, repetitions, nullptr, [&]() {
+            SharedRing::Producer producer;
+            if (!producer.create(ringName)) return;
+            std::thread writer([&]() {
+                producer.write(charges.data(), charges.size());
+                producer.finish();
+            });
+            BasicChargeDataModel<SharedRing::Consumer, RecordParsers::Binary, Storages::Vector> loader;
+            loader.init(ringName, false);
+            loader.load();
+            writer.join();
+            sink = sink + loader.getStorage().size();
+        }));
+#endif
+
+        // Handing one item per line from one thread to another, through each kind of queue.
+        auto measureHandoff = [&](const std::string& kernel, auto tryPush, auto tryPop) {
+            print(measure(kernel, lines, 0, repetitions, nullptr, [&]() {
+                std::thread producer([&]() {
+                    Queues::Backoff backoff;
+                    for (uint64_t i = 1; i <= lines; ++i) {
+                        while (!tryPush(i)) backoff.pause();
+                        backoff.reset();
+                    }
+                });
+                Queues::Backoff backoff;
+                uint64_t total = 0;
+                for (uint64_t i = 0; i < lines; ++i) {
+                    uint64_t value;
+                    while (!tryPop(value)) backoff.pause();
+                    backoff.reset();
+                    total += value;
+                }
+                producer.join();
+                sink = sink + total;
+            }));
+        };
+        {
+            Queues::SpscQueue<uint64_t> queue(1024);
+            measureHandoff("Queues::SpscQueue handoff",
+                [&](uint64_t value) { return queue.tryPush(std::move(value)); }, [&](uint64_t& value) { return queue.tryPop(value); });
+        }
+        {
+            Queues::MpmcQueue<uint64_t> queue(1024);
+            measureHandoff("Queues::MpmcQueue handoff",
+                [&](uint64_t value) { return queue.tryPush(std::move(value)); }, [&](uint64_t& value) { return queue.tryPop(value); });
+        }
+        {
+            // What the lock-free queues replace: a mutex around a std::deque, bounded the same way.
+            std::mutex mutex;
+            std::deque<uint64_t> queue;
+            measureHandoff("std::mutex + std::deque handoff",
+                [&](uint64_t value) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (queue.size() >= 1024) return false;
+                    queue.push_back(value);
+                    return true;
+                },
+                [&](uint64_t& value) {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (queue.empty()) return false;
+                    value = queue.front();
+                    queue.pop_front();
+                    return true;
+                });
+        }
+
+        // Trimming, over the raw lines held in memory.
+        if (lines <= settings.maxTrimLines) {
+            std::vector<std::string> rawLines;
+            rawLines.reserve((size_t)lines);
+            {
+                std::ifstream in(path);
+                std::string line;
+                while (std::getline(in, line)) rawLines.push_back(line);
+            }
+            uint64_t lineBytes = 0;
+            for (const std::string& line : rawLines) lineBytes += line.size();
+
+            std::vector<std::string> working;
+            print(measure("String::trim", lines, lineBytes, repetitions, [&]() {
+                working = rawLines;
+            }, [&]() {
+                for (std::string& line : working) String::trim(line);
+            }));
+        } else {
+            std::cout << std::left << std::setw(46) << "String::trim" << "  skipped, more lines than --max-trim-lines" << std::endl;
+        }
+
+        // Analysis kernels over the loaded data.
+        const double* data = charges.data();
+        unsigned int size = (unsigned int)charges.size();
+        uint64_t dataBytes = (uint64_t)size * sizeof(double);
+
+        double mean = 0.0;
+        print(measure("DataAnalysis::computeMean", size, dataBytes, repetitions, nullptr, [&]() {
+            mean = DataAnalysis::computeMean(data, size);
+            sink = sink + mean;
+        }));
+        print(measure("DataAnalysis::computeStandardDeviation", size, dataBytes, repetitions, nullptr, [&]() {
+            sink = sink + DataAnalysis::computeStandardDeviation(data, size, mean);
+        }));
+        // Constant time, so only timed per call.
+        print(measure("DataAnalysis::computeStandardErrorInTheMean", 1, 0, repetitions, nullptr, [&]() {
+            sink = sink + DataAnalysis::computeStandardErrorInTheMean(mean, size);
+        }));
+        print(measure("DataAnalysis::Accumulator::add", size, dataBytes, repetitions, nullptr, [&]() {
+            DataAnalysis::Accumulator accumulator;
+            for (unsigned int i = 0; i < size; ++i) accumulator.add(data[i]);
+            sink = sink + accumulator.getStandardDeviation();
+        }));
+        print(measure("DataAnalysis::summarise", size, dataBytes, repetitions, nullptr, [&]() {
+            sink = sink + DataAnalysis::summarise(data, size).standardDeviation;
+        }));
+
+        // The same over other storage and summing types, to see what each combination's kernel costs.
+        std::vector<float> floats(charges.begin(), charges.end());
+        std::vector<uint32_t> scaled(charges.size());
+        for (size_t i = 0; i < charges.size(); ++i) scaled[i] = (uint32_t)std::llround(charges[i] * 1e5);
+
+        print(measure("DataAnalysis::summarise<float, float>", size, (uint64_t)size * sizeof(float), repetitions, nullptr, [&]() {
+            sink = sink + DataAnalysis::summarise<float, float>(floats.data(), size).standardDeviation;
+        }));
+        print(measure("DataAnalysis::summarise<float, double>", size, (uint64_t)size * sizeof(float), repetitions, nullptr, [&]() {
+            sink = sink + DataAnalysis::summarise<float, double>(floats.data(), size).standardDeviation;
+        }));
+        print(measure("DataAnalysis::summarise<double, DoubleDouble>", size, dataBytes, repetitions, nullptr, [&]() {
+            sink = sink + DataAnalysis::summarise<double, DataAnalysis::DoubleDouble>(data, size).standardDeviation;
+        }));
+        print(measure("DataAnalysis::summarise<uint32_t, uint64_t>", size, (uint64_t)size * sizeof(uint32_t), repetitions, nullptr, [&]() {
+            sink = sink + DataAnalysis::summarise<uint32_t, uint64_t>(scaled.data(), size).standardDeviation;
+        }));
+
+        if (!settings.keepFiles) {
+            std::filesystem::remove(path);
+        }
+        return true;
+    }
+
+    // Lines that have tripped up number parsers, checked on top of the generated data.
+    const char* const TRICKY_LINES[] = {
+        "", " ", "error", "nan", "inf", "infinity", "-inf", "0x10", "0x1p3", "1.2.3", "1.5 1.6", "#####", "nan?",
+        "-1.00000", "-0", "-0.0", "+0", "+1.5", "+-1", "-+1", ".5", "5.", ".", "+.", "1e5", "1E-5", "1e", "1e+", "e5",
+        ".e5", "1.5e3x", "1,5", "  1.60218  ", "\t1.60218\r", "1.60218 ", "00001.60218000", "1e400", "1e-400",
+        "4.9e-324", "2.2250738585072011e-308", "1.7976931348623157e308", "1.7976931348623159e308",
+        "9007199254740993", "9007199254740993.0", "0.1000000000000000055511151231257827",
+        "123456789012345678901234567890", "1234567890123456", "12345678.12345678", "0.0000000000000000000000001"
+    };
+
+    // Parses every line with every backend, reporting any line a backend disagrees with the stringstream parser on.
+    // Returns the number of disagreements.
+    inline uint64_t checkAgreement(const std::vector<std::pair<const char*, const char*>>& lines) {
+        uint64_t disagreements = 0;
+        for (size_t b = 1; b < (size_t)ChargeParser::Backend::COUNT; ++b) {
+            auto backend = (ChargeParser::Backend)b;
+            uint64_t backendDisagreements = 0;
+            std::string firstDisagreement;
+            for (const auto& line : lines) {
+                double expected = 0.0, actual = 0.0;
+                bool isExpected = ChargeParser::parseStringStream(line.first, line.second, expected);
+                bool isActual   = ChargeParser::parse(backend, line.first, line.second, actual);
+                if (isExpected != isActual || (isExpected && std::memcmp(&expected, &actual, sizeof(double)) != 0)) {
+                    if (backendDisagreements++ == 0) firstDisagreement.assign(line.first, line.second);
+                }
+            }
+            if (backendDisagreements > 0) {
+                std::cout << "  " << ChargeParser::getName(backend) << " disagrees with stringstream on "
+                          << backendDisagreements << " line(s), first: \"" << firstDisagreement << "\"" << std::endl;
+            }
+            disagreements += backendDisagreements;
+        }
+        return disagreements;
+    }
+
+    // Benchmarks every parser backend over the lines of a data set of the given number of lines, having first
+    // checked they all agree on them, and adds the lines they disagreed on to disagreements. Returns false if the
+    // data set couldn't be written.
+    inline bool runParsersForSize(const Settings& settings, uint64_t lines, uint64_t& disagreements) {
+        std::string path = (std::filesystem::path(settings.directory) / ("bench_parsers_" + std::to_string(lines) + ".dat")).string();
+        uint64_t fileBytes = 0;
+        // A few corrupt lines, so the rejection paths get some use.
+        if (!writeSyntheticFile(path, lines, fileBytes, 1, 0.001)) return false;
+
+        std::string text;
+        {
+            std::ifstream in(path, std::ios::in | std::ios::binary);
+            text.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+        }
+        if (!settings.keepFiles) {
+            std::filesystem::remove(path);
+        }
+
+        std::vector<std::pair<const char*, const char*>> lineRanges;
+        lineRanges.reserve((size_t)lines);
+        const char* lineStart = text.data();
+        const char* const end = text.data() + text.size();
+        while (const char* newline = static_cast<const char*>(std::memchr(lineStart, '\n', end - lineStart))) {
+            lineRanges.emplace_back(lineStart, newline);
+            lineStart = newline + 1;
+        }
+
+        disagreements += checkAgreement(lineRanges);
+        for (size_t b = 0; b < (size_t)ChargeParser::Backend::COUNT; ++b) {
+            auto backend = (ChargeParser::Backend)b;
+            print(measure(std::string("ChargeParser::") + ChargeParser::getName(backend), lineRanges.size(), text.size(), settings.repetitions, nullptr, [&]() {
+                double total = 0.0;
+                for (const auto& line : lineRanges) {
+                    double charge;
+                    if (ChargeParser::parse(backend, line.first, line.second, charge)) total += charge;
+                }
+                sink = sink + total;
+            }));
+        }
+        return true;
+    }
+
+    // Reads an argument that must be a whole number no bigger than max, returning false if it isn't one.
+    inline bool parseCount(const char* text, uint64_t max, uint64_t& value) {
+        // strtoull skips leading space and takes a minus sign as wrapping round, so insist on a digit first.
+        if (!std::isdigit((unsigned char)text[0])) return false;
+        char* valueEnd = nullptr;
+        unsigned long long parsed = std::strtoull(text, &valueEnd, 10);
+        if (*valueEnd != '\0' || parsed > max) return false;
+        value = parsed;
+        return true;
+    }
+
+    inline void printUsage(std::ostream& out, const char* program) {
+        out << "Usage: " << program << " [options]" << std::endl
+            << std::endl
+            << "Benchmarks the loader and analysis kernels over synthetic data sets of 10^k lines." << std::endl
+            << std::endl
+            << "Options:" << std::endl
+            << "  --min-lines <n>        Smallest data set (default 100)." << std::endl
+            << "  --max-lines <n>        Largest data set (default 1000000, up to 1000000000, or 100000000 with" << std::endl
+            << "                         --parsers)." << std::endl
+            << "  --repetitions <n>      Times to run each kernel (default 5)." << std::endl
+            << "  --max-trim-lines <n>   Largest data set to benchmark trimming on (default 10000000)." << std::endl
+            << "  --dir <directory>      Where to write the data sets (default the temporary directory)." << std::endl
+            << "  --keep                 Leave the data sets behind afterwards." << std::endl
+            << "  --perf                 Also report cycles, instructions, cache misses and branch misses per" << std::endl
+            << "                         element, summed over every thread a kernel uses, read through" << std::endl
+            << "                         perf_event_open (Linux only)." << std::endl
+            << "  --parsers              Check the number parser backends agree, and compare their throughput," << std::endl
+            << "                         instead of benchmarking every kernel. Exits with 1 if they disagree." << std::endl;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    Benchmark::Settings settings;
+    settings.directory = std::filesystem::temp_directory_path().string();
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool isValid = true;
+        if (argument == "--min-lines" && hasValue) {
+            isValid = Benchmark::parseCount(argv[++i], Benchmark::MAX_LINES, settings.minLines);
+        } else if (argument == "--max-lines" && hasValue) {
+            isValid = Benchmark::parseCount(argv[++i], Benchmark::MAX_LINES, settings.maxLines);
+        } else if (argument == "--repetitions" && hasValue) {
+            uint64_t repetitions = 0;
+            isValid = Benchmark::parseCount(argv[++i], UINT_MAX, repetitions);
+            settings.repetitions = (unsigned)repetitions;
+        } else if (argument == "--max-trim-lines" && hasValue) {
+            isValid = Benchmark::parseCount(argv[++i], UINT64_MAX, settings.maxTrimLines);
+        } else if (argument == "--dir" && hasValue) {
+            settings.directory = argv[++i];
+        } else if (argument == "--keep") {
+            settings.keepFiles = true;
+        } else if (argument == "--perf") {
+            settings.perf = true;
+        } else if (argument == "--parsers") {
+            settings.parsers = true;
+        } else {
+            bool isHelp = argument == "--help" || argument == "-h";
+            Benchmark::printUsage(isHelp ? std::cout : std::cerr, argv[0]);
+            return isHelp ? 0 : 2;
+        }
+        if (!isValid) {
+            std::cerr << "Invalid value for " << argument << ": " << argv[i] << "." << std::endl;
+            Benchmark::printUsage(std::cerr, argv[0]);
+            return 2;
+        }
+    }
+    if (settings.repetitions == 0) settings.repetitions = 1;
+    if (settings.parsers && settings.maxLines > Benchmark::MAX_PARSER_LINES) {
+        std::cerr << "--parsers holds every line in memory, so --max-lines can be at most " << Benchmark::MAX_PARSER_LINES
+                  << "." << std::endl;
+        Benchmark::printUsage(std::cerr, argv[0]);
+        return 2;
+    }
+
+    PerfCounters counters;
+    if (settings.perf) {
+        if (counters.open()) {
+            Benchmark::counters = &counters;
+        } else {
+            std::cerr << "Could not open any hardware performance counters, carrying on without them." << std::endl;
+        }
+    }
+
+    if (settings.parsers) {
+        std::vector<std::pair<const char*, const char*>> trickyLines;
+        for (const char* line : Benchmark::TRICKY_LINES) trickyLines.emplace_back(line, line + std::strlen(line));
+        std::cout << "Checking parser agreement on " << trickyLines.size() << " awkward lines." << std::endl;
+        uint64_t disagreements = Benchmark::checkAgreement(trickyLines);
+
+        Benchmark::printHeader();
+        for (uint64_t lines = std::max<uint64_t>(settings.minLines, 1); lines <= settings.maxLines; lines *= 10) {
+            if (!Benchmark::runParsersForSize(settings, lines, disagreements)) return 1;
+        }
+        return disagreements > 0 ? 1 : 0;
+    }
+
+    Benchmark::printHeader();
+    for (uint64_t lines = std::max<uint64_t>(settings.minLines, 1); lines <= settings.maxLines; lines *= 10) {
+        if (!Benchmark::runForSize(settings, lines)) return 1;
+    }
+    return 0;
+}
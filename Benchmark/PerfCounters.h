@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+/// Hardware performance counters read through perf_event_open, for telling whether a kernel is limited by
+/// branches or by memory. Only works on Linux; everywhere else nothing opens and every counter reads as
+/// unavailable. Even on Linux some counters may not be there, for example inside a virtual machine or when
+/// perf_event_paranoid forbids it, so whichever of them open are used and the rest read as unavailable.
+///
+/// The counters follow every thread the calling thread starts after they're opened, and add in what those threads
+/// counted once they exit, so kernels that spread their work over threads (and join them before returning) are
+/// counted in full. They're opened as one group, so they're all counting over exactly the same stretch of time.
+/// When the processor has fewer counters than were asked for, the kernel takes turns with them, and the counts are
+/// scaled up by how much of the time they were really counting.
+class PerfCounters {
+public:
+    enum class Event { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, COUNT };
+
+    /// Counts over one or more measured regions.
+    struct Values {
+        uint64_t counts[(size_t)Event::COUNT] = {};
+        bool     isAvailable[(size_t)Event::COUNT] = {};
+
+        uint64_t get(Event event) const { return counts[(size_t)event]; }
+        bool has(Event event) const { return isAvailable[(size_t)event]; }
+
+        void add(const Values& other) {
+            for (size_t i = 0; i < (size_t)Event::COUNT; ++i) {
+                counts[i] += other.counts[i];
+                isAvailable[i] = other.isAvailable[i];
+            }
+        }
+    };
+
+    PerfCounters() = default;
+    ~PerfCounters() {
+        close();
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // Opens whichever counters this machine allows, for the calling thread and the threads it goes on to start.
+    // Returns false if none could be opened.
+    bool open() {
+        close();
+#if defined(__linux__)
+        // A group that won't fit on the processor at all never counts anything, so leave counters off the end
+        // until it does.
+        for (size_t wanted = (size_t)Event::COUNT; wanted > 0; --wanted) {
+            if (!openGroup(wanted)) return false;
+            if (isCounting()) return true;
+            close();
+        }
+#endif
+        return false;
+    }
+
+    void close() {
+#if defined(__linux__)
+        for (int& descriptor : m_descriptors) {
+            if (descriptor >= 0) ::close(descriptor);
+            descriptor = -1;
+        }
+        m_leader = -1;
+        m_memberCount = 0;
+#endif
+    }
+
+    // Starts every open counter.
+    void start() {
+#if defined(__linux__)
+        if (m_leader < 0) return;
+        // The kernel never resets the times a counter's been enabled and running, so the counts are taken as
+        // differences from here too.
+        m_isStarted = readGroup(m_startCounts, m_startEnabled, m_startRunning);
+        ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+    }
+
+    // Stops every open counter and reads what it counted since start.
+    Values stop() {
+        Values values;
+#if defined(__linux__)
+        if (m_leader < 0) return values;
+        ioctl(m_leader, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+        uint64_t counts[(size_t)Event::COUNT];
+        uint64_t enabled, running;
+        if (!m_isStarted || !readGroup(counts, enabled, running)) return values;
+        enabled -= m_startEnabled;
+        running -= m_startRunning;
+        if (running == 0) return values; // Never got onto the processor, so there's nothing to scale up.
+
+        double scale = (double)enabled / (double)running;
+        for (size_t i = 0; i < m_memberCount; ++i) {
+            size_t event = (size_t)m_members[i];
+            values.counts[event]      = (uint64_t)((double)(counts[i] - m_startCounts[i]) * scale + 0.5);
+            values.isAvailable[event] = true;
+        }
+#endif
+        return values;
+    }
+
+private:
+#if defined(__linux__)
+    // Opens the first wanted counters that this machine allows as a group. Returns false if none would open.
+    bool openGroup(size_t wanted) {
+        static const uint64_t CONFIGS[] = {
+            PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+        };
+        for (size_t i = 0; i < (size_t)Event::COUNT && m_memberCount < wanted; ++i) {
+            perf_event_attr attributes{};
+            attributes.type           = PERF_TYPE_HARDWARE;
+            attributes.size           = sizeof(attributes);
+            attributes.config         = CONFIGS[i];
+            attributes.disabled       = m_leader < 0 ? 1 : 0; // The rest start and stop with the leader.
+            attributes.inherit        = 1;
+            attributes.exclude_kernel = 1; // Also lets it work with perf_event_paranoid at 2.
+            attributes.exclude_hv     = 1;
+            attributes.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+            m_descriptors[i] = (int)syscall(SYS_perf_event_open, &attributes, 0, -1, m_leader, 0);
+            if (m_descriptors[i] < 0) continue;
+            if (m_leader < 0) m_leader = m_descriptors[i];
+            m_members[m_memberCount++] = (Event)i;
+        }
+        return m_leader >= 0;
+    }
+
+    // Whether the group gets onto the processor at all.
+    bool isCounting() {
+        start();
+        Values values = stop();
+        for (bool isAvailable : values.isAvailable) {
+            if (isAvailable) return true;
+        }
+        return false;
+    }
+
+    // Reads the whole group at once: the times it's been enabled and running, and each member's count in the
+    // order they joined.
+    bool readGroup(uint64_t* counts, uint64_t& enabled, uint64_t& running) {
+        uint64_t buffer[3 + (size_t)Event::COUNT];
+        ssize_t expected = (ssize_t)((3 + m_memberCount) * sizeof(uint64_t));
+        if (read(m_leader, buffer, sizeof(buffer)) != expected || buffer[0] != m_memberCount) return false;
+
+        enabled = buffer[1];
+        running = buffer[2];
+        for (size_t i = 0; i < m_memberCount; ++i) counts[i] = buffer[3 + i];
+        return true;
+    }
+
+    int m_descriptors[(size_t)Event::COUNT] = { -1, -1, -1, -1 };
+    int m_leader = -1;
+    Event  m_members[(size_t)Event::COUNT] = {}; // Which event each member of the group counts, in joining order.
+    size_t m_memberCount = 0;
+
+    uint64_t m_startCounts[(size_t)Event::COUNT] = {};
+    uint64_t m_startEnabled = 0;
+    uint64_t m_startRunning = 0;
+    bool     m_isStarted    = false;
+#endif
+};
@@ -0,0 +1,211 @@
+#include <cmath>
+#include <cctype>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <cstdint>
+#include <cfloat>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+
+#include "DatasetGenerator.h"
+#include "SharedRing.h"
+
+// Reads an argument that must be a whole number no bigger than max, returning false if it isn't one.
+bool parseCount(const char* text, uint64_t max, uint64_t& value) {
+    // strtoull skips leading space and takes a minus sign as wrapping round, so insist on a digit first.
+    if (!std::isdigit((unsigned char)text[0])) return false;
+    char* valueEnd = nullptr;
+    unsigned long long parsed = std::strtoull(text, &valueEnd, 10);
+    if (*valueEnd != '\0' || parsed > max) return false;
+    value = parsed;
+    return true;
+}
+
+bool parseCount(const char* text, unsigned max, unsigned& value) {
+    uint64_t parsed = 0;
+    if (!parseCount(text, max, parsed)) return false;
+    value = (unsigned)parsed;
+    return true;
+}
+
+// Reads an argument that must be a finite number between min and max, returning false if it isn't one.
+bool parseNumber(const char* text, double min, double max, double& value) {
+    char* valueEnd = nullptr;
+    double parsed = std::strtod(text, &valueEnd);
+    if (text[0] == '\0' || *valueEnd != '\0' || !std::isfinite(parsed) || parsed < min || parsed > max) return false;
+    value = parsed;
+    return true;
+}
+
+void printUsage(std::ostream& out, const char* program) {
+    out << "Usage: " << program << " [options] <output file, or - for standard output>" << std::endl
+        << "       " << program << " [options] --shm <name>" << std::endl
+        << std::endl
+        << "Writes a synthetic charge data set: charges are n * e plus Gaussian noise, with n drawn" << std::endl
+        << "uniformly between the minimum and maximum multiples." << std::endl
+        << std::endl
+        << "Options:" << std::endl
+        << "  --lines <n>              Number of data points (default 1000000)." << std::endl
+        << "  --seed <n>               Seed, the same seed always gives the same file (default 1)." << std::endl
+        << "  --charge <e>             Elementary charge (default 1.60218)." << std::endl
+        << "  --min-multiple <n>       Smallest multiple of e (default 1)." << std::endl
+        << "  --max-multiple <n>       Largest multiple of e (default 1)." << std::endl
+        << "  --noise <sigma>          Standard deviation of the noise (default 0.1)." << std::endl
+        << "  --decimals <n>           Decimal places written, up to 9 (default 5)." << std::endl
+        << "  --corrupt-fraction <f>   Fraction of lines that are corrupt, from 0 to 1 (default 0)." << std::endl
+        << "  --crlf                   Use Windows line endings." << std::endl
+        << "  --odd-whitespace         Surround values with random runs of spaces and tabs." << std::endl
+        << "  --binary                 Write packed little-endian doubles instead of text." << std::endl
+        << "  --threads <n>            Threads to generate with (default all hardware threads)." << std::endl
+        << "  --shm <name>             Stand in for a live instrument: write the charges into the shared-memory" << std::endl
+        << "                           ring <name> (always as doubles) for Assignment2 --shm to take." << std::endl
+        << "  --rate <n>               With --shm, write about <n> charges a second (default as fast as the" << std::endl
+        << "                           reader takes them)." << std::endl;
+}
+
+// Writes the data set into a shared-memory ring a slice at a time, as an instrument would, then waits for it to
+// be read. Returns false if the ring couldn't be created.
+bool produce(const DatasetGenerator::Settings& settings, const std::string& name, double rate) {
+    SharedRing::Producer ring;
+    if (!ring.create(name)) return false;
+
+    const size_t SLICE_CHARGES = 4096;
+    auto start = std::chrono::steady_clock::now();
+    std::string chunk;
+    for (uint64_t index = 0; index < DatasetGenerator::getChunkCount(settings); ++index) {
+        chunk.clear();
+        DatasetGenerator::generateChunk(settings, index, chunk);
+        const double* charges = reinterpret_cast<const double*>(chunk.data());
+        size_t count = chunk.size() / sizeof(double);
+
+        for (size_t offset = 0; offset < count; offset += SLICE_CHARGES) {
+            ring.write(charges + offset, std::min(SLICE_CHARGES, count - offset));
+            if (rate > 0.0) {
+                // Hold back to the rate asked for, going by the total so far so rounding doesn't build up.
+                std::this_thread::sleep_until(start + std::chrono::duration<double>((double)ring.getWrittenCount() / rate));
+            }
+        }
+    }
+    ring.finish();
+    ring.waitUntilRead();
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    DatasetGenerator::Settings settings;
+    unsigned threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::string outputPath;
+    std::string sharedRing;
+    double rate = 0.0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        bool hasValue = i + 1 < argc;
+        bool isValid = true;
+        if (argument == "--lines" && hasValue) {
+            isValid = parseCount(argv[++i], UINT64_MAX, settings.lines);
+        } else if (argument == "--seed" && hasValue) {
+            isValid = parseCount(argv[++i], UINT64_MAX, settings.seed);
+        } else if (argument == "--charge" && hasValue) {
+            isValid = parseNumber(argv[++i], -DBL_MAX, DBL_MAX, settings.elementaryCharge);
+        } else if (argument == "--min-multiple" && hasValue) {
+            isValid = parseCount(argv[++i], UINT_MAX, settings.minMultiple);
+        } else if (argument == "--max-multiple" && hasValue) {
+            isValid = parseCount(argv[++i], UINT_MAX, settings.maxMultiple);
+        } else if (argument == "--noise" && hasValue) {
+            isValid = parseNumber(argv[++i], 0.0, DBL_MAX, settings.noise);
+        } else if (argument == "--decimals" && hasValue) {
+            isValid = parseCount(argv[++i], DatasetGenerator::MAX_DECIMALS, settings.decimals);
+        } else if (argument == "--corrupt-fraction" && hasValue) {
+            isValid = parseNumber(argv[++i], 0.0, 1.0, settings.corruptFraction);
+        } else if (argument == "--crlf") {
+            settings.crlf = true;
+        } else if (argument == "--odd-whitespace") {
+            settings.oddWhitespace = true;
+        } else if (argument == "--binary") {
+            settings.binary = true;
+        } else if (argument == "--threads" && hasValue) {
+            isValid = parseCount(argv[++i], UINT_MAX, threads);
+        } else if (argument == "--shm" && hasValue) {
+            sharedRing = argv[++i];
+        } else if (argument == "--rate" && hasValue) {
+            isValid = parseNumber(argv[++i], 0.0, DBL_MAX, rate);
+        } else if (argument == "-h" || argument == "--help") {
+            printUsage(std::cout, argv[0]);
+            return 0;
+        } else if (outputPath.empty() && (argument == "-" || argument[0] != '-')) {
+            outputPath = argument;
+        } else {
+            printUsage(std::cerr, argv[0]);
+            return 2;
+        }
+        if (!isValid) {
+            std::cerr << "Invalid value for " << argument << ": " << argv[i] << "." << std::endl;
+            printUsage(std::cerr, argv[0]);
+            return 2;
+        }
+    }
+    if (!sharedRing.empty()) {
+        if (!outputPath.empty()) {
+            printUsage(std::cerr, argv[0]);
+            return 2;
+        }
+        settings.binary = true;
+
+        auto start = std::chrono::steady_clock::now();
+        if (!produce(settings, sharedRing, rate)) {
+            std::cerr << "Could not create shared ring: " << sharedRing << "." << std::endl;
+            return 1;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        std::cerr << "Wrote " << settings.lines << " data points into " << sharedRing << " in " << seconds << "s." << std::endl;
+        return 0;
+    }
+    if (outputPath.empty()) {
+        printUsage(std::cerr, argv[0]);
+        return 2;
+    }
+    if (!settings.binary && !DatasetGenerator::isWritableAsText(settings)) {
+        std::cerr << "Charges this big can't be written exactly with " << settings.decimals << " decimals. "
+                  << "Lower --charge, --max-multiple, --noise or --decimals, or use --binary." << std::endl;
+        printUsage(std::cerr, argv[0]);
+        return 2;
+    }
+
+    std::ofstream file;
+    if (outputPath != "-") {
+        file.open(outputPath, std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file.is_open()) {
+            std::cerr << "Could not open output file: " << outputPath << "." << std::endl;
+            return 1;
+        }
+    } else {
+        std::ios::sync_with_stdio(false);
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::ostream& out = file.is_open() ? file : std::cout;
+    uint64_t bytes = DatasetGenerator::write(settings, out, threads);
+    if (file.is_open()) file.close();
+    if (out.fail()) {
+        std::string target = outputPath == "-" ? std::string("standard output") : outputPath;
+        std::cerr << "Could not write the data set to " << target << "." << std::endl;
+        return 1;
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::cerr << "Wrote " << settings.lines << " data points (" << bytes << " bytes) in " << seconds << "s, "
+              << (seconds > 0.0 ? (double)bytes / seconds / 1e9 : 0.0) << " GB/s." << std::endl;
+    return 0;
+}
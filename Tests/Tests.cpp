@@ -0,0 +1,406 @@
+#include <cmath>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <system_error>
+#include <algorithm>
+
+#include "ChargePack.h"
+#include "ChargeParser.h"
+#include "DataAnalysis.h"
+#include "FixedPoint.h"
+#include "Incremental.h"
+#include "ResultCache.h"
+
+/// Regression tests for the parts of the loader and analysis that have to give exactly the right answer, not just
+/// a fast one. Run it with no arguments, it exits with 1 if any check fails.
+namespace Tests {
+    uint64_t checks   = 0;
+    uint64_t failures = 0;
+
+// Counts a check, reporting it if it doesn't hold. Carries on either way, so one run shows every failure.
+#define CHECK(condition) Tests::check((condition), #condition, __FILE__, __LINE__)
+
+    inline bool check(bool isTrue, const char* condition, const char* file, int line) {
+        ++checks;
+        if (!isTrue) {
+            ++failures;
+            std::cerr << file << ":" << line << ": check failed: " << condition << std::endl;
+        }
+        return isTrue;
+    }
+
+    // Somewhere to put files, cleared out when done.
+    class Directory {
+    public:
+        Directory() {
+            m_path = std::filesystem::temp_directory_path()
+                   / ("millikan_tests_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+            std::error_code error;
+            std::filesystem::remove_all(m_path, error);
+            std::filesystem::create_directories(m_path);
+        }
+        ~Directory() {
+            std::error_code error;
+            std::filesystem::remove_all(m_path, error);
+        }
+
+        std::string getPath(const std::string& name) const {
+            return (m_path / name).string();
+        }
+    private:
+        std::filesystem::path m_path;
+    };
+
+    inline void writeFile(const std::string& path, const std::string& contents) {
+        std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+        out << contents;
+    }
+    inline void appendFile(const std::string& path, const std::string& contents) {
+        std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::app);
+        out << contents;
+    }
+
+    inline bool isSameDouble(double a, double b) {
+        return std::memcmp(&a, &b, sizeof(a)) == 0;
+    }
+
+    // Every backend must accept exactly the lines stringstream does and give bit-identical charges, and every
+    // charge must be the correctly rounded one (which is what strtod gives).
+    inline void testParsers() {
+        struct Case {
+            const char* line;
+            bool        isCharge;
+        };
+        const Case CASES[] = {
+            { "", false }, { " ", false }, { "\t\r", false }, { "error", false }, { "nan", false }, { "inf", false },
+            { "infinity", false }, { "-inf", false }, { "0x10", false }, { "0x1p3", false }, { "1.2.3", false },
+            { "1.5 1.6", false }, { "#####", false }, { "-1.00000", false }, { "+-1", false }, { "-+1", false },
+            { ".", false }, { "+.", false }, { "1e", false }, { "1e+", false }, { "e5", false }, { ".e5", false },
+            { "1.5e3x", false }, { "1,5", false }, { "1e400", false }, { "1.7976931348623159e308", false },
+            { "0", true }, { "-0", true }, { "-0.0", true }, { "+0", true }, { "+1.5", true }, { ".5", true },
+            { "5.", true }, { "1e5", true }, { "1E-5", true }, { "  1.60218  ", true }, { "\t1.60218\r", true },
+            { "00001.60218000", true }, { "4.9e-324", true }, { "2.2250738585072011e-308", true },
+            { "1.7976931348623157e308", true }, { "9007199254740993", true }, { "9007199254740993.0", true },
+            { "0.1000000000000000055511151231257827", true }, { "123456789012345678901234567890", true },
+            { "1234567890123456", true }, { "12345678.12345678", true }, { "0.0000000000000000000000001", true },
+            { "1.60217662e-19", true }, { "0.30000000000000004", true }
+        };
+
+        for (const Case& test : CASES) {
+            const char* const end = test.line + std::strlen(test.line);
+            double expected = std::strtod(test.line, nullptr);
+            for (size_t b = 0; b < (size_t)ChargeParser::Backend::COUNT; ++b) {
+                auto backend = (ChargeParser::Backend)b;
+                double charge = -1.0;
+                bool isCharge = ChargeParser::parse(backend, test.line, end, charge);
+                bool isRight = CHECK(isCharge == test.isCharge) && (!isCharge || CHECK(isSameDouble(charge, expected)));
+                if (!isRight) {
+                    std::cerr << "  " << ChargeParser::getName(backend) << " on \"" << test.line << "\"" << std::endl;
+                }
+            }
+        }
+
+        // A line is only what's between begin and end, whatever follows it in memory.
+        const char* const BUFFER = "1.5x2";
+        for (size_t b = 0; b < (size_t)ChargeParser::Backend::COUNT; ++b) {
+            double charge = -1.0;
+            CHECK(ChargeParser::parse((ChargeParser::Backend)b, BUFFER, BUFFER + 3, charge) && charge == 1.5);
+            CHECK(!ChargeParser::parse((ChargeParser::Backend)b, BUFFER, BUFFER + 4, charge));
+        }
+
+        std::string line = "  2.5\r";
+        double charge = 0.0;
+        CHECK(ChargeParser::parseLine(line, charge) && charge == 2.5);
+    }
+
+    // Resuming from the state file must give the same statistics as analysing the whole file afresh.
+    inline void testIncremental(const Directory& directory) {
+        std::string path = directory.getPath("incremental.dat");
+        Incremental::Outcome outcome;
+
+        writeFile(path, "1.0\n2.0\nerror\n");
+        CHECK(Incremental::analyseFile(path, outcome, false));
+        CHECK(!outcome.resumed);
+        CHECK(outcome.accumulator.getCount() == 2 && outcome.corruptCount == 1);
+        CHECK(outcome.accumulator.getMean() == 1.5);
+
+        // Nothing new, everything comes from the state file.
+        CHECK(Incremental::analyseFile(path, outcome, false));
+        CHECK(outcome.resumed);
+        CHECK(outcome.accumulator.getCount() == 2 && outcome.corruptCount == 1);
+
+        // A last line without its newline isn't a data point yet, and is picked up once it's finished.
+        appendFile(path, "3.0\n4.0");
+        CHECK(Incremental::analyseFile(path, outcome, false));
+        CHECK(outcome.resumed);
+        CHECK(outcome.accumulator.getCount() == 3 && outcome.corruptCount == 1);
+        appendFile(path, "\n");
+        CHECK(Incremental::analyseFile(path, outcome, false));
+        CHECK(outcome.resumed);
+        CHECK(outcome.accumulator.getCount() == 4);
+        CHECK(outcome.accumulator.getMean() == 2.5);
+
+        // A different start: the saved state no longer applies.
+        writeFile(path, "9.0\n2.0\nerror\n3.0\n4.0\n");
+        CHECK(Incremental::analyseFile(path, outcome, false));
+        CHECK(!outcome.resumed);
+        CHECK(outcome.accumulator.getCount() == 4 && outcome.corruptCount == 1);
+        CHECK(outcome.accumulator.getMean() == 4.5);
+
+        // Shorter than the state says it got through.
+        writeFile(path, "7.0\n");
+        CHECK(Incremental::analyseFile(path, outcome, false));
+        CHECK(!outcome.resumed);
+        CHECK(outcome.accumulator.getCount() == 1 && outcome.corruptCount == 0);
+
+        // A state file that's been cut short is ignored rather than trusted.
+        writeFile(Incremental::getStatePath(path), "CHAS");
+        CHECK(Incremental::analyseFile(path, outcome, false));
+        CHECK(!outcome.resumed);
+        CHECK(outcome.accumulator.getCount() == 1);
+
+        CHECK(!Incremental::analyseFile(directory.getPath("missing.dat"), outcome, false));
+    }
+
+    inline bool isSame(const FixedPoint::UInt128& a, const FixedPoint::UInt128& b) {
+        return a.low == b.low && a.high == b.high;
+    }
+    inline bool isSame(const FixedPoint::Sums& a, const FixedPoint::Sums& b) {
+        return a.count == b.count && isSame(a.sum, b.sum) && isSame(a.sumOfSquares, b.sumOfSquares);
+    }
+
+    // Sums worked out one charge at a time, to check the blocked ones against.
+    inline FixedPoint::Sums addUp(const FixedPoint::Charges& charges) {
+        FixedPoint::Sums sums;
+        for (size_t i = 0; i < charges.size(); ++i) {
+            sums.add(charges.getNarrow() != nullptr ? charges.getNarrow()[i] : charges.getWide()[i]);
+        }
+        return sums;
+    }
+
+    // Fixed-point sums must be exact, whatever order the charges come in and however big they get.
+    inline void testFixedPoint() {
+        FixedPoint::Charges charges;
+
+        // Only charges that scale back to the very same double, and no further than 2^53, are taken.
+        const double TOO_PRECISE[] = { 1.234567, -1.0, 1e300, 1e11 };
+        for (double charge : TOO_PRECISE) {
+            CHECK(!charges.assign(&charge, 1, 5));
+            CHECK(charges.empty());
+        }
+
+        // In floating point, (0.1 + 0.2 + 0.3) / 3 isn't 0.2, and the order matters.
+        std::vector<double> values = { 0.1, 0.2, 0.3 };
+        CHECK(charges.assign(values.data(), values.size(), 1));
+        DataAnalysis::Summary summary = FixedPoint::summarise(FixedPoint::accumulate(charges), charges.getDecimals());
+        CHECK(summary.count == 3 && summary.mean == 0.2);
+        FixedPoint::Sums forwards = FixedPoint::accumulate(charges);
+        std::reverse(values.begin(), values.end());
+        CHECK(charges.assign(values.data(), values.size(), 1));
+        CHECK(isSame(FixedPoint::accumulate(charges), forwards));
+
+        // 100, 200, 300 and 400 hundredths, a variance of exactly 5/3.
+        values = { 1.0, 2.0, 3.0, 4.0 };
+        CHECK(charges.assign(values.data(), values.size(), 2));
+        summary = FixedPoint::summarise(FixedPoint::accumulate(charges), 2);
+        CHECK(summary.mean == 2.5);
+        CHECK(std::fabs(summary.standardDeviation - std::sqrt(5.0 / 3.0)) < 1e-15);
+
+        // Charges near the top of 32 bits, where the blocked 64-bit sums of squares have to carry often.
+        values.assign(100000, 4294967295.0 / 1e3);
+        values.push_back(1.0);
+        CHECK(charges.assign(values.data(), values.size(), 3));
+        CHECK(charges.getNarrow() != nullptr && charges.getWide() == nullptr);
+        CHECK(isSame(FixedPoint::accumulate(charges), addUp(charges)));
+
+        // One charge too big for 32 bits moves the lot to 64, keeping everything before it.
+        charges.start(3, 4);
+        CHECK(charges.add(1.5) && charges.add(2.5));
+        CHECK(charges.getNarrow() != nullptr);
+        CHECK(charges.add(9007199254740.992));
+        CHECK(charges.add(0.001));
+        charges.finish();
+        CHECK(charges.getWide() != nullptr && charges.getNarrow() == nullptr);
+        CHECK(charges.size() == 4 && charges.getMaximum() == 9007199254740992ULL);
+        CHECK(charges.getWide()[0] == 1500 && charges.getWide()[1] == 2500 && charges.getWide()[3] == 1);
+        CHECK(isSame(FixedPoint::accumulate(charges), addUp(charges)));
+        // The mean of values summing past 2^53 still comes out correctly rounded.
+        summary = FixedPoint::summarise(FixedPoint::accumulate(charges), 3);
+        CHECK(summary.mean == (9007199254740992.0 + 4001.0) / 4000.0);
+
+        std::vector<double> back;
+        charges.appendTo(back);
+        CHECK(back.size() == 4 && back[0] == 1.5 && back[2] == 9007199254740.992 && back[3] == 0.001);
+
+        // A range takes exactly the charges whose doubles it contains, both ends included.
+        values = { 0.1, 0.15, 0.2, 0.25, 0.3 };
+        CHECK(charges.assign(values.data(), values.size(), 2));
+        DataAnalysis::Range range;
+        range.lower = 0.15;
+        range.upper = 0.25;
+        FixedPoint::Sums inRange = FixedPoint::accumulate(charges, FixedPoint::getScaledRange(range, 2));
+        CHECK(inRange.count == 3 && inRange.sum.low == 60);
+        range.lower = 0.151;
+        range.upper = 0.249;
+        CHECK(FixedPoint::accumulate(charges, FixedPoint::getScaledRange(range, 2)).count == 1);
+        range.lower = 0.31;
+        range.upper = 1.0;
+        CHECK(FixedPoint::accumulate(charges, FixedPoint::getScaledRange(range, 2)).count == 0);
+        CHECK(FixedPoint::summarise(FixedPoint::Sums(), 2).count == 0);
+    }
+
+    // Packs the charges, checking they decode back to the very same doubles and summarise from the headers
+    // exactly as the fixed-point charges themselves do. Returns each block's bit width, for checking the blocks
+    // came out as meant.
+    inline std::vector<uint32_t> checkRoundTrip(const Directory& directory, const std::vector<double>& values,
+                                                unsigned decimals) {
+        std::vector<uint32_t> bits;
+        FixedPoint::Charges charges;
+        if (!CHECK(charges.assign(values.data(), values.size(), decimals))) return bits;
+
+        std::string path = directory.getPath("round_trip.cpk");
+        CHECK(ChargePack::write(path, charges, 7));
+        ChargePack::Reader reader;
+        std::string error;
+        if (!CHECK(reader.open(path, error))) return bits;
+        for (size_t i = 0; i < reader.getBlockCount(); ++i) bits.push_back(reader.getBlock(i).bits);
+        CHECK(reader.getHeader().count == values.size() && reader.getHeader().corruptCount == 7);
+        CHECK(reader.getBlockCount() == (values.size() + ChargePack::BLOCK_SIZE - 1) / ChargePack::BLOCK_SIZE);
+
+        std::vector<double> decoded;
+        reader.decodeAll(decoded);
+        CHECK(decoded.size() == values.size());
+        size_t mismatches = 0;
+        for (size_t i = 0; i < std::min(decoded.size(), values.size()); ++i) {
+            if (!isSameDouble(decoded[i], values[i])) ++mismatches;
+        }
+        CHECK(mismatches == 0);
+
+        CHECK(isSame(reader.getSums(), FixedPoint::accumulate(charges)));
+        DataAnalysis::Summary summary = reader.summarise();
+        DataAnalysis::Summary expected = FixedPoint::summarise(FixedPoint::accumulate(charges), decimals);
+        CHECK(summary.count == expected.count && isSameDouble(summary.mean, expected.mean));
+        CHECK(isSameDouble(summary.standardDeviation, expected.standardDeviation) && summary.corruptCount == 7);
+
+        // Ranges that cut through blocks, cover them or miss them all.
+        const double BOUNDS[][2] = {
+            { 0.0, HUGE_VAL }, { 1.5, 1.7 }, { 1.60218, 1.60218 }, { 0.0, 1.0 }, { 1e12, HUGE_VAL }
+        };
+        for (const auto& bounds : BOUNDS) {
+            DataAnalysis::Range range;
+            range.lower = bounds[0];
+            range.upper = bounds[1];
+            FixedPoint::ScaledRange scaled = FixedPoint::getScaledRange(range, decimals);
+            CHECK(isSame(reader.getSums(scaled), FixedPoint::accumulate(charges, scaled)));
+        }
+        return bits;
+    }
+
+    // Charge packs must give back exactly what went in, however the blocks come out.
+    inline void testChargePack(const Directory& directory) {
+        // Narrow blocks, the last one short.
+        std::vector<double> values;
+        uint64_t state = 1;
+        for (size_t i = 0; i < 3 * ChargePack::BLOCK_SIZE - 77; ++i) {
+            state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+            values.push_back((double)(150000 + (state >> 40) % 20000) / 1e5);
+        }
+        std::vector<uint32_t> bits = checkRoundTrip(directory, values, 5);
+        CHECK(bits.size() == 3 && bits[0] > 0 && bits[0] <= 32 && bits[2] > 0 && bits[2] <= 32);
+
+        // A single short block, and a block where every charge is the same so there are no bits to pack.
+        checkRoundTrip(directory, { 1.60218 }, 5);
+        bits = checkRoundTrip(directory, std::vector<double>(ChargePack::BLOCK_SIZE + 3, 1.60218), 5);
+        CHECK(bits.size() == 2 && bits[0] == 0 && bits[1] == 0);
+
+        // Wide: a block spread too far for 32-bit offsets, between narrow ones.
+        std::vector<double> wide = values;
+        wide[ChargePack::BLOCK_SIZE + 5] = 9e10;
+        wide[ChargePack::BLOCK_SIZE + 6] = 0.0;
+        bits = checkRoundTrip(directory, wide, 5);
+        CHECK(bits.size() == 3 && bits[0] <= 32 && bits[1] == ChargePack::WIDE_BITS && bits[2] <= 32);
+
+        // Nothing at all.
+        checkRoundTrip(directory, {}, 5);
+
+        // A pack cut short is turned away rather than read past its end.
+        FixedPoint::Charges charges;
+        CHECK(charges.assign(values.data(), values.size(), 5));
+        std::string path = directory.getPath("cut_short.cpk");
+        CHECK(ChargePack::write(path, charges, 0));
+        std::filesystem::resize_file(path, std::filesystem::file_size(path) - 1);
+        ChargePack::Reader reader;
+        std::string error;
+        CHECK(!reader.open(path, error) && !error.empty());
+        writeFile(path, "1.60218\n");
+        CHECK(!reader.open(path, error));
+    }
+
+    // A result must only ever come back for the very contents and options it was stored under.
+    inline void testResultCache(const Directory& directory) {
+        ResultCache cache;
+        cache.init(directory.getPath("cache"));
+        CHECK(cache.isUsable());
+
+        std::string path = directory.getPath("cached.dat");
+        writeFile(path, "1.0\n2.0\n");
+        const uint64_t OPTIONS = 42;
+
+        DataAnalysis::Summary stored;
+        stored.count = 2;
+        stored.mean  = 1.5;
+        DataAnalysis::Summary summary;
+        ResultCache::Key key;
+        CHECK(!cache.lookup(path, OPTIONS, summary, key));
+        CHECK(key.isValid);
+        cache.store(key, stored);
+
+        CHECK(cache.lookup(path, OPTIONS, summary, key));
+        CHECK(summary.count == 2 && summary.mean == 1.5);
+        CHECK(!cache.lookup(path, OPTIONS + 1, summary, key));
+
+        // Keyed on contents, so a copy elsewhere hits too.
+        std::string copyPath = directory.getPath("copy.dat");
+        writeFile(copyPath, "1.0\n2.0\n");
+        CHECK(cache.lookup(copyPath, OPTIONS, summary, key));
+
+        // Changed contents miss, even at the same size, as long as the modification time moves on.
+        auto modifiedTime = std::filesystem::last_write_time(path);
+        writeFile(path, "1.0\n3.0\n");
+        std::filesystem::last_write_time(path, modifiedTime + std::chrono::seconds(10));
+        CHECK(!cache.lookup(path, OPTIONS, summary, key));
+        CHECK(key.isValid);
+
+        appendFile(path, "4.0\n");
+        CHECK(!cache.lookup(path, OPTIONS, summary, key));
+
+        // Back to the original contents, and the original result.
+        writeFile(path, "1.0\n2.0\n");
+        std::filesystem::last_write_time(path, modifiedTime + std::chrono::seconds(20));
+        CHECK(cache.lookup(path, OPTIONS, summary, key));
+
+        CHECK(!cache.lookup(directory.getPath("missing.dat"), OPTIONS, summary, key));
+        CHECK(!key.isValid);
+    }
+}
+
+int main() {
+    {
+        Tests::Directory directory;
+        Tests::testParsers();
+        Tests::testIncremental(directory);
+        Tests::testResultCache(directory);
+        Tests::testFixedPoint();
+        Tests::testChargePack(directory);
+    }
+
+    std::cout << Tests::checks << " checks, " << Tests::failures << " failed." << std::endl;
+    return Tests::failures > 0 ? 1 : 0;
+}